@@ -0,0 +1,98 @@
+#version 430 core
+// Frustum culling of the opaque draws of a RenderQueue, see render_cull.h.
+// Each draw's command is copied to the output with instanceCount set to 0 if
+// its bounding sphere is outside of the frustum, so the draws keep their
+// place in the indirect buffer and the CPU side runs don't change.
+// The LOD is picked from the sphere's height on screen, like SelectLOD() in
+// render_queue.cpp but without hysteresis. Draws in nodes that occlusion
+// queries found hidden in this view are culled too, see render_occlusion.h.
+
+layout (local_size_x = 64) in;
+
+struct CullDraw {
+    // xyz: world space centre, w: radius
+    vec4 sphere;
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+    uint numLODs;
+    // Index of the draw's node in occludedNodes
+    uint node;
+    // 1 for static draws, see DrawPacket::mStatic
+    uint isStatic;
+    // x: first index, y: number of indices
+    uvec2 lods[MAX_MESH_LODS];
+};
+
+layout (std430, binding = 0) readonly buffer CullDraws {
+    CullDraw draws[];
+};
+
+// DrawElementsIndirectCommand, 5 uints each
+layout (std430, binding = 1) writeonly buffer Commands {
+    uint commands[];
+};
+
+// Non-zero for nodes hidden in this view
+layout (std430, binding = 2) readonly buffer OccludedNodes {
+    uint occludedNodes[];
+};
+
+uniform vec4 planes[6];
+uniform int firstDraw;
+uniform int numDraws;
+// 0 draws everything, e.g. when frustum culling is off in the debug GUI
+uniform int cullEnabled;
+// 0 ignores occludedNodes, e.g. in shadow passes
+uniform int occlusionEnabled;
+// ShadowCasters in render_queue.h: 0 all, 1 static only, 2 dynamic only
+uniform int casters;
+// 0 always draws LOD 0
+uniform int lodEnabled;
+uniform mat4 lodViewProj;
+uniform vec4 lodThresholds;
+uniform int lodBias;
+
+uint SelectLOD(CullDraw draw)
+{
+    if (lodEnabled == 0 || draw.numLODs <= 1u) return 0u;
+    vec4 clip = lodViewProj * vec4(draw.sphere.xyz, 1.0);
+    float scaleY = length(vec3(lodViewProj[0][1], lodViewProj[1][1], lodViewProj[2][1]));
+    float size = draw.sphere.w * scaleY / max(clip.w, 0.001);
+    uint level = 0u;
+    while (level + 1u < draw.numLODs && size < lodThresholds[level + 1u]) {
+        level++;
+    }
+    return min(level + uint(lodBias), draw.numLODs - 1u);
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(numDraws)) return;
+    uint idx = uint(firstDraw) + i;
+    CullDraw draw = draws[idx];
+
+    bool visible = casters == 0 || (draw.isStatic != 0u) == (casters == 1);
+    if (cullEnabled != 0) {
+        for (int p = 0; p < 6; p++) {
+            if (dot(planes[p].xyz, draw.sphere.xyz) + planes[p].w < -draw.sphere.w) {
+                visible = false;
+            }
+        }
+        if (occlusionEnabled != 0 && occludedNodes[draw.node] != 0u) {
+            visible = false;
+        }
+    }
+
+    uvec2 lod = draw.numLODs > 0u ? draw.lods[SelectLOD(draw)]
+                                  : uvec2(draw.firstIndex, draw.count);
+    uint base = idx * 5u;
+    commands[base + 0u] = lod.y;
+    commands[base + 1u] = visible ? draw.instanceCount : 0u;
+    commands[base + 2u] = lod.x;
+    commands[base + 3u] = uint(draw.baseVertex);
+    commands[base + 4u] = draw.baseInstance;
+}
@@ -0,0 +1,59 @@
+#version 330 core
+
+// Lighting pass of the deferred renderer, see render_deferred.h. Drawn over
+// the viewport of a view with the defines of the view's PBR shader variant,
+// and lit by the same code as the forward shader (lighting.glsl).
+
+in vec2 TexCoords;
+
+out vec4 FragColor;
+
+// The G-buffer, see fragment.glsl with GBUFFER
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+// Inverse of the (jittered) projection * view the G-buffer was drawn with
+uniform mat4 invViewProj;
+
+#include "lighting.glsl"
+
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    // Nothing was drawn here. The skybox fills it in after this pass.
+    if (depth == 1.0) {
+        discard;
+    }
+    vec3 albedo = texelFetch(gAlbedo, texel, 0).rgb;
+
+#ifdef LIGHTING
+    vec2 ndc = (gl_FragCoord.xy - viewport.xy) / viewport.zw * 2.0 - 1.0;
+    vec4 position = invViewProj * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    vec2 material = texelFetch(gMaterial, texel, 0).xy;
+
+    Surface surface;
+    surface.position = position.xyz / position.w;
+    surface.normal = DecodeNormal(texelFetch(gNormal, texel, 0).xy);
+    surface.albedo = albedo;
+    surface.roughness = material.x;
+    surface.metallic = material.y;
+
+    vec3 viewDir = normalize(camPos.xyz - surface.position);
+
+    // Outgoing radiance
+    vec3 Lo = CalcDirLight(dirLight, surface, viewDir);
+#ifdef LOCAL_LIGHTS
+    Lo += CalcLocalLights(surface, viewDir);
+#endif
+
+    vec3 ambient = vec3(0.01) * albedo;
+    vec3 result  = ambient + Lo;
+#else
+    vec3 result = albedo;
+#endif
+
+    FragColor = vec4(result, 1.0);
+}
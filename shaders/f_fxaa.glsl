@@ -0,0 +1,68 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// Tonemapped and gamma corrected scene, bilinear filtered
+uniform sampler2D screenTexture;
+
+// Lowest contrast between the pixel and its neighbours that counts as an edge
+const float EDGE_THRESHOLD = 1.0 / 8.0;
+const float EDGE_THRESHOLD_MIN = 1.0 / 32.0;
+// Longest distance in pixels to search along an edge
+const float SPAN_MAX = 8.0;
+const float REDUCE_MUL = 1.0 / 8.0;
+const float REDUCE_MIN = 1.0 / 128.0;
+
+float Luma(vec3 col)
+{
+    return dot(col, vec3(0.299, 0.587, 0.114));
+}
+
+
+// Based on the FXAA 3.11 console version by Timothy Lottes
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(screenTexture, 0));
+    vec3 rgbM  = texture(screenTexture, TexCoords).rgb;
+    vec3 rgbNW = texture(screenTexture, TexCoords + vec2(-0.5, -0.5) * texelSize).rgb;
+    vec3 rgbNE = texture(screenTexture, TexCoords + vec2( 0.5, -0.5) * texelSize).rgb;
+    vec3 rgbSW = texture(screenTexture, TexCoords + vec2(-0.5,  0.5) * texelSize).rgb;
+    vec3 rgbSE = texture(screenTexture, TexCoords + vec2( 0.5,  0.5) * texelSize).rgb;
+    float lumaM  = Luma(rgbM);
+    float lumaNW = Luma(rgbNW);
+    float lumaNE = Luma(rgbNE);
+    float lumaSW = Luma(rgbSW);
+    float lumaSE = Luma(rgbSE);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    // Most pixels aren't on an edge.
+    if (lumaMax - lumaMin < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD)) {
+        FragColor = vec4(rgbM, 1.0);
+        return;
+    }
+
+    // Blur along the edge, perpendicular to the gradient
+    vec2 dir;
+    dir.x = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+    dir.y =  ((lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 * REDUCE_MUL),
+                          REDUCE_MIN);
+    float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+    dir = clamp(dir * rcpDirMin, vec2(-SPAN_MAX), vec2(SPAN_MAX)) * texelSize;
+
+    vec3 rgbA = 0.5 * (
+            texture(screenTexture, TexCoords + dir * (1.0 / 3.0 - 0.5)).rgb +
+            texture(screenTexture, TexCoords + dir * (2.0 / 3.0 - 0.5)).rgb);
+    vec3 rgbB = rgbA * 0.5 + 0.25 * (
+            texture(screenTexture, TexCoords + dir * -0.5).rgb +
+            texture(screenTexture, TexCoords + dir * 0.5).rgb);
+    // The longer blur went past the edge, use the shorter one.
+    float lumaB = Luma(rgbB);
+    if (lumaB < lumaMin || lumaB > lumaMax) {
+        FragColor = vec4(rgbA, 1.0);
+    } else {
+        FragColor = vec4(rgbB, 1.0);
+    }
+}
@@ -0,0 +1,29 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2DMS sceneSamples;
+uniform int numSamples;
+// 2^exposure, the same as in f_screen.glsl
+uniform float exposureScale;
+
+float Luminance(vec3 col)
+{
+    return dot(col, vec3(0.2126, 0.7152, 0.0722));
+}
+
+
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    // Weighting by the inverse of the Reinhard curve is about the same as
+    // averaging after tonemapping, but the result is still HDR.
+    for (int i = 0; i < numSamples; i++) {
+        vec3 col = texelFetch(sceneSamples, coord, i).rgb;
+        float weight = 1.0 / (1.0 + Luminance(col * exposureScale));
+        sum += col * weight;
+        weightSum += weight;
+    }
+    FragColor = vec4(sum / weightSum, 1.0);
+}
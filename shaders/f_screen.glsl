@@ -4,14 +4,32 @@ out vec4 FragColor;
 in vec2 TexCoords;
 
 uniform sampler2D screenTexture;
+// In stops
+uniform float exposure;
+// Render::Tonemapper
+uniform int tonemapper;
+// Part of screenTexture that has the scene, less than 1 when the resolution
+// is scaled down
+uniform vec2 uvScale;
 
 const float of = 1.0 / 300.0;
-const float exposure = -1.0;
 
 
     
 vec3 EdgeDetect();
 
+
+// Fitted ACES curve by Krzysztof Narkowicz
+vec3 ACESFilm(vec3 x)
+{
+    const float a = 2.51;
+    const float b = 0.03;
+    const float c = 2.43;
+    const float d = 0.59;
+    const float e = 0.14;
+    return (x * (a * x + b)) / (x * (c * x + d) + e);
+}
+
 float near = 1.0;
 float far = 40.0;
 float LinearizeDepth(float depth)
@@ -24,14 +42,20 @@ float LinearizeDepth(float depth)
 void main()
 {
     //vec4 col = vec4(EdgeDetect(), 1.0);
-    vec3 col = texture(screenTexture, TexCoords).rgb;
+    // Don't filter in texels past the edge of the scene.
+    vec2 texelSize = 1.0 / vec2(textureSize(screenTexture, 0));
+    vec2 coords = min(TexCoords * uvScale, uvScale - 0.5 * texelSize);
+    vec3 col = texture(screenTexture, coords).rgb;
 
-    // reinhard tonemapping
-    //col = col / (col + vec3(1.0));
-    
-    // exposure tonemapping
-    //col = vec3(1.0) - exp(-col * exposure);
     col = col * pow(2, exposure);
+    if (tonemapper == 1) {
+        // Reinhard on luminance, so that colours don't lose saturation
+        float luminance = dot(col, vec3(0.2126, 0.7152, 0.0722));
+        col = col / (1.0 + luminance);
+    } else if (tonemapper == 2) {
+        col = ACESFilm(col);
+    }
+    col = clamp(col, 0.0, 1.0);
 
     // Gamma correction
     float gamma = 2.2;
@@ -0,0 +1,66 @@
+#version 330 core
+out vec4 FragColor;
+
+// This frame, drawn with the jittered projection
+uniform sampler2D currentColour;
+uniform sampler2D currentDepth;
+// Last frame's output of this pass, bilinear filtered
+uniform sampler2D history;
+// NDC and depth of this frame to the clip space of the last frame
+uniform mat4 reprojection;
+// xy: offset, zw: size of the view in pixels, in this frame and in the
+// history. They differ when the resolution scale changes.
+uniform vec4 viewRect;
+uniform vec4 prevViewRect;
+// How much of the history to keep, 0 if there is none
+uniform float historyWeight;
+// 2^exposure, the same as in f_screen.glsl
+uniform float exposureScale;
+
+float Luminance(vec3 col)
+{
+    return dot(col, vec3(0.2126, 0.7152, 0.0722));
+}
+
+
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 viewMin = ivec2(viewRect.xy);
+    ivec2 viewMax = viewMin + ivec2(viewRect.zw) - 1;
+    vec3 current = texelFetch(currentColour, coord, 0).rgb;
+
+    // Colour range around the pixel, which the history is clamped to
+    vec3 neighbourMin = current;
+    vec3 neighbourMax = current;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            ivec2 neighbour = clamp(coord + ivec2(x, y), viewMin, viewMax);
+            vec3 col = texelFetch(currentColour, neighbour, 0).rgb;
+            neighbourMin = min(neighbourMin, col);
+            neighbourMax = max(neighbourMax, col);
+        }
+    }
+
+    // Where this pixel was in the last frame
+    float depth = texelFetch(currentDepth, coord, 0).r;
+    vec2 ndc = (gl_FragCoord.xy - viewRect.xy) / viewRect.zw * 2.0 - 1.0;
+    vec4 prevClip = reprojection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    vec2 prevCoords = prevClip.xy / prevClip.w * 0.5 + 0.5;
+    float weight = historyWeight;
+    if (prevClip.w <= 0.0 || any(lessThan(prevCoords, vec2(0.0)))
+            || any(greaterThan(prevCoords, vec2(1.0)))) {
+        weight = 0.0;
+    }
+    vec2 historyCoords = (prevViewRect.xy + prevCoords * prevViewRect.zw)
+                       / vec2(textureSize(history, 0));
+    vec3 prev = clamp(texture(history, historyCoords).rgb, neighbourMin, neighbourMax);
+
+    // Weighted by the inverse of the tonemapped brightness, like the MSAA
+    // resolve, so that bright pixels don't flicker.
+    float currentWeight = (1.0 - weight) / (1.0 + Luminance(current * exposureScale));
+    float prevWeight = weight / (1.0 + Luminance(prev * exposureScale));
+    vec3 col = (current * currentWeight + prev * prevWeight)
+             / max(currentWeight + prevWeight, 1e-5);
+    FragColor = vec4(col, 1.0);
+}
@@ -1,56 +1,43 @@
 #version 330 core
 
-#define MAX_SPOT_SHADOWS 8
+// MAX_SPOT_SHADOWS, NUM_SPOT_SHADOWS, SUN_CASCADES, the CLUSTER_* sizes and
+// the feature
+// defines (LIGHTING, LOCAL_LIGHTS, SUN_SHADOW, NORMAL_MAP, ALPHA, GBUFFER) are
+// added by GetPBRShader() in render_shaders.cpp.
 
 in VS_OUT {
-    //in vec3 Normal;
     in vec3 FragPos;
     in vec2 TexCoords;
+    // rgb replaces the material colour when a is 1
+    in vec4 Paint;
+#ifdef NORMAL_MAP
     in mat3 TBN;
-    in vec4 FragPosLightSpace;
-    in vec4 FragPosSpotLightSpace[MAX_SPOT_SHADOWS];
+#else
+    in vec3 Normal;
+#endif
+#if NUM_SPOT_SHADOWS > 0
+    in vec4 FragPosSpotLightSpace[NUM_SPOT_SHADOWS];
+#endif
 } fs_in;
 
+#ifdef GBUFFER
+// The surface is written to the G-buffer and lit by f_deferred.glsl, see
+// render_deferred.h. Lighting is defined too, so that the normal is there.
+layout (location = 0) out vec4 FragColor;
+// Octahedral encoded normal, see EncodeNormal()
+layout (location = 1) out vec2 GNormal;
+// x: roughness, y: metallic
+layout (location = 2) out vec2 GMaterial;
+#else
 out vec4 FragColor;
+#endif
 
+#if NUM_SPOT_SHADOWS > 0
+// Interpolated by vertex.glsl instead of a matrix per light per fragment.
+#define SPOT_LIGHT_SPACE_POS(n, fragPos) fs_in.FragPosSpotLightSpace[n]
+#endif
 
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-
-struct PointLight {
-    vec3 position;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-
-    vec3 diffuse;
-    vec3 specular;
-
-    float cutoffInner;
-    float cutoffOuter;
-    float quadratic;
-    int shadowMapIdx;
-    //sampler2D shadowMap;
-};
-
+#include "lighting.glsl"
 
 
 struct Material {
@@ -65,339 +52,68 @@ struct Material {
 //uniform sampler2D diffuse;
 
 uniform Material material;
-uniform DirLight dirLight;
-
-#define NUM_POINT_LIGHTS 16
-#define NUM_SPOT_LIGHTS 32
-uniform PointLight pointLights[NUM_POINT_LIGHTS];
-uniform SpotLight spotLights[NUM_SPOT_LIGHTS];
-uniform sampler2D shadowMap;
-uniform sampler2D spotLightShadowMaps[MAX_SPOT_SHADOWS];
-//uniform sampler2DArray spotLightShadowMapArr;
-uniform sampler2D spotLightShadowMapAtlas;
-uniform int shadowSize;
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir,
-        vec4 fragPosLightSpace, int shadowMapNum);
-
-#define PI 3.14159265359
-
-
-
-float ShadowCalculation(sampler2D shadMap, vec4 fragPosLightSpace, float bias)
-{
-    // perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    // Map [-1, 1] range to [0, 1] range
-    projCoords = projCoords * 0.5 + 0.5;
-    if (projCoords.z > 1.0) {
-        return 0.0;
-    }
-
-    // Get depth of current fragment from lights perspective
-    float currentDepth = projCoords.z;
-    
-    // Get cloest depth from lights perspective
-    //float closestDepth = texture(shadMap, projCoords.xy).r;
-    //float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
-    
-    
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(shadMap, 0);
-    for (float x = -1.5; x <= 1.5; x++) {
-        for (float y = -1.5; y <= 1.5; y++) {
-            float pcfDepth = texture(shadMap,
-                                     projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
-        }
-    }
-    shadow /= 16.0;
-    
-
-    return shadow;
-}
 
 
-float ShadowCalculation(vec4 fragPosLightSpace,
-        float bias, int shadowNum)
+vec3 BaseColour()
 {
-    // perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    // Map [-1, 1] range to [0, 1] range
-    projCoords = projCoords * 0.5 + 0.5;
-    if (projCoords.z > 1.0) {
-        return 0.0;
-    }
-
-    // Get depth of current fragment from lights perspective
-    float currentDepth = projCoords.z;
-    
-    // Get cloest depth from lights perspective
-    //float closestDepth = texture(shadMap, projCoords.xy).r;
-    //float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
-    
-    
-    float shadow = 0.0;
-    
-    vec2 texelSize = 1.0 / textureSize(spotLightShadowMapAtlas, 0).xy;
-    
-    
-    for (float x = -1.5; x <= 1.5; x++) {
-        for (float y = -1.5; y <= 1.5; y++) {
-            vec2 texCoords = vec2(projCoords.xy + vec2(x, y) * texelSize);
-            texCoords.x = (texCoords.x + shadowNum) / MAX_SPOT_SHADOWS;
-            float pcfDepth = texture(spotLightShadowMapAtlas, texCoords).r;
-            //float pcfDepth = 0.0;
-            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
-        }
-    }
-    shadow /= 16.0;
-    
-    /*
-    float x = (projCoords.x + shadowNum) / MAX_SPOT_SHADOWS;
-    float depth = texture(spotLightShadowMapAtlas,
-                            vec2(x, projCoords.y)).r;
-    shadow = currentDepth > depth ? 1.0 : 0.0;
-    */
-
-    return shadow;
+    return mix(material.baseColour, fs_in.Paint.rgb, fs_in.Paint.a);
 }
 
 
-void main() 
+void main()
 {
-    //vec3 norm = normalize(Normal);
-
     vec4 textureSample = texture(material.albedo, fs_in.TexCoords);
-    /*
-    if (textureSample.a < 0.1) {
-        discard;
-    }
-    */
-
+    vec3 albedo = BaseColour() * textureSample.rgb;
+#ifdef ALPHA
+    float alpha = textureSample.a;
+#else
+    float alpha = 1.0;
+#endif
+
+#ifdef LIGHTING
+#ifdef NORMAL_MAP
     vec3 norm = texture(material.normalMap, fs_in.TexCoords).rgb;
     // RGB is from 0.0 to 1.0. Normals coords should be from -1.0 to 1.0.
     norm = norm * 2.0 - 1.0;
     norm = normalize(fs_in.TBN * norm);
+#else
+    vec3 norm = normalize(fs_in.Normal);
+#endif
+
+    Surface surface;
+    surface.position = fs_in.FragPos;
+    surface.normal = norm;
+    surface.albedo = albedo;
+    surface.roughness = texture(material.roughnessMap, fs_in.TexCoords).r
+                      * material.roughness;
+    surface.metallic = material.metallic;
+
+#ifdef GBUFFER
+    GNormal = EncodeNormal(surface.normal);
+    GMaterial = vec2(surface.roughness, surface.metallic);
+    vec3 result = albedo;
+#else
+    vec3 viewDir = normalize(camPos.xyz - fs_in.FragPos);
 
-    vec3 viewDir = normalize(-fs_in.FragPos);
-    
 
     // Outgoing radiance
     vec3 Lo = vec3(0.0);
-    Lo += CalcDirLight(dirLight, norm, viewDir);
-    
-    
-    for (int i = 0; i < NUM_POINT_LIGHTS; i++) {
-        Lo += CalcPointLight(pointLights[i], norm, fs_in.FragPos, viewDir);
-    }
-    
-    
-    for (int i = 0; i < NUM_SPOT_LIGHTS; i++) {
-        //if (spotLights[i].shadowMapIdx == -1) continue;
-        int shadowMapNum = spotLights[i].shadowMapIdx;
-        Lo += CalcSpotLight(spotLights[i], norm, fs_in.FragPos, viewDir,
-                fs_in.FragPosSpotLightSpace[shadowMapNum], shadowMapNum);
-    }
+    Lo += CalcDirLight(dirLight, surface, viewDir);
+
+
+#ifdef LOCAL_LIGHTS
+    Lo += CalcLocalLights(surface, viewDir);
+#endif
 
-    
-    vec3 albedo = material.baseColour * textureSample.rgb;
     vec3 ambient = vec3(0.01) * albedo;
     vec3 result  = ambient + Lo;
+#endif
+#else
+    vec3 result = albedo;
+#endif
+
+    FragColor = vec4(result, alpha);
 
-    //vec4 result = texture(diffuse, fs_in.TexCoords);
-    // The alpha is quite hacky here.
-    FragColor = vec4(result, textureSample.a);
-    
     //vec3 normCol = (norm + 1.0) / 2.0;
     //FragColor = vec4(normCol, 1.0);
 }
-
-
-vec3 FresnelSchlick(float cosTheta, vec3 F0)
-{
-    // Calculate ratio of how much light is reflected vs refracted.
-    // cosTheta: cosine of the angle between surface normal and view
-    // F0: Surface reflection at zero incidence
-    return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
-}
-
-
-float DistributionGGX(vec3 N, vec3 H, float roughness)
-{
-    float a = roughness * roughness;
-    float a2 = a * a;
-    float NdotH = max(dot(N, H), 0.0);
-    float NdotH2 = NdotH * NdotH;
-
-    float num = a2;
-    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
-    denom = PI * denom * denom;
-
-    return num / denom;
-}
-
-
-float GeometrySchlickGGX(float NdotV, float roughness)
-{
-    float r = (roughness + 1.0);
-    float k = (r*r) / 8.0;
-
-    float num   = NdotV;
-    float denom = NdotV * (1.0 - k) + k;
-
-    return num / denom;
-}
-
-
-float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
-{
-    float NdotV = max(dot(N, V), 0.0);
-    float NdotL = max(dot(N, L), 0.0);
-    float ggx2  = GeometrySchlickGGX(NdotV, roughness);
-    float ggx1  = GeometrySchlickGGX(NdotL, roughness);
-
-    return ggx1 * ggx2;
-}
-
-
-vec3 CalcLightIntensity(vec3 normal, vec3 lightDir, vec3 viewDir,
-                        vec3 radiance)
-{
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-
-    vec3 albedo = material.baseColour 
-                * texture(material.albedo, fs_in.TexCoords).rgb;
-    float metallic = material.metallic;
-    float roughness = texture(material.roughnessMap, fs_in.TexCoords).r 
-                    * material.roughness;
-
-
-    // Value of 0.04 approximates most dielectric surfaces
-    vec3 F0 = vec3(0.04);
-    F0      = mix(F0, albedo, metallic);
-    vec3 F  = FresnelSchlick(max(dot(halfwayDir, viewDir), 0.0), F0);
-
-    // Normal distribution function component
-    float NDF = DistributionGGX(normal, halfwayDir, roughness);
-    // Geometry component
-    float G   = GeometrySmith(normal, viewDir, lightDir, roughness);
-
-    // Cook-Torrance BRDF
-    vec3 numerator    = NDF * G * F;
-    // Add 0.0001 to prevent divide by zero
-    float denominator = 4.0 * max(dot(normal, viewDir), 0.0) 
-                            * max(dot(normal, lightDir), 0.0) + 0.0001;
-    vec3 specular     = numerator / denominator;
-
-    // Portion of light that is reflected (specular)
-    vec3 kS = F;
-    // Portion of light that is refracted (diffuse)
-    vec3 kD = vec3(1.0) - kS;
-    // Metallic objects have no diffuse lighting
-    kD *= 1.0 - metallic;
-
-    float NdotL = max(dot(normal, lightDir), 0.0);
-    return (kD * albedo / PI + specular) * radiance * NdotL;
-}
-
-
-
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir) {
-    vec3 lightDir = normalize(-light.direction);
-    // Calculate shadows
-    //float shadowBias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
-    float shadowBias = -0.0005;
-    float shadow = ShadowCalculation(shadowMap, fs_in.FragPosLightSpace, shadowBias);
-    //float shadow = 0.0;
-    vec3 radiance = light.diffuse * (1.0 - shadow);
-    return CalcLightIntensity(normal, lightDir, viewDir, radiance);
-}
-
-
-
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    if (light.constant + light.linear + light.quadratic == 0.0) {
-        return vec3(0.0);
-    }
-    float dist = length(fragPos - light.position);
-    float attenuation = 1.0 / (dist * dist);
-    vec3 radiance = light.diffuse * attenuation;
-
-    vec3 lightDir = normalize(light.position - fragPos);
-
-    return CalcLightIntensity(normal, lightDir, viewDir, radiance);
-}
-
-
-
-
-
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir,
-        vec4 fragPosLightSpace, int shadowMapNum)
-{
-    if (light.quadratic == 0.0) {
-        return vec3(0.0);
-    }
-    float dist = length(fragPos - light.position);
-    float attenuation = 1.0 / (dist * dist);
-
-    vec3 lightDir = normalize(light.position - fragPos);
-    float cutoffMult = smoothstep(light.cutoffOuter, light.cutoffInner, dot(lightDir, normalize(-light.direction)));
-
-    // Calculate shadows
-    //float shadowBias = 0.005 / fragPosLightSpace.w;
-    float shadowBias = 0.0;
-    float shadow = 0.0;
-    // This is just the worst thing ever, but I had to do it to get around the
-    // error "sampler arrays indexed with non-constant expressions are
-    // forbidden in GLSL 1.30 and later".
-    // TODO: Could use an Array Texture to solve this properly.
-    shadow = shadowMapNum == -1 ? 0.0
-           : ShadowCalculation(fragPosLightSpace, shadowBias, shadowMapNum);
-    /*
-    switch (shadowMapNum) {
-        case 0: 
-            shadow = ShadowCalculation(spotLightShadowMaps[0],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 1: 
-            shadow = ShadowCalculation(spotLightShadowMaps[1],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 2: 
-            shadow = ShadowCalculation(spotLightShadowMaps[2],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 3: 
-            shadow = ShadowCalculation(spotLightShadowMaps[3],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 4: 
-            shadow = ShadowCalculation(spotLightShadowMaps[4],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 5: 
-            shadow = ShadowCalculation(spotLightShadowMaps[5],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 6: 
-            shadow = ShadowCalculation(spotLightShadowMaps[6],
-                              fragPosLightSpace, shadowBias);
-            break;
-        case 7: 
-            shadow = ShadowCalculation(spotLightShadowMaps[7],
-                              fragPosLightSpace, shadowBias);
-            break;
-    }
-    */
-
-    vec3 radiance = light.diffuse * attenuation * cutoffMult * (1.0 - shadow);
-
-    return CalcLightIntensity(normal, lightDir, viewDir, radiance);
-}
-
@@ -0,0 +1,392 @@
+// Lighting shared by the forward PBR shader (fragment.glsl) and the lighting
+// pass of the deferred renderer (f_deferred.glsl). Included after the
+// defines of the shader variant, see GetPBRShader() in render_shaders.cpp.
+//
+// SPOT_LIGHT_SPACE_POS(n, fragPos) can be defined before including this to
+// give the position in the light space of spot shadow n some other way than
+// transforming fragPos, e.g. interpolated from the vertex shader.
+
+
+struct DirLight {
+    vec4 direction;
+    vec4 colour;
+};
+
+
+// Point and spot lights are read from the lightData buffer texture. Each
+// light is 4 texels, see ClusterLight in render_clusters.h.
+struct PointLight {
+    // xyz: position, w: range
+    vec4 position;
+    vec4 colour;
+};
+
+
+
+struct SpotLight {
+    // xyz: position, w: range
+    vec4 position;
+    // xyz: direction, w: cosine of the inner cutoff
+    vec4 direction;
+    // rgb: colour, w: cosine of the outer cutoff
+    vec4 colour;
+};
+
+
+// Everything the BRDF needs to know about the point being lit. Filled in from
+// the material by fragment.glsl and from the G-buffer by f_deferred.glsl.
+struct Surface {
+    // World space
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    float roughness;
+    float metallic;
+};
+
+// These must align with ClusterLightType in render_clusters.h
+#define CLUSTER_LIGHT_POINT 0
+#define CLUSTER_LIGHT_SPOT 1
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 camPos;
+    // x, y, width, height of the view in pixels
+    vec4 viewport;
+    // x: depth of the first cluster slice, y: slices per log depth
+    vec4 clusterParams;
+};
+
+layout (std140) uniform Lights {
+    DirLight dirLight;
+};
+
+layout (std140) uniform Shadows {
+    // World to light clip space of each sun cascade of this view
+    mat4 sunCascadeMatrix[SUN_CASCADES];
+    // xy: offset, zw: size of each cascade in shadowMap
+    vec4 sunCascadeRect[SUN_CASCADES];
+    // View depth of the far end of each cascade
+    vec4 sunCascadeSplits;
+    mat4 spotLightSpaceMatrix[MAX_SPOT_SHADOWS];
+    // xy: offset, zw: size of each spot shadow's tile in
+    // spotLightShadowMapAtlas, zero size if it has none
+    vec4 spotShadowRect[MAX_SPOT_SHADOWS];
+};
+
+uniform samplerBuffer lightData;
+// Offset and count of each cluster's lights in lightIndices
+uniform usamplerBuffer clusterTable;
+uniform usamplerBuffer lightIndices;
+
+// Atlas of the sun cascades of every view
+uniform sampler2D shadowMap;
+//uniform sampler2DArray spotLightShadowMapArr;
+uniform sampler2D spotLightShadowMapAtlas;
+uniform int shadowSize;
+
+#ifndef SPOT_LIGHT_SPACE_POS
+#define SPOT_LIGHT_SPACE_POS(n, fragPos) (spotLightSpaceMatrix[n] * vec4(fragPos, 1.0))
+#endif
+
+#define PI 3.14159265359
+
+
+// Octahedral encoding of a unit vector into [0, 1], for the normals in the
+// G-buffer. Keeps much more precision than storing xyz in as many bits.
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return n.xy * 0.5 + 0.5;
+}
+
+
+vec3 DecodeNormal(vec2 encoded)
+{
+    vec2 e = encoded * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+
+int ClusterIndex(vec3 fragPos)
+{
+    vec2 viewportPos = (gl_FragCoord.xy - viewport.xy) / viewport.zw;
+    ivec2 tile = clamp(ivec2(viewportPos * vec2(CLUSTER_TILES_X, CLUSTER_TILES_Y)),
+                       ivec2(0), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    // Must match SliceDepth() in render_clusters.cpp. Anything in front of
+    // clusterParams.x goes negative and is clamped into slice 0.
+    int slice = int(floor(log(max(depth, 0.0001) / clusterParams.x) * clusterParams.y));
+    slice = clamp(slice, 0, CLUSTER_SLICES_Z - 1);
+    return tile.x + tile.y * CLUSTER_TILES_X
+         + slice * CLUSTER_TILES_X * CLUSTER_TILES_Y;
+}
+
+
+// Smoothly fades the inverse square falloff to zero at the light's range, so
+// that lights can be left out of clusters beyond it.
+float DistanceAttenuation(float dist, float range)
+{
+    float ratio = dist / range;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window / (dist * dist + 0.0001);
+}
+
+
+
+// Sun shadow from the first cascade that covers fragPos.
+float SunShadowCalculation(vec3 fragPos, float bias)
+{
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        if (viewDepth > sunCascadeSplits[c]) continue;
+
+        vec4 fragPosLightSpace = sunCascadeMatrix[c] * vec4(fragPos, 1.0);
+        // Map [-1, 1] range to [0, 1] range
+        vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+        // Cascades that are only updated every few frames may not reach all
+        // the way to their split any more, so fall through to the next one.
+        // The margin keeps the filter taps inside of the cascade.
+        vec2 margin = 2.0 * texelSize / sunCascadeRect[c].zw;
+        if (any(lessThan(projCoords.xy, margin))
+                || any(greaterThan(projCoords.xy, 1.0 - margin))) {
+            continue;
+        }
+        if (projCoords.z > 1.0) {
+            return 0.0;
+        }
+
+        vec2 atlasCoords = sunCascadeRect[c].xy + projCoords.xy * sunCascadeRect[c].zw;
+        float currentDepth = projCoords.z;
+        float shadow = 0.0;
+        for (float x = -1.5; x <= 1.5; x++) {
+            for (float y = -1.5; y <= 1.5; y++) {
+                float pcfDepth = texture(shadowMap,
+                                         atlasCoords + vec2(x, y) * texelSize).r;
+                shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+            }
+        }
+        return shadow / 16.0;
+    }
+    return 0.0;
+}
+
+
+float ShadowCalculation(vec4 fragPosLightSpace,
+        float bias, int shadowNum)
+{
+    // perform perspective divide
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    // Map [-1, 1] range to [0, 1] range
+    projCoords = projCoords * 0.5 + 0.5;
+    if (projCoords.z > 1.0) {
+        return 0.0;
+    }
+
+    // Get depth of current fragment from lights perspective
+    float currentDepth = projCoords.z;
+
+    float shadow = 0.0;
+
+    vec4 rect = spotShadowRect[shadowNum];
+    if (rect.z == 0.0) {
+        return 0.0;
+    }
+    vec2 texelSize = 1.0 / textureSize(spotLightShadowMapAtlas, 0).xy;
+    // Keep the filter taps inside of this light's tile
+    vec2 tileMin = rect.xy + 0.5 * texelSize;
+    vec2 tileMax = rect.xy + rect.zw - 0.5 * texelSize;
+    vec2 atlasCoords = rect.xy + projCoords.xy * rect.zw;
+
+    for (float x = -1.5; x <= 1.5; x++) {
+        for (float y = -1.5; y <= 1.5; y++) {
+            vec2 texCoords = clamp(atlasCoords + vec2(x, y) * texelSize,
+                                   tileMin, tileMax);
+            float pcfDepth = texture(spotLightShadowMapAtlas, texCoords).r;
+            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+        }
+    }
+    shadow /= 16.0;
+
+
+    return shadow;
+}
+
+
+vec3 FresnelSchlick(float cosTheta, vec3 F0)
+{
+    // Calculate ratio of how much light is reflected vs refracted.
+    // cosTheta: cosine of the angle between surface normal and view
+    // F0: Surface reflection at zero incidence
+    return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+
+
+float DistributionGGX(vec3 N, vec3 H, float roughness)
+{
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float NdotH = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH * NdotH;
+
+    float num = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+
+    return num / denom;
+}
+
+
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    float r = (roughness + 1.0);
+    float k = (r*r) / 8.0;
+
+    float num   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return num / denom;
+}
+
+
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2  = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1  = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+
+
+vec3 CalcLightIntensity(Surface surface, vec3 lightDir, vec3 viewDir,
+                        vec3 radiance)
+{
+    vec3 normal = surface.normal;
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+
+    // Value of 0.04 approximates most dielectric surfaces
+    vec3 F0 = vec3(0.04);
+    F0      = mix(F0, surface.albedo, surface.metallic);
+    vec3 F  = FresnelSchlick(max(dot(halfwayDir, viewDir), 0.0), F0);
+
+    // Normal distribution function component
+    float NDF = DistributionGGX(normal, halfwayDir, surface.roughness);
+    // Geometry component
+    float G   = GeometrySmith(normal, viewDir, lightDir, surface.roughness);
+
+    // Cook-Torrance BRDF
+    vec3 numerator    = NDF * G * F;
+    // Add 0.0001 to prevent divide by zero
+    float denominator = 4.0 * max(dot(normal, viewDir), 0.0)
+                            * max(dot(normal, lightDir), 0.0) + 0.0001;
+    vec3 specular     = numerator / denominator;
+
+    // Portion of light that is reflected (specular)
+    vec3 kS = F;
+    // Portion of light that is refracted (diffuse)
+    vec3 kD = vec3(1.0) - kS;
+    // Metallic objects have no diffuse lighting
+    kD *= 1.0 - surface.metallic;
+
+    float NdotL = max(dot(normal, lightDir), 0.0);
+    return (kD * surface.albedo / PI + specular) * radiance * NdotL;
+}
+
+
+
+
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir) {
+    vec3 lightDir = normalize(-light.direction.xyz);
+    // Calculate shadows
+    //float shadowBias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+    float shadow = 0.0;
+#ifdef SUN_SHADOW
+    float shadowBias = -0.0005;
+    shadow = SunShadowCalculation(surface.position, shadowBias);
+#endif
+    vec3 radiance = light.colour.rgb * (1.0 - shadow);
+    return CalcLightIntensity(surface, lightDir, viewDir, radiance);
+}
+
+
+
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 viewDir)
+{
+    float dist = length(surface.position - light.position.xyz);
+    float attenuation = DistanceAttenuation(dist, light.position.w);
+    vec3 radiance = light.colour.rgb * attenuation;
+
+    vec3 lightDir = normalize(light.position.xyz - surface.position);
+
+    return CalcLightIntensity(surface, lightDir, viewDir, radiance);
+}
+
+
+
+
+
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 viewDir,
+        int shadowMapNum)
+{
+    float dist = length(surface.position - light.position.xyz);
+    float attenuation = DistanceAttenuation(dist, light.position.w);
+
+    vec3 lightDir = normalize(light.position.xyz - surface.position);
+    float cutoffMult = smoothstep(light.colour.w, light.direction.w,
+                                  dot(lightDir, normalize(-light.direction.xyz)));
+
+    // Calculate shadows
+    //float shadowBias = 0.005 / fragPosLightSpace.w;
+    float shadowBias = 0.0;
+    float shadow = 0.0;
+#if NUM_SPOT_SHADOWS > 0
+    // The shadows in use are always the first ones, so shadowMapNum is
+    // below NUM_SPOT_SHADOWS when it isn't -1.
+    if (shadowMapNum >= 0 && shadowMapNum < NUM_SPOT_SHADOWS) {
+        shadow = ShadowCalculation(SPOT_LIGHT_SPACE_POS(shadowMapNum, surface.position),
+                                   shadowBias, shadowMapNum);
+    }
+#endif
+
+    vec3 radiance = light.colour.rgb * attenuation * cutoffMult * (1.0 - shadow);
+
+    return CalcLightIntensity(surface, lightDir, viewDir, radiance);
+}
+
+
+#ifdef LOCAL_LIGHTS
+// Point and spot lights that reach surface. Only the lights in its cluster
+// can reach it.
+vec3 CalcLocalLights(Surface surface, vec3 viewDir)
+{
+    vec3 Lo = vec3(0.0);
+    uvec2 cluster = texelFetch(clusterTable, ClusterIndex(surface.position)).xy;
+    for (uint i = 0u; i < cluster.y; i++) {
+        int lightIdx = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+        vec4 position  = texelFetch(lightData, lightIdx * 4);
+        vec4 direction = texelFetch(lightData, lightIdx * 4 + 1);
+        vec4 colour    = texelFetch(lightData, lightIdx * 4 + 2);
+        vec4 info      = texelFetch(lightData, lightIdx * 4 + 3);
+
+        if (int(info.x) == CLUSTER_LIGHT_POINT) {
+            PointLight light = PointLight(position, colour);
+            Lo += CalcPointLight(light, surface, viewDir);
+        } else {
+            SpotLight light = SpotLight(position, direction, colour);
+            Lo += CalcSpotLight(light, surface, viewDir, int(info.y));
+        }
+    }
+    return Lo;
+}
+#endif
@@ -1,10 +1,36 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
+// VIEW_DEPTH is defined for the depth pre-pass of the views, which must give
+// exactly the same depth as vertex.glsl.
+#ifdef VIEW_DEPTH
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 camPos;
+    vec4 viewport;
+    vec4 clusterParams;
+};
+invariant gl_Position;
+#else
 uniform mat4 lightSpaceMatrix;
+#endif
+
+// INSTANCED and INSTANCE_ATTRIB_MODEL are defined by LoadShaders() for the
+// instanced variant.
+#ifdef INSTANCED
+layout (location = INSTANCE_ATTRIB_MODEL) in mat4 model;
+#else
 uniform mat4 model;
+#endif
 
 void main()
 {
+#ifdef VIEW_DEPTH
+    // The same expression as in vertex.glsl
+    vec4 worldPos = model * vec4(aPos, 1.0f);
+    gl_Position = projection * view * worldPos;
+#else
     gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+#endif
 }
@@ -3,42 +3,91 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in vec3 aTangent;
+// w is the handedness of the bitangent for packed vertices, 1.0 otherwise.
+layout (location = 3) in vec4 aTangent;
+// Zero for packed vertices, which do not store the bitangent.
 layout (location = 4) in vec3 aBitTangent;
 
-#define MAX_SPOT_SHADOWS 8
+// MAX_SPOT_SHADOWS, NUM_SPOT_SHADOWS, SUN_CASCADES and the feature defines (LIGHTING,
+// SUN_SHADOW, NORMAL_MAP, ...) are added by GetPBRShader() in
+// render_shaders.cpp.
 
+#ifdef INSTANCED
+layout (location = INSTANCE_ATTRIB_MODEL) in mat4 aModel;
+layout (location = INSTANCE_ATTRIB_PAINT) in vec4 aPaint;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
-uniform mat4 spotLightSpaceMatrix[MAX_SPOT_SHADOWS];
+// rgb replaces the material colour when a is 1
+uniform vec4 paint;
+#endif
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 camPos;
+    vec4 viewport;
+    vec4 clusterParams;
+};
+
+// The sun cascades are picked per fragment, see fragment.glsl.
+layout (std140) uniform Shadows {
+    mat4 sunCascadeMatrix[SUN_CASCADES];
+    vec4 sunCascadeRect[SUN_CASCADES];
+    vec4 sunCascadeSplits;
+    mat4 spotLightSpaceMatrix[MAX_SPOT_SHADOWS];
+    vec4 spotShadowRect[MAX_SPOT_SHADOWS];
+};
 
 out VS_OUT {
-    //vec3 Normal;
     vec3 FragPos;
     vec2 TexCoords;
+    vec4 Paint;
+#ifdef NORMAL_MAP
     mat3 TBN;
-    vec4 FragPosLightSpace;
-    vec4 FragPosSpotLightSpace[MAX_SPOT_SHADOWS];
+#else
+    vec3 Normal;
+#endif
+#if NUM_SPOT_SHADOWS > 0
+    vec4 FragPosSpotLightSpace[NUM_SPOT_SHADOWS];
+#endif
 } vs_out;
 
+// Matches the depth pre-pass, see v_simple_depth.glsl.
+invariant gl_Position;
+
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
-    vs_out.FragPos = vec3(view * model * vec4(aPos, 1.0f));
-    //vs_out.Normal = mat3(transpose(inverse(view * model))) * aNormal;
+#ifdef INSTANCED
+    mat4 model = aModel;
+    vec4 paint = aPaint;
+#endif
+    // Lighting is done in world space so that the light data does not depend
+    // on the view.
+    vec4 worldPos = model * vec4(aPos, 1.0f);
+    gl_Position = projection * view * worldPos;
+    vs_out.FragPos = vec3(worldPos);
     vs_out.TexCoords = aTexCoords;
-    vs_out.FragPosLightSpace = lightSpaceMatrix * model * vec4(aPos, 1.0);
-    for (int i = 0; i < MAX_SPOT_SHADOWS; i++) {
-        vs_out.FragPosSpotLightSpace[i] = spotLightSpaceMatrix[i] 
-                                        * model * vec4(aPos, 1.0f);
+    vs_out.Paint = paint;
+#if NUM_SPOT_SHADOWS > 0
+    for (int i = 0; i < NUM_SPOT_SHADOWS; i++) {
+        vs_out.FragPosSpotLightSpace[i] = spotLightSpaceMatrix[i] * worldPos;
     }
+#endif
 
-    vec3 T = normalize(vec3(view * model * vec4(aTangent,    0.0)));
-    vec3 B = normalize(vec3(view * model * vec4(aBitTangent, 0.0)));
-    vec3 N = normalize(vec3(view * model * vec4(aNormal,     0.0)));
-    //vec3 B = cross(N, T);
+#ifdef NORMAL_MAP
+    vec3 T = normalize(vec3(model * vec4(aTangent.xyz, 0.0)));
+    vec3 N = normalize(vec3(model * vec4(aNormal,      0.0)));
+    vec3 B;
+    if (dot(aBitTangent, aBitTangent) > 0.0) {
+        B = normalize(vec3(model * vec4(aBitTangent, 0.0)));
+    } else {
+        // Only the sign of w is used because the snorm conversion of a 2 bit
+        // value does not give exactly -1.0 on all drivers.
+        B = cross(N, T) * (aTangent.w < 0.0 ? -1.0 : 1.0);
+    }
 
     vs_out.TBN = mat3(T, B, N);
+#else
+    vs_out.Normal = normalize(vec3(model * vec4(aNormal, 0.0)));
+#endif
 }
 
@@ -0,0 +1,85 @@
+#include "bounds.h"
+
+#include <glm/glm.hpp>
+
+
+bool AABB::IsValid() const
+{
+    return mMin.x <= mMax.x && mMin.y <= mMax.y && mMin.z <= mMax.z;
+}
+
+
+void AABB::Extend(glm::vec3 point)
+{
+    mMin = glm::min(mMin, point);
+    mMax = glm::max(mMax, point);
+}
+
+
+void AABB::Extend(const AABB &other)
+{
+    if (!other.IsValid()) return;
+    mMin = glm::min(mMin, other.mMin);
+    mMax = glm::max(mMax, other.mMax);
+}
+
+
+glm::vec3 AABB::Centre() const  { return (mMin + mMax) * 0.5f; }
+glm::vec3 AABB::Extents() const { return (mMax - mMin) * 0.5f; }
+
+
+AABB AABB::Transformed(const glm::mat4 &transform) const
+{
+    if (!IsValid()) return AABB();
+    // Transform the centre, then find the extents of the rotated box by
+    // summing the absolute values of the rotated extents.
+    glm::vec3 centre = glm::vec3(transform * glm::vec4(Centre(), 1.0f));
+    glm::mat3 absRot = glm::mat3(glm::abs(glm::vec3(transform[0])),
+                                 glm::abs(glm::vec3(transform[1])),
+                                 glm::abs(glm::vec3(transform[2])));
+    glm::vec3 extents = absRot * Extents();
+
+    AABB out;
+    out.mMin = centre - extents;
+    out.mMax = centre + extents;
+    return out;
+}
+
+
+void Frustum::FromMatrix(const glm::mat4 &clip)
+{
+    // Gribb/Hartmann plane extraction. glm is column major, so row i is
+    // (clip[0][i], clip[1][i], clip[2][i], clip[3][i]).
+    glm::vec4 row0 = glm::vec4(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+    glm::vec4 row1 = glm::vec4(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+    glm::vec4 row2 = glm::vec4(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+    glm::vec4 row3 = glm::vec4(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+
+    mPlanes[0] = row3 + row0; // Left
+    mPlanes[1] = row3 - row0; // Right
+    mPlanes[2] = row3 + row1; // Bottom
+    mPlanes[3] = row3 - row1; // Top
+    mPlanes[4] = row3 + row2; // Near
+    mPlanes[5] = row3 - row2; // Far
+
+    for (int i = 0; i < 6; i++) {
+        mPlanes[i] /= glm::length(glm::vec3(mPlanes[i]));
+    }
+}
+
+
+bool Frustum::Intersects(const AABB &box) const
+{
+    if (!box.IsValid()) return false;
+    glm::vec3 centre = box.Centre();
+    glm::vec3 extents = box.Extents();
+    for (int i = 0; i < 6; i++) {
+        glm::vec3 normal = glm::vec3(mPlanes[i]);
+        // Distance of the box corner furthest along the plane normal.
+        float radius = glm::dot(extents, glm::abs(normal));
+        if (glm::dot(normal, centre) + mPlanes[i].w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <float.h>
+
+/* Axis aligned bounding box. A default constructed box is empty and becomes
+ * valid once a point is added to it. */
+struct AABB {
+    glm::vec3 mMin = glm::vec3(FLT_MAX);
+    glm::vec3 mMax = glm::vec3(-FLT_MAX);
+
+    bool IsValid() const;
+    void Extend(glm::vec3 point);
+    void Extend(const AABB &other);
+    glm::vec3 Centre() const;
+    glm::vec3 Extents() const;
+    /* Returns the box enclosing this box after being transformed. */
+    AABB Transformed(const glm::mat4 &transform) const;
+};
+
+
+/* The six planes of a view volume, pointing inwards. Works with both
+ * perspective and orthographic projections. */
+struct Frustum {
+    // xyz is the plane normal, w is the distance.
+    glm::vec4 mPlanes[6];
+
+    /* Extracts the planes from a clip matrix (projection * view). */
+    void FromMatrix(const glm::mat4 &clip);
+    /* True if the box is at least partly inside the frustum. */
+    bool Intersects(const AABB &box) const;
+};
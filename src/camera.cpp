@@ -40,6 +40,15 @@ void Camera::CalcProjection()
     projection = glm::perspective(fov, aspect, near, far);
 }
 
+glm::mat4 Camera::JitteredProjection(glm::vec2 ndcOffset) const
+{
+    // Clip space w is -z, so these offsets are divided back out.
+    glm::mat4 jittered = projection;
+    jittered[2][0] -= ndcOffset.x;
+    jittered[2][1] -= ndcOffset.y;
+    return jittered;
+}
+
 void Camera::SetFovAndRecalcProjection(float aFov)
 {
     if (aFov != fov) {
@@ -20,6 +20,9 @@ struct Camera {
 
     void Init(float aFov, float aAspect, float aNear, float aFar);
     void CalcProjection();
+    /* The projection moved by ndcOffset after the perspective divide, for
+     * temporal anti-aliasing. */
+    glm::mat4 JitteredProjection(glm::vec2 ndcOffset) const;
     void SetFovAndRecalcProjection(float fov);
 
     glm::vec3 Target() const;
@@ -0,0 +1,266 @@
+#include "geometry_pool.h"
+#include "model.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Size of a normal block. Meshes bigger than this get a block of their own.
+static constexpr uint32_t cBlockVertices = 1 << 18;
+static constexpr uint32_t cBlockIndices = 1 << 20;
+
+
+/* First fit allocator of ranges in [0, capacity). Free ranges are kept sorted
+ * by offset and merged with their neighbours when freed. */
+struct RangeAllocator {
+    struct Range {
+        uint32_t mOffset;
+        uint32_t mSize;
+    };
+
+    void Init(uint32_t capacity)
+    {
+        mCapacity = capacity;
+        mFree.assign(1, Range{0, capacity});
+        mUsed = 0;
+    }
+
+    /* Returns false if there is no free range big enough. */
+    bool Allocate(uint32_t size, uint32_t *outOffset)
+    {
+        for (size_t i = 0; i < mFree.size(); i++) {
+            if (mFree[i].mSize < size) continue;
+            *outOffset = mFree[i].mOffset;
+            mFree[i].mOffset += size;
+            mFree[i].mSize -= size;
+            if (mFree[i].mSize == 0) {
+                mFree.erase(mFree.begin() + i);
+            }
+            mUsed += size;
+            return true;
+        }
+        return false;
+    }
+
+    void Free(uint32_t offset, uint32_t size)
+    {
+        if (size == 0) return;
+        auto it = std::lower_bound(mFree.begin(), mFree.end(), offset,
+                                   [](const Range &r, uint32_t o) {
+                                       return r.mOffset < o;
+                                   });
+        it = mFree.insert(it, Range{offset, size});
+        // Merge with the next range, then with the previous one.
+        if (it + 1 != mFree.end() && it->mOffset + it->mSize == (it + 1)->mOffset) {
+            it->mSize += (it + 1)->mSize;
+            mFree.erase(it + 1);
+        }
+        if (it != mFree.begin() && (it - 1)->mOffset + (it - 1)->mSize == it->mOffset) {
+            (it - 1)->mSize += it->mSize;
+            mFree.erase(it);
+        }
+        mUsed -= size;
+    }
+
+    std::vector<Range> mFree;
+    uint32_t mCapacity = 0;
+    uint32_t mUsed = 0;
+};
+
+
+struct GeometryBlock {
+    VertexFormat mFormat;
+    unsigned int mVAO = 0;
+    unsigned int mDepthVAO = 0;
+    unsigned int mPosVBO = 0;
+    unsigned int mAttribVBO = 0;
+    unsigned int mEBO = 0;
+    RangeAllocator mVertices;
+    RangeAllocator mIndices;
+};
+
+static std::vector<std::unique_ptr<GeometryBlock>> blocks;
+
+
+static size_t AttributeSize(VertexFormat format)
+{
+    return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertexAttributes)
+                                          : sizeof(VertexAttributes);
+}
+
+
+/* Sets up the attribute pointers of the bound VAO for format. */
+static void SetAttributeLayout(VertexFormat format)
+{
+    if (format == VERTEX_FORMAT_PACKED) {
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+                sizeof(PackedVertexAttributes),
+                (void*) (offsetof(PackedVertexAttributes, normal)));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE,
+                sizeof(PackedVertexAttributes),
+                (void*) (offsetof(PackedVertexAttributes, texCoords)));
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+                sizeof(PackedVertexAttributes),
+                (void*) (offsetof(PackedVertexAttributes, tangent)));
+        // No bitangent attribute. It reads as zero so the shader rebuilds it.
+        glDisableVertexAttribArray(4);
+    } else {
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexAttributes), 
+                (void*) (offsetof(VertexAttributes, normal)));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexAttributes),
+                (void*) (offsetof(VertexAttributes, texCoords)));
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(VertexAttributes),
+                (void*) (offsetof(VertexAttributes, tangent)));
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(VertexAttributes),
+                (void*) (offsetof(VertexAttributes, bitangent)));
+        glEnableVertexAttribArray(4);
+    }
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+}
+
+
+static int CreateBlock(VertexFormat format, uint32_t numVertices,
+                       uint32_t numIndices)
+{
+    std::unique_ptr<GeometryBlock> block = std::make_unique<GeometryBlock>();
+    block->mFormat = format;
+    block->mVertices.Init(numVertices);
+    block->mIndices.Init(numIndices);
+
+    glGenVertexArrays(1, &block->mVAO);
+    glGenVertexArrays(1, &block->mDepthVAO);
+    glGenBuffers(1, &block->mPosVBO);
+    glGenBuffers(1, &block->mAttribVBO);
+    glGenBuffers(1, &block->mEBO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, block->mPosVBO);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(glm::vec3), nullptr,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, block->mAttribVBO);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * AttributeSize(format), nullptr,
+                 GL_STATIC_DRAW);
+
+    glBindVertexArray(block->mVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block->mEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int),
+                 nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, block->mPosVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*) 0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, block->mAttribVBO);
+    SetAttributeLayout(format);
+
+    // Depth only VAO shares the position and index buffers.
+    glBindVertexArray(block->mDepthVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block->mEBO);
+    glBindBuffer(GL_ARRAY_BUFFER, block->mPosVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*) 0);
+    glEnableVertexAttribArray(0);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GLERR;
+
+    SDL_Log("Created geometry block %zu (%u vertices, %u indices)",
+            blocks.size(), numVertices, numIndices);
+    blocks.push_back(std::move(block));
+    return blocks.size() - 1;
+}
+
+
+GeometryAllocation AllocateGeometry(VertexFormat format,
+                                    const glm::vec3 *positions,
+                                    const void *attributes, uint32_t numVertices,
+                                    const unsigned int *indices, uint32_t numIndices)
+{
+    GeometryAllocation alloc;
+    alloc.mNumVertices = numVertices;
+    alloc.mNumIndices = numIndices;
+
+    // Use the first block of the format with room for both ranges.
+    for (size_t i = 0; i < blocks.size() && alloc.mBlock == -1; i++) {
+        GeometryBlock &block = *blocks[i];
+        if (block.mFormat != format) continue;
+        if (!block.mVertices.Allocate(numVertices, &alloc.mBaseVertex)) continue;
+        if (!block.mIndices.Allocate(numIndices, &alloc.mFirstIndex)) {
+            block.mVertices.Free(alloc.mBaseVertex, numVertices);
+            continue;
+        }
+        alloc.mBlock = i;
+    }
+    if (alloc.mBlock == -1) {
+        alloc.mBlock = CreateBlock(format, SDL_max(numVertices, cBlockVertices),
+                                   SDL_max(numIndices, cBlockIndices));
+        GeometryBlock &block = *blocks[alloc.mBlock];
+        block.mVertices.Allocate(numVertices, &alloc.mBaseVertex);
+        block.mIndices.Allocate(numIndices, &alloc.mFirstIndex);
+    }
+
+    GeometryBlock &block = *blocks[alloc.mBlock];
+    size_t attributeSize = AttributeSize(format);
+    glBindBuffer(GL_ARRAY_BUFFER, block.mPosVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, alloc.mBaseVertex * sizeof(glm::vec3),
+                    numVertices * sizeof(glm::vec3), positions);
+    glBindBuffer(GL_ARRAY_BUFFER, block.mAttribVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, alloc.mBaseVertex * attributeSize,
+                    numVertices * attributeSize, attributes);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // The element buffer is part of the VAO state, so bind it through the VAO.
+    glBindVertexArray(block.mVAO);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, alloc.mFirstIndex * sizeof(unsigned int),
+                    numIndices * sizeof(unsigned int), indices);
+    glBindVertexArray(0);
+    GLERR;
+    return alloc;
+}
+
+
+void FreeGeometry(GeometryAllocation *alloc)
+{
+    // The pool may already be destroyed if a model outlives the renderer.
+    if (alloc->mBlock < 0 || alloc->mBlock >= (int)blocks.size()) return;
+    GeometryBlock &block = *blocks[alloc->mBlock];
+    block.mVertices.Free(alloc->mBaseVertex, alloc->mNumVertices);
+    block.mIndices.Free(alloc->mFirstIndex, alloc->mNumIndices);
+    *alloc = GeometryAllocation();
+}
+
+
+unsigned int GetGeometryVAO(int block)        { return blocks[block]->mVAO; }
+unsigned int GetGeometryDepthVAO(int block)   { return blocks[block]->mDepthVAO; }
+
+
+void DestroyGeometryPool()
+{
+    for (std::unique_ptr<GeometryBlock> &block : blocks) {
+        glDeleteVertexArrays(1, &block->mVAO);
+        glDeleteVertexArrays(1, &block->mDepthVAO);
+        glDeleteBuffers(1, &block->mPosVBO);
+        glDeleteBuffers(1, &block->mAttribVBO);
+        glDeleteBuffers(1, &block->mEBO);
+    }
+    blocks.clear();
+}
+
+
+void GeometryPoolDebugGUI()
+{
+    if (!ImGui::CollapsingHeader("Geometry pool")) return;
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const GeometryBlock &block = *blocks[i];
+        ImGui::Text("Block %zu (%s): vertices %u/%u, indices %u/%u, %zu free ranges",
+                    i, block.mFormat == VERTEX_FORMAT_PACKED ? "packed" : "full",
+                    block.mVertices.mUsed, block.mVertices.mCapacity,
+                    block.mIndices.mUsed, block.mIndices.mCapacity,
+                    block.mVertices.mFree.size() + block.mIndices.mFree.size());
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Forward declarations
+enum VertexFormat : int;
+
+/*
+ * Sub-allocates the vertex and index data of all meshes from a few large
+ * buffers. Each block holds one vertex format and has a VAO for drawing and a
+ * position only VAO for depth passes that every mesh in the block shares, so
+ * meshes in the same block can be drawn without changing VAO, with
+ * glDrawElementsBaseVertex or one glMultiDrawElementsIndirect.
+ *
+ * Freed ranges go on a free list and are reused by later allocations, so
+ * loading a map after unloading another doesn't grow the buffers.
+ */
+
+// Every vertex attribute except for the position, which is in its own buffer.
+struct VertexAttributes {
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+    glm::vec3 tangent;
+    glm::vec3 bitangent;
+};
+
+// VertexAttributes for VERTEX_FORMAT_PACKED. 12 bytes instead of 44.
+struct PackedVertexAttributes {
+    // 10:10:10:2 snorm
+    uint32_t normal;
+    // 10:10:10:2 snorm, w is the handedness of the bitangent
+    uint32_t tangent;
+    // Two half floats
+    uint32_t texCoords;
+};
+
+struct GeometryAllocation {
+    // Index of the block, or -1 if nothing is allocated
+    int mBlock = -1;
+    uint32_t mBaseVertex = 0;
+    uint32_t mNumVertices = 0;
+    uint32_t mFirstIndex = 0;
+    uint32_t mNumIndices = 0;
+};
+
+/* Copies the vertices and indices into a block with the given format.
+ * attributes is an array of VertexAttributes or PackedVertexAttributes to
+ * match format. Indices are relative to the first vertex of the mesh. */
+GeometryAllocation AllocateGeometry(VertexFormat format,
+                                    const glm::vec3 *positions,
+                                    const void *attributes, uint32_t numVertices,
+                                    const unsigned int *indices, uint32_t numIndices);
+/* Puts the ranges of alloc back on the free list and resets alloc. */
+void FreeGeometry(GeometryAllocation *alloc);
+unsigned int GetGeometryVAO(int block);
+unsigned int GetGeometryDepthVAO(int block);
+/* Deletes every block. Only call once all meshes are destroyed. */
+void DestroyGeometryPool();
+void GeometryPoolDebugGUI();
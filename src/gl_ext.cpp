@@ -0,0 +1,60 @@
+#include "gl_ext.h"
+
+#include <SDL3/SDL.h>
+
+bool GLEXT_ARB_get_program_binary = false;
+PFNGLGETPROGRAMBINARYPROC glext_glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROC glext_glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROC glext_glProgramParameteri = nullptr;
+bool GLEXT_ARB_multi_draw_indirect = false;
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glext_glMultiDrawElementsIndirect = nullptr;
+bool GLEXT_ARB_compute_shader = false;
+PFNGLDISPATCHCOMPUTEPROC glext_glDispatchCompute = nullptr;
+PFNGLMEMORYBARRIERPROC glext_glMemoryBarrier = nullptr;
+
+
+/* True if the context is at least major.minor or has the extension. */
+static bool HasVersionOrExtension(int major, int minor, const char *extension)
+{
+    if (GLVersion.major > major
+            || (GLVersion.major == major && GLVersion.minor >= minor)) {
+        return true;
+    }
+    return SDL_GL_ExtensionSupported(extension);
+}
+
+
+void LoadGLExtensions()
+{
+    if (HasVersionOrExtension(4, 1, "GL_ARB_get_program_binary")) {
+        glext_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)
+                SDL_GL_GetProcAddress("glGetProgramBinary");
+        glext_glProgramBinary = (PFNGLPROGRAMBINARYPROC)
+                SDL_GL_GetProcAddress("glProgramBinary");
+        glext_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)
+                SDL_GL_GetProcAddress("glProgramParameteri");
+        GLEXT_ARB_get_program_binary = glext_glGetProgramBinary
+                                    && glext_glProgramBinary
+                                    && glext_glProgramParameteri;
+    }
+    if (HasVersionOrExtension(4, 3, "GL_ARB_multi_draw_indirect")
+            && HasVersionOrExtension(4, 2, "GL_ARB_base_instance")) {
+        glext_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)
+                SDL_GL_GetProcAddress("glMultiDrawElementsIndirect");
+        GLEXT_ARB_multi_draw_indirect = glext_glMultiDrawElementsIndirect != nullptr;
+    }
+    if (HasVersionOrExtension(4, 3, "GL_ARB_compute_shader")
+            && HasVersionOrExtension(4, 3, "GL_ARB_shader_storage_buffer_object")) {
+        glext_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)
+                SDL_GL_GetProcAddress("glDispatchCompute");
+        glext_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)
+                SDL_GL_GetProcAddress("glMemoryBarrier");
+        GLEXT_ARB_compute_shader = glext_glDispatchCompute && glext_glMemoryBarrier;
+    }
+    SDL_Log("GL_ARB_get_program_binary: %s",
+            GLEXT_ARB_get_program_binary ? "yes" : "no");
+    SDL_Log("GL_ARB_multi_draw_indirect: %s",
+            GLEXT_ARB_multi_draw_indirect ? "yes" : "no");
+    SDL_Log("GL_ARB_compute_shader: %s",
+            GLEXT_ARB_compute_shader ? "yes" : "no");
+}
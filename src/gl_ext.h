@@ -0,0 +1,73 @@
+#pragma once
+#include "../glad/glad.h"
+
+/*
+ * Functions and enums from GL versions and extensions newer than the 3.3 core
+ * profile that glad was generated for. They are loaded by LoadGLExtensions()
+ * after glad, and the function pointers are null when the driver doesn't
+ * support them, so always check the matching GLEXT_ flag first.
+ */
+
+// GL_ARB_get_program_binary (core in 4.1)
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH           0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS      0x87FE
+#define GL_PROGRAM_BINARY_FORMATS          0x87FF
+#endif
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize,
+        GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat,
+        const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname,
+        GLint value);
+
+extern bool GLEXT_ARB_get_program_binary;
+extern PFNGLGETPROGRAMBINARYPROC glext_glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC glext_glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC glext_glProgramParameteri;
+#define glGetProgramBinary glext_glGetProgramBinary
+#define glProgramBinary glext_glProgramBinary
+#define glProgramParameteri glext_glProgramParameteri
+
+// GL_ARB_multi_draw_indirect with GL_ARB_base_instance (core in 4.3). The
+// base instance of each command is needed to find its per draw data.
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type,
+        const void *indirect, GLsizei drawcount, GLsizei stride);
+
+/* Layout of one command in the GL_DRAW_INDIRECT_BUFFER. */
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+extern bool GLEXT_ARB_multi_draw_indirect;
+extern PFNGLMULTIDRAWELEMENTSINDIRECTPROC glext_glMultiDrawElementsIndirect;
+#define glMultiDrawElementsIndirect glext_glMultiDrawElementsIndirect
+
+// GL_ARB_compute_shader with GL_ARB_shader_storage_buffer_object (core in
+// 4.3). Only used together, so they share one flag.
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER               0x91B9
+#define GL_SHADER_STORAGE_BUFFER        0x90D2
+#define GL_SHADER_STORAGE_BARRIER_BIT   0x00002000
+#define GL_COMMAND_BARRIER_BIT          0x00000040
+#endif
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint numGroupsX,
+        GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+
+extern bool GLEXT_ARB_compute_shader;
+extern PFNGLDISPATCHCOMPUTEPROC glext_glDispatchCompute;
+extern PFNGLMEMORYBARRIERPROC glext_glMemoryBarrier;
+#define glDispatchCompute glext_glDispatchCompute
+#define glMemoryBarrier glext_glMemoryBarrier
+
+/* Loads the functions above. Call once after gladLoadGLLoader(). */
+void LoadGLExtensions();
@@ -0,0 +1,93 @@
+#include "gpu_timer.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+
+#include <SDL3/SDL.h>
+
+
+void GPUTimer::Init()
+{
+    glGenQueries(cFrames * cMaxSections * 2, &mQueries[0][0]);
+    for (int i = 0; i < cFrames; i++) {
+        mNumSections[i] = 0;
+        mPending[i] = false;
+    }
+    mFrame = 0;
+    mRecording = false;
+    mInSection = false;
+    GLERR;
+}
+
+
+void GPUTimer::Destroy()
+{
+    glDeleteQueries(cFrames * cMaxSections * 2, &mQueries[0][0]);
+    for (int i = 0; i < cFrames; i++) {
+        mPending[i] = false;
+    }
+}
+
+
+bool GPUTimer::BeginFrame()
+{
+    bool newResult = false;
+    // Oldest first, so the newest result is the one that's kept.
+    for (int i = 1; i <= cFrames; i++) {
+        int f = (mFrame + i) % cFrames;
+        if (!mPending[f]) continue;
+        // Queries finish in order, so the last one being ready means they
+        // all are.
+        GLuint available = 0;
+        glGetQueryObjectuiv(mQueries[f][mNumSections[f] * 2 - 1],
+                            GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+        GLuint64 total = 0;
+        for (int s = 0; s < mNumSections[f]; s++) {
+            GLuint64 start = 0, stop = 0;
+            glGetQueryObjectui64v(mQueries[f][s * 2], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(mQueries[f][s * 2 + 1], GL_QUERY_RESULT, &stop);
+            total += stop - start;
+        }
+        mMilliseconds = total / 1.0e6f;
+        mPending[f] = false;
+        newResult = true;
+    }
+
+    mFrame = (mFrame + 1) % cFrames;
+    mRecording = !mPending[mFrame];
+    if (mRecording) {
+        mNumSections[mFrame] = 0;
+    }
+    GLERR;
+    return newResult;
+}
+
+
+void GPUTimer::EndFrame()
+{
+    if (mRecording && mNumSections[mFrame] > 0) {
+        mPending[mFrame] = true;
+    }
+    mRecording = false;
+}
+
+
+void GPUTimer::Start()
+{
+    if (!mRecording || mInSection || mNumSections[mFrame] == cMaxSections) return;
+    glQueryCounter(mQueries[mFrame][mNumSections[mFrame] * 2], GL_TIMESTAMP);
+    mInSection = true;
+}
+
+
+void GPUTimer::Stop()
+{
+    if (!mInSection) return;
+    glQueryCounter(mQueries[mFrame][mNumSections[mFrame] * 2 + 1], GL_TIMESTAMP);
+    mNumSections[mFrame]++;
+    mInSection = false;
+}
+
+
+float GPUTimer::GetMilliseconds() const     { return mMilliseconds; }
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * Measures GPU time with timestamp queries. Any number of Start()/Stop()
+ * pairs (up to a limit) can be made in a frame, and their times are summed.
+ * Results are read a few frames later, once the GPU has finished them, so
+ * the CPU never waits. Timestamps are used instead of GL_TIME_ELAPSED
+ * queries, which can't be nested, so timers can overlap each other.
+ */
+
+struct GPUTimer {
+    void Init();
+    void Destroy();
+    /* Reads the frames that have finished and starts recording a new one.
+     * Returns true if there is a new result. */
+    bool BeginFrame();
+    void EndFrame();
+    void Start();
+    void Stop();
+    /* Milliseconds of the newest finished frame. */
+    float GetMilliseconds() const;
+
+private:
+    static constexpr int cFrames = 4;
+    static constexpr int cMaxSections = 8;
+
+    // Start and stop timestamps of each section of each frame in flight
+    unsigned int mQueries[cFrames][cMaxSections * 2] = {};
+    int mNumSections[cFrames] = {};
+    bool mPending[cFrames] = {};
+    int mFrame = 0;
+    // False if this frame isn't being recorded because the GPU is too far
+    // behind.
+    bool mRecording = false;
+    bool mInSection = false;
+    float mMilliseconds = 0.0f;
+};
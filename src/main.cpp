@@ -9,7 +9,7 @@
 
 SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[])
 {
-    return MainGame::Init();
+    return MainGame::Init(argc, argv);
 }
 
 
@@ -20,6 +20,7 @@
 #include "input_mapping.h"
 #include "audio.h"
 #include "render.h"
+#include "render_deferred.h"
 #include "player.h"
 #include "font.h"
 #include "ui.h"
@@ -224,12 +225,41 @@ void MainGame::Quit()
 }
 
 
-SDL_AppResult MainGame::Init()
+/* Applies the command line options, which have to be known before the
+ * renderer is initialised. */
+static void ParseArguments(int argc, char *argv[])
+{
+    const char *rendererArg = "--renderer=";
+    size_t rendererArgLen = SDL_strlen(rendererArg);
+    for (int i = 1; i < argc; i++) {
+        if (SDL_strncmp(argv[i], rendererArg, rendererArgLen) != 0) {
+            SDL_Log("Unknown argument %s", argv[i]);
+            continue;
+        }
+        const char *name = argv[i] + rendererArgLen;
+        bool found = false;
+        for (int p = 0; p < Render::NUM_RENDER_PATHS; p++) {
+            Render::RenderPath path = (Render::RenderPath)p;
+            if (SDL_strcmp(name, Render::GetRenderPathName(path)) == 0) {
+                Render::SetRenderPath(path);
+                found = true;
+            }
+        }
+        if (!found) {
+            SDL_Log("Unknown renderer %s, expected forward or deferred", name);
+        }
+    }
+}
+
+
+SDL_AppResult MainGame::Init(int argc, char *argv[])
 {
     SDL_SetAppMetadataProperty(SDL_PROP_APP_METADATA_NAME_STRING, "Car Game");
     SDL_SetAppMetadataProperty(SDL_PROP_APP_METADATA_TYPE_STRING, "game");
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_GAMEPAD | SDL_INIT_AUDIO);
 
+    ParseArguments(argc, argv);
+
     if (!Render::Init()) {
         return SDL_APP_FAILURE;
     }
@@ -10,7 +10,9 @@ enum GameState {
 };
 
 namespace MainGame {
-    SDL_AppResult Init();
+    /* argv may pick the renderer with --renderer=forward or
+     * --renderer=deferred, see render_deferred.h. */
+    SDL_AppResult Init(int argc, char *argv[]);
     SDL_AppResult HandleEvent(SDL_Event *event);
     SDL_AppResult Update();
     void StartWorld();
@@ -0,0 +1,629 @@
+#include "mesh_optimize.h"
+#include "model.h"
+
+#include <SDL3/SDL.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+// Post-transform cache size used for ACMR numbers and the overdraw clusters.
+// Most hardware since 2010 or so is roughly this or better.
+static constexpr int cFifoCacheSize = 16;
+
+
+/* FIFO cache simulation. A vertex is in the cache if it was added less than
+ * cacheSize misses ago. Reset() empties the cache without touching every
+ * vertex. */
+struct FifoCache {
+    FifoCache(size_t numVertices, int cacheSize)
+        : mAddedAt(numVertices, 0), mTime(cacheSize + 1), mCacheSize(cacheSize)
+    {
+    }
+
+    /* Returns 1 on a miss, 0 on a hit. */
+    int Fetch(unsigned int vertex)
+    {
+        if (mTime - mAddedAt[vertex] > (unsigned int)mCacheSize) {
+            mAddedAt[vertex] = mTime++;
+            return 1;
+        }
+        return 0;
+    }
+
+    void Reset()    { mTime += mCacheSize + 1; }
+
+    std::vector<unsigned int> mAddedAt;
+    unsigned int mTime;
+    int mCacheSize;
+};
+
+
+float GetACMR(const std::vector<unsigned int> &indices, size_t numVertices,
+              int cacheSize)
+{
+    if (indices.empty()) return 0.0f;
+    FifoCache cache(numVertices, cacheSize);
+    size_t misses = 0;
+    for (unsigned int index : indices) {
+        misses += cache.Fetch(index);
+    }
+    return (float)misses / (indices.size() / 3);
+}
+
+
+struct VertexHash {
+    size_t operator()(const Vertex &v) const
+    {
+        // FNV-1a of the bytes. Vertex is all floats, so there is no padding.
+        const uint8_t *bytes = (const uint8_t*)&v;
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(Vertex); i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+struct VertexEqual {
+    bool operator()(const Vertex &a, const Vertex &b) const
+    {
+        return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+
+void WeldVertices(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    std::unordered_map<Vertex, unsigned int, VertexHash, VertexEqual> unique;
+    unique.reserve(vertices.size());
+    std::vector<Vertex> welded;
+    std::vector<unsigned int> remap(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        auto [it, inserted] = unique.emplace(vertices[i], welded.size());
+        if (inserted) {
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = it->second;
+    }
+    for (unsigned int &index : indices) {
+        index = remap[index];
+    }
+    vertices = std::move(welded);
+}
+
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation", 2006. Uses an LRU
+// cache that is larger than the real one so that it works for any hardware
+// cache size up to cForsythCacheSize.
+static constexpr int cForsythCacheSize = 32;
+static constexpr float cCacheDecayPower = 1.5f;
+static constexpr float cLastTriScore = 0.75f;
+static constexpr float cValenceBoostScale = 2.0f;
+static constexpr float cValenceBoostPower = 0.5f;
+
+
+static float ForsythVertexScore(int cachePosition, int remainingTriangles)
+{
+    // Vertices that aren't used by any more triangles never matter.
+    if (remainingTriangles == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // Used by the last triangle. Fixed score so that the next
+            // triangle doesn't just reuse the same edge every time.
+            score = cLastTriScore;
+        } else {
+            float scaler = 1.0f / (cForsythCacheSize - 3);
+            score = 1.0f - (cachePosition - 3) * scaler;
+            score = SDL_powf(score, cCacheDecayPower);
+        }
+    }
+    // Favour vertices with few triangles left, so that lone triangles are
+    // finished off instead of being left for later.
+    score += cValenceBoostScale * SDL_powf((float)remainingTriangles,
+                                           -cValenceBoostPower);
+    return score;
+}
+
+
+void OptimizeVertexCache(std::vector<unsigned int> &indices, size_t numVertices)
+{
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0) return;
+
+    // Triangles of each vertex, as offsets into one array.
+    std::vector<uint32_t> triangleOffsets(numVertices + 1, 0);
+    for (unsigned int index : indices) {
+        triangleOffsets[index + 1]++;
+    }
+    for (size_t v = 0; v < numVertices; v++) {
+        triangleOffsets[v + 1] += triangleOffsets[v];
+    }
+    std::vector<uint32_t> vertexTriangles(indices.size());
+    std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        vertexTriangles[fill[indices[i]]++] = i / 3;
+    }
+
+    // Number of triangles not yet output for each vertex. Output triangles
+    // are swapped to the end of the vertex's list, so the first
+    // remaining[v] entries are the ones still to go.
+    std::vector<uint32_t> remaining(numVertices);
+    std::vector<int> cachePosition(numVertices, -1);
+    std::vector<float> vertexScore(numVertices);
+    for (size_t v = 0; v < numVertices; v++) {
+        remaining[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+        vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScore(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    for (size_t t = 0; t < numTriangles; t++) {
+        triangleScore[t] = vertexScore[indices[t * 3]]
+                         + vertexScore[indices[t * 3 + 1]]
+                         + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> newCache;
+    cache.reserve(cForsythCacheSize + 3);
+    newCache.reserve(cForsythCacheSize + 3);
+    // Where to continue the linear search for the best triangle when the
+    // cache has no candidates.
+    size_t searchStart = 0;
+
+    int64_t bestTriangle = -1;
+    while (output.size() < indices.size()) {
+        if (bestTriangle < 0) {
+            float bestScore = -1.0f;
+            while (searchStart < numTriangles && emitted[searchStart]) {
+                searchStart++;
+            }
+            // Only scanning a window keeps this linear for big meshes. The
+            // scores of triangles outside of the cache only depend on the
+            // valence, so the first few are as good as any.
+            for (size_t t = searchStart; t < numTriangles && t < searchStart + 64; t++) {
+                if (!emitted[t] && triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        // Output the triangle and put its vertices at the front of the cache.
+        emitted[bestTriangle] = true;
+        newCache.clear();
+        for (int i = 0; i < 3; i++) {
+            unsigned int v = indices[bestTriangle * 3 + i];
+            output.push_back(v);
+            newCache.push_back(v);
+
+            uint32_t *tris = &vertexTriangles[triangleOffsets[v]];
+            for (uint32_t j = 0; j < remaining[v]; j++) {
+                if (tris[j] == bestTriangle) {
+                    std::swap(tris[j], tris[remaining[v] - 1]);
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+        for (unsigned int v : cache) {
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+                newCache.push_back(v);
+            }
+        }
+        // Vertices that fell out of the cache lose their cache score.
+        for (size_t i = cForsythCacheSize; i < newCache.size(); i++) {
+            unsigned int v = newCache[i];
+            cachePosition[v] = -1;
+            vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+        }
+        newCache.resize(SDL_min(newCache.size(), (size_t)cForsythCacheSize));
+        std::swap(cache, newCache);
+
+        // Rescore the vertices in the cache and their triangles, and pick
+        // the best of those triangles for the next step.
+        for (size_t i = 0; i < cache.size(); i++) {
+            unsigned int v = cache[i];
+            cachePosition[v] = i;
+            vertexScore[v] = ForsythVertexScore(i, remaining[v]);
+        }
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : cache) {
+            const uint32_t *tris = &vertexTriangles[triangleOffsets[v]];
+            for (uint32_t j = 0; j < remaining[v]; j++) {
+                uint32_t t = tris[j];
+                float score = vertexScore[indices[t * 3]]
+                            + vertexScore[indices[t * 3 + 1]]
+                            + vertexScore[indices[t * 3 + 2]];
+                triangleScore[t] = score;
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
+        }
+    }
+    indices = std::move(output);
+}
+
+
+void OptimizeOverdraw(std::vector<unsigned int> &indices,
+                      const std::vector<Vertex> &vertices, float threshold)
+{
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles < 2) return;
+
+    // Hard boundaries are where the cache order starts over anyway, i.e. a
+    // triangle misses on all three vertices. Moving those clusters around
+    // costs nothing.
+    std::vector<size_t> hardBoundaries;
+    FifoCache cache(vertices.size(), cFifoCacheSize);
+    for (size_t t = 0; t < numTriangles; t++) {
+        int misses = cache.Fetch(indices[t * 3]) + cache.Fetch(indices[t * 3 + 1])
+                   + cache.Fetch(indices[t * 3 + 2]);
+        if (misses == 3) {
+            hardBoundaries.push_back(t);
+        }
+    }
+    hardBoundaries.push_back(numTriangles);
+
+    // Split the hard clusters further where a cluster started from an empty
+    // cache would be within threshold of the ACMR of the whole hard cluster.
+    std::vector<size_t> clusters;
+    for (size_t c = 0; c + 1 < hardBoundaries.size(); c++) {
+        size_t start = hardBoundaries[c];
+        size_t end = hardBoundaries[c + 1];
+
+        cache.Reset();
+        size_t misses = 0;
+        for (size_t t = start; t < end; t++) {
+            for (int i = 0; i < 3; i++) {
+                misses += cache.Fetch(indices[t * 3 + i]);
+            }
+        }
+        float target = threshold * misses / (end - start);
+
+        clusters.push_back(start);
+        cache.Reset();
+        size_t clusterMisses = 0;
+        size_t clusterTriangles = 0;
+        for (size_t t = start; t < end; t++) {
+            for (int i = 0; i < 3; i++) {
+                clusterMisses += cache.Fetch(indices[t * 3 + i]);
+            }
+            clusterTriangles++;
+            if (t + 1 < end && clusterMisses <= target * clusterTriangles) {
+                clusters.push_back(t + 1);
+                cache.Reset();
+                clusterMisses = 0;
+                clusterTriangles = 0;
+            }
+        }
+    }
+    clusters.push_back(numTriangles);
+
+    // Clusters facing away from the centre of the mesh are usually on the
+    // outside, so draw those first to occlude the rest.
+    glm::vec3 meshCentroid = glm::vec3(0.0f);
+    for (unsigned int index : indices) {
+        meshCentroid += vertices[index].position;
+    }
+    meshCentroid /= (float)indices.size();
+
+    struct ClusterSort {
+        size_t mStart;
+        size_t mEnd;
+        float mKey;
+    };
+    std::vector<ClusterSort> sorted;
+    for (size_t c = 0; c + 1 < clusters.size(); c++) {
+        glm::vec3 centroid = glm::vec3(0.0f);
+        glm::vec3 normal = glm::vec3(0.0f);
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            glm::vec3 p0 = vertices[indices[t * 3]].position;
+            glm::vec3 p1 = vertices[indices[t * 3 + 1]].position;
+            glm::vec3 p2 = vertices[indices[t * 3 + 2]].position;
+            // Area weighted, as the cross product is twice the area.
+            glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+            centroid += (p0 + p1 + p2) * (glm::length(areaNormal) / 3.0f);
+            normal += areaNormal;
+        }
+        float area = glm::length(normal);
+        float key = 0.0f;
+        if (area > 0.0f) {
+            centroid /= area;
+            key = glm::dot(centroid - meshCentroid, normal / area);
+        }
+        sorted.push_back({clusters[c], clusters[c + 1], key});
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const ClusterSort &a, const ClusterSort &b) {
+                         return a.mKey > b.mKey;
+                     });
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (const ClusterSort &cluster : sorted) {
+        output.insert(output.end(), indices.begin() + cluster.mStart * 3,
+                      indices.begin() + cluster.mEnd * 3);
+    }
+    indices = std::move(output);
+}
+
+
+void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    // New index of each old vertex, in order of first use. Vertices that no
+    // triangle uses are dropped.
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (unsigned int &index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(reordered);
+}
+
+
+void OptimizeMesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+                  const char *name)
+{
+    size_t verticesBefore = vertices.size();
+    float acmrBefore = GetACMR(indices, vertices.size(), cFifoCacheSize);
+
+    WeldVertices(vertices, indices);
+    OptimizeVertexCache(indices, vertices.size());
+    OptimizeOverdraw(indices, vertices);
+    OptimizeVertexFetch(vertices, indices);
+
+    float acmrAfter = GetACMR(indices, vertices.size(), cFifoCacheSize);
+    SDL_Log("Optimized mesh %s: %zu -> %zu vertices, ACMR %.3f -> %.3f",
+            name, verticesBefore, vertices.size(), acmrBefore, acmrAfter);
+}
+
+
+/* Sum of squared distances to a set of planes, as a symmetric 4x4 matrix. */
+struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0;
+    double b2 = 0, bc = 0, bd = 0;
+    double c2 = 0, cd = 0;
+    double d2 = 0;
+
+    void AddPlane(glm::dvec3 n, double d)
+    {
+        a2 += n.x * n.x; ab += n.x * n.y; ac += n.x * n.z; ad += n.x * d;
+        b2 += n.y * n.y; bc += n.y * n.z; bd += n.y * d;
+        c2 += n.z * n.z; cd += n.z * d;
+        d2 += d * d;
+    }
+
+    void Add(const Quadric &q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    double Evaluate(glm::dvec3 p) const
+    {
+        double e = a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+                 + b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+                 + c2 * p.z * p.z + 2 * cd * p.z
+                 + d2;
+        // Rounding can make it slightly negative.
+        return e > 0.0 ? e : 0.0;
+    }
+};
+
+
+struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const
+    {
+        uint32_t bits[3];
+        memcpy(bits, &p, sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+
+/* Marks vertices that must not move: ones sharing their position with other
+ * vertices (attribute seams) and ones on open or non-manifold edges. */
+static std::vector<bool> FindLockedVertices(const std::vector<Vertex> &vertices,
+                                            const std::vector<unsigned int> &indices)
+{
+    std::unordered_map<glm::vec3, unsigned int, PositionHash> positions;
+    std::vector<unsigned int> positionIdx(vertices.size());
+    std::vector<unsigned int> positionCount;
+    for (size_t v = 0; v < vertices.size(); v++) {
+        auto [it, inserted] = positions.emplace(vertices[v].position,
+                                                positionCount.size());
+        if (inserted) {
+            positionCount.push_back(0);
+        }
+        positionIdx[v] = it->second;
+        positionCount[it->second]++;
+    }
+
+    std::unordered_map<uint64_t, int> edgeUses;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        for (int e = 0; e < 3; e++) {
+            uint32_t a = positionIdx[indices[i + e]];
+            uint32_t b = positionIdx[indices[i + (e + 1) % 3]];
+            uint64_t key = a < b ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a);
+            edgeUses[key]++;
+        }
+    }
+    std::vector<bool> lockedPositions(positionCount.size(), false);
+    for (size_t p = 0; p < positionCount.size(); p++) {
+        lockedPositions[p] = positionCount[p] > 1;
+    }
+    for (const auto &[key, uses] : edgeUses) {
+        if (uses != 2) {
+            lockedPositions[key >> 32] = true;
+            lockedPositions[key & 0xFFFFFFFF] = true;
+        }
+    }
+
+    std::vector<bool> locked(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++) {
+        locked[v] = lockedPositions[positionIdx[v]];
+    }
+    return locked;
+}
+
+
+std::vector<unsigned int> SimplifyMesh(const std::vector<Vertex> &vertices,
+                                       const std::vector<unsigned int> &indices,
+                                       size_t targetIndexCount, float *outError)
+{
+    std::vector<unsigned int> result = indices;
+    double maxCost = 0.0;
+    std::vector<bool> locked = FindLockedVertices(vertices, indices);
+
+    std::vector<Quadric> quadrics(vertices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        glm::dvec3 p0 = vertices[indices[i]].position;
+        glm::dvec3 p1 = vertices[indices[i + 1]].position;
+        glm::dvec3 p2 = vertices[indices[i + 2]].position;
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        if (length == 0.0) continue;
+        normal /= length;
+        Quadric q;
+        q.AddPlane(normal, -glm::dot(normal, p0));
+        for (int j = 0; j < 3; j++) {
+            quadrics[indices[i + j]].Add(q);
+        }
+    }
+
+    struct Collapse {
+        unsigned int mFrom;
+        unsigned int mTo;
+        double mCost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> triangleOffsets;
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<bool> touched(vertices.size());
+
+    // Each pass collapses the cheapest edges that don't touch an edge
+    // collapsed earlier in the pass. Costs are only updated between passes.
+    for (int pass = 0; pass < 100 && result.size() > targetIndexCount; pass++) {
+        size_t numTriangles = result.size() / 3;
+        triangleOffsets.assign(vertices.size() + 1, 0);
+        for (unsigned int index : result) {
+            triangleOffsets[index + 1]++;
+        }
+        for (size_t v = 0; v < vertices.size(); v++) {
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        }
+        vertexTriangles.resize(result.size());
+        std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (size_t i = 0; i < result.size(); i++) {
+            vertexTriangles[fill[result[i]]++] = i / 3;
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                unsigned int a = result[i + e];
+                unsigned int b = result[i + (e + 1) % 3];
+                Quadric q = quadrics[a];
+                q.Add(quadrics[b]);
+                if (!locked[a]) {
+                    collapses.push_back({a, b, q.Evaluate(vertices[b].position)});
+                }
+                if (!locked[b]) {
+                    collapses.push_back({b, a, q.Evaluate(vertices[a].position)});
+                }
+            }
+        }
+        if (collapses.empty()) break;
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &a, const Collapse &b) {
+                      return a.mCost < b.mCost;
+                  });
+        // Only the cheapest third, so that expensive collapses wait for the
+        // next pass, when cheaper ones may have appeared.
+        size_t limit = SDL_max(collapses.size() / 3, (size_t)1);
+
+        for (size_t v = 0; v < vertices.size(); v++) {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+        size_t trianglesLeft = numTriangles;
+        size_t numCollapsed = 0;
+        for (size_t c = 0; c < limit && trianglesLeft * 3 > targetIndexCount; c++) {
+            const Collapse &collapse = collapses[c];
+            if (touched[collapse.mFrom] || touched[collapse.mTo]) continue;
+
+            // Reject collapses that flip a triangle around mFrom.
+            bool flips = false;
+            int removed = 0;
+            glm::vec3 to = vertices[collapse.mTo].position;
+            for (uint32_t j = triangleOffsets[collapse.mFrom];
+                    j < triangleOffsets[collapse.mFrom + 1] && !flips; j++) {
+                uint32_t t = vertexTriangles[j];
+                unsigned int tri[3] = {remap[result[t * 3]], remap[result[t * 3 + 1]],
+                                       remap[result[t * 3 + 2]]};
+                if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) continue;
+                if (tri[0] == collapse.mTo || tri[1] == collapse.mTo
+                        || tri[2] == collapse.mTo) {
+                    removed++;
+                    continue;
+                }
+                glm::vec3 p[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = vertices[tri[k]].position;
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                for (int k = 0; k < 3; k++) {
+                    if (tri[k] == collapse.mFrom) p[k] = to;
+                }
+                glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips) continue;
+
+            remap[collapse.mFrom] = collapse.mTo;
+            quadrics[collapse.mTo].Add(quadrics[collapse.mFrom]);
+            touched[collapse.mFrom] = touched[collapse.mTo] = true;
+            trianglesLeft -= SDL_min((size_t)removed, trianglesLeft);
+            maxCost = SDL_max(maxCost, collapse.mCost);
+            numCollapsed++;
+        }
+        if (numCollapsed == 0) break;
+
+        size_t out = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            unsigned int a = remap[result[i]];
+            unsigned int b = remap[result[i + 1]];
+            unsigned int c = remap[result[i + 2]];
+            if (a == b || b == c || a == c) continue;
+            result[out++] = a;
+            result[out++] = b;
+            result[out++] = c;
+        }
+        result.resize(out);
+    }
+
+    *outError = (float)SDL_sqrt(maxCost);
+    return result;
+}
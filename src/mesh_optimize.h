@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+// Forward declarations
+struct Vertex;
+
+/*
+ * Load time mesh optimisation. OptimizeMesh() runs every step in order:
+ *  1. WeldVertices()           merges vertices that are exactly the same
+ *  2. OptimizeVertexCache()    orders triangles for the post-transform cache
+ *                              (Forsyth's linear speed algorithm)
+ *  3. OptimizeOverdraw()       orders clusters of triangles front to back
+ *                              from the outside in, keeping most of the
+ *                              cache order (after Tipsify)
+ *  4. OptimizeVertexFetch()    orders vertices by first use
+ * Indices are always triangle lists.
+ *
+ * SimplifyMesh() is used for LODs, see Mesh::Init().
+ */
+
+/* Average number of vertex shader invocations per triangle with a FIFO
+ * post-transform cache of cacheSize entries. 3 is the worst, around 0.5 to
+ * 0.7 is good for a regular grid. */
+float GetACMR(const std::vector<unsigned int> &indices, size_t numVertices,
+              int cacheSize = 16);
+void WeldVertices(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+void OptimizeVertexCache(std::vector<unsigned int> &indices, size_t numVertices);
+/* threshold is how much worse the ACMR of a cluster may get before it is
+ * split, e.g. 1.05 for 5% */
+void OptimizeOverdraw(std::vector<unsigned int> &indices,
+                      const std::vector<Vertex> &vertices, float threshold = 1.05f);
+void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+/* Runs all the steps above. name is only used in the log. */
+void OptimizeMesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+                  const char *name);
+
+/* Quadric error edge collapse. Returns indices for a mesh with at most
+ * targetIndexCount indices if it can get there, using the same vertices.
+ * Vertices on open edges and UV or normal seams never move, so the result
+ * has no cracks and keeps its outline. outError is the largest error of a
+ * collapse, roughly the distance moved in model units. */
+std::vector<unsigned int> SimplifyMesh(const std::vector<Vertex> &vertices,
+                                       const std::vector<unsigned int> &indices,
+                                       size_t targetIndexCount, float *outError);
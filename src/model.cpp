@@ -4,15 +4,66 @@
 #include "convert.h"
 #include "../glad/glad.h"
 #include "glerr.h"
+#include "geometry_pool.h"
+#include "mesh_optimize.h"
 
 #include <SDL3/SDL.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/DefaultLogger.hpp>
 
 #include <memory>
+#include <map>
+#include <tuple>
+
+// Half floats have a step of 1/2048 just below 1, which is half a texel of a
+// 1024 texture. It doubles with every power of two above that, so tiled UVs
+// would swim and seam. Meshes with UVs outside of [-1, 1] keep the full
+// format.
+static constexpr float cMaxPackedUV = 1.0f;
+
+static VertexFormat vertexFormat = VERTEX_FORMAT_PACKED;
+static bool optimizeMeshes = true;
+static bool generateLODs = true;
+
+// Meshes smaller than this aren't worth simplifying.
+static constexpr size_t cMinLODIndices = 3 * 256;
+
+
+static PackedVertexAttributes PackVertexAttributes(const Vertex &vertex)
+{
+    PackedVertexAttributes packed;
+    packed.normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.normal, 0.0f));
+    // The bitangent is rebuilt in the shader as cross(normal, tangent) * w.
+    float handedness = glm::dot(glm::cross(vertex.normal, vertex.tangent),
+                                vertex.bitangent) < 0.0f ? -1.0f : 1.0f;
+    packed.tangent = glm::packSnorm3x10_1x2(glm::vec4(vertex.tangent, handedness));
+    packed.texCoords = glm::packHalf2x16(vertex.texCoords);
+    return packed;
+}
+
+
+static bool CanPackUVs(const std::vector<Vertex> &vertices)
+{
+    for (const Vertex &vertex : vertices) {
+        if (glm::abs(vertex.texCoords.x) > cMaxPackedUV
+                || glm::abs(vertex.texCoords.y) > cMaxPackedUV) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void SetVertexFormat(VertexFormat format)   { vertexFormat = format; }
+VertexFormat GetVertexFormat()              { return vertexFormat; }
+void SetOptimizeMeshes(bool optimize)       { optimizeMeshes = optimize; }
+bool GetOptimizeMeshes()                    { return optimizeMeshes; }
+void SetGenerateLODs(bool generate)         { generateLODs = generate; }
+bool GetGenerateLODs()                      { return generateLODs; }
 
 
 void Mesh::Init(std::vector<Vertex> aVertices,
@@ -23,38 +74,64 @@ void Mesh::Init(std::vector<Vertex> aVertices,
     indices = aIndices;
     materialIdx = aMaterialIdx;
 
+    for (const Vertex &vertex : vertices) {
+        mBounds.Extend(vertex.position);
+    }
 
-    // Initialise all opengl vertex array stuff
-
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-
-    glBindVertexArray(vao);
+    mFormat = vertexFormat;
+    if (mFormat == VERTEX_FORMAT_PACKED && !CanPackUVs(vertices)) {
+        mFormat = VERTEX_FORMAT_FULL;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0],
-                 GL_STATIC_DRAW);
+    // Split the vertices into a position stream and an attribute stream so
+    // that depth only passes only have to fetch positions.
+    std::vector<glm::vec3> positions(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions[i] = vertices[i].position;
+    }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), 
-                 &indices[0], GL_STATIC_DRAW);
+    // Each LOD is simplified from the full mesh, and they all go into the
+    // pool together so they share the vertices.
+    std::vector<unsigned int> allIndices = indices;
+    mLODs.clear();
+    mLODs.push_back({0, (uint32_t)indices.size(), 0.0f});
+    if (generateLODs && indices.size() >= cMinLODIndices) {
+        for (int level = 1; level < MAX_MESH_LODS; level++) {
+            float error;
+            std::vector<unsigned int> lod = SimplifyMesh(
+                    vertices, indices, indices.size() >> level, &error);
+            // Stop when it barely gets simpler, e.g. when most of the
+            // vertices are on seams.
+            if (lod.size() > mLODs.back().mNumIndices * 4 / 5) break;
+            OptimizeVertexCache(lod, vertices.size());
+            mLODs.push_back({(uint32_t)allIndices.size(), (uint32_t)lod.size(), error});
+            allIndices.insert(allIndices.end(), lod.begin(), lod.end());
+        }
+    }
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) 0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 
-            (void*) (offsetof(Vertex, normal)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-            (void*) (offsetof(Vertex, texCoords)));
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-            (void*) (offsetof(Vertex, tangent)));
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-            (void*) (offsetof(Vertex, bitangent)));
+    if (mFormat == VERTEX_FORMAT_PACKED) {
+        std::vector<PackedVertexAttributes> attributes(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            attributes[i] = PackVertexAttributes(vertices[i]);
+        }
+        mGeometry = AllocateGeometry(mFormat, positions.data(), attributes.data(),
+                                     vertices.size(), allIndices.data(), allIndices.size());
+    } else {
+        std::vector<VertexAttributes> attributes(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            attributes[i].normal = vertices[i].normal;
+            attributes[i].texCoords = vertices[i].texCoords;
+            attributes[i].tangent = vertices[i].tangent;
+            attributes[i].bitangent = vertices[i].bitangent;
+        }
+        mGeometry = AllocateGeometry(mFormat, positions.data(), attributes.data(),
+                                     vertices.size(), allIndices.data(), allIndices.size());
+    }
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
+    // The VAOs belong to the geometry pool and are shared with every other
+    // mesh in the same block.
+    vao = GetGeometryVAO(mGeometry.mBlock);
+    depthVao = GetGeometryDepthVAO(mGeometry.mBlock);
 }
 
 
@@ -62,21 +139,40 @@ void Mesh::Init(std::vector<Vertex> aVertices,
 Mesh::~Mesh()
 {
     //SDL_Log("Deleting Mesh");
-    
-    if (vao) {
-        glDeleteVertexArrays(1, &vao);
-    }
-    if (vbo) {
-        glDeleteBuffers(1, &vbo);
-    }
-    if (ebo) {
-        glDeleteBuffers(1, &ebo);
-    }
+    FreeGeometry(&mGeometry);
 }
 
+size_t Mesh::GetGPUMemory() const
+{
+    size_t attributeSize = mFormat == VERTEX_FORMAT_PACKED
+                         ? sizeof(PackedVertexAttributes)
+                         : sizeof(VertexAttributes);
+    // The allocation also has the indices of the LODs.
+    return vertices.size() * (sizeof(glm::vec3) + attributeSize)
+         + mGeometry.mNumIndices * sizeof(unsigned int);
+}
+
+
+void *Mesh::GetIndexOffset(int lod) const
+{
+    return (void*) (GetFirstIndex(lod) * sizeof(unsigned int));
+}
+
+
+uint32_t Mesh::GetFirstIndex(int lod) const
+{
+    return mGeometry.mFirstIndex + mLODs[lod].mFirstIndex;
+}
+
+
+uint32_t Mesh::GetNumIndices(int lod) const   { return mLODs[lod].mNumIndices; }
+
+
 Mesh::Mesh()
 {
     //SDL_Log("Creating Mesh");
+    static unsigned int nextMeshId = 0;
+    mId = nextMeshId++;
 }
 
 Model::~Model()
@@ -98,56 +194,20 @@ Material::~Material()
 Material::Material()
 {
     //SDL_Log("Creating Material");
-}
-
-void Material::Destroy()
-{
-    texture.Destroy();
-    normalMap.Destroy();
-    roughnessMap.Destroy();
-}
-
-
-ModelNode::~ModelNode()
-{
-    //SDL_Log("Deleting Node");
-}
-
-ModelNode::ModelNode()
-{
-    //SDL_Log("Creating Node");
+    // Id 0 is never given out so it can be used as "no material".
+    static unsigned int nextMaterialId = 1;
+    mId = nextMaterialId++;
 }
 
 
-void Mesh::Draw(ShaderProg shader,
-                const std::vector<std::unique_ptr<Material>> &materials,
-                const Material *materialOverride) const
+void Material::Bind(const ShaderProg &shader) const
 {
-    glm::vec3 diffuseColour = glm::vec3(1.0f);
-    float roughness = 1.0;
-    
-    const Material *material = materials[materialIdx].get();
-    if (materialOverride) {
-        material = materialOverride;
-    }
-    
-    unsigned int texId = material->texture.id;
-    unsigned int normalMapId = material->normalMap.id;
-    unsigned int roughnessMapId = material->roughnessMap.id;
-    diffuseColour = material->diffuseColour;
-    roughness = material->roughness;
-
-    texId = texId == 0 ? gDefaultTexture.id : texId;
-    normalMapId = normalMapId == 0 ? gDefaultNormalMap.id : normalMapId;
-    roughnessMapId = roughnessMapId == 0 ? gDefaultTexture.id : roughnessMapId;
+    unsigned int texId = texture.id == 0 ? gDefaultTexture.id : texture.id;
+    unsigned int normalMapId = normalMap.id == 0 ? gDefaultNormalMap.id
+                                                 : normalMap.id;
+    unsigned int roughnessMapId = roughnessMap.id == 0 ? gDefaultTexture.id
+                                                       : roughnessMap.id;
 
-    /*
-    if (normalMapId != 0) {
-        SDL_Log("Normal map id: %d", normalMapId);
-    }
-    */
-
-    
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, roughnessMapId);
     glActiveTexture(GL_TEXTURE1);
@@ -155,69 +215,27 @@ void Mesh::Draw(ShaderProg shader,
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texId);
 
-    shader.SetInt((char*)"material.texture_diffuse", 0);
-    shader.SetInt((char*)"material.normalMap", 1);
-    shader.SetInt((char*)"material.roughnessMap", 2);
-
-    shader.SetVec3((char*)"material.baseColour",
-                    glm::value_ptr(diffuseColour));
-    shader.SetFloat((char*)"material.roughness", roughness);
-    shader.SetFloat((char*)"material.metallic", material->metallic);
-
-    glBindVertexArray(vao);
-    GLERR;
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    GLERR;
-    glBindVertexArray(0);
-}
-
-
-void ModelNode::Draw(ShaderProg shader,
-                     const std::vector<std::unique_ptr<Mesh>> &meshes,
-                     const std::vector<std::unique_ptr<Material>> &materials,
-                     glm::mat4 transform,
-                     const Material *materialOverride) const
-{
-    GLERR;
-    glm::mat4 newTrans = transform * mTransform;
-    newTrans = ToGlmMat4(ToJoltMat4(newTrans));
-    GLERR;
-    shader.SetMat4fv((char*)"model", glm::value_ptr(newTrans));
-
-    for (size_t i = 0; i < mMeshes.size(); i++) {
-        meshes[mMeshes[i]]->Draw(shader, materials, materialOverride);
-        GLERR;
-    }
+    shader.SetVec3("material.baseColour"_u, glm::value_ptr(diffuseColour));
+    shader.SetFloat("material.roughness"_u, roughness);
+    shader.SetFloat("material.metallic"_u, metallic);
 }
 
-
-void ModelNode::Draw(ShaderProg shader,
-                     const std::vector<std::unique_ptr<Mesh>> &meshes,
-                     const std::vector<std::unique_ptr<Material>> &materials,
-                     const Material *materialOverride) const
+void Material::Destroy()
 {
-    Draw(shader, meshes, materials, glm::mat4(1.0f), materialOverride);
+    texture.Destroy();
+    normalMap.Destroy();
+    roughnessMap.Destroy();
 }
 
 
-void Model::Draw(ShaderProg shader, glm::mat4 transform,
-                 const Material *materialOverride) const
+ModelNode::~ModelNode()
 {
-    GLERR;
-    for (unsigned int i = 0; i < nodes.size(); i++) {
-        nodes[i]->Draw(shader, meshes, materials, transform, materialOverride);
-        GLERR;
-    }
+    //SDL_Log("Deleting Node");
 }
 
-
-void Model::Draw(ShaderProg shader, const Material *materialOverride) const
+ModelNode::ModelNode()
 {
-    GLERR;
-    for (unsigned int i = 0; i < nodes.size(); i++) {
-        nodes[i]->Draw(shader, meshes, materials, materialOverride);
-        GLERR;
-    }
+    //SDL_Log("Creating Node");
 }
 
 
@@ -291,16 +309,31 @@ void Model::LoadSceneMaterials(const aiScene *scene)
         }
         newMat->roughness = roughness;
         newMat->metallic = metallic;
+        aiString name;
+        if (aiMat->Get(AI_MATKEY_NAME, name) == aiReturn_SUCCESS) {
+            newMat->mName = name.C_Str();
+        }
 
         materials.push_back(std::move(newMat));
     }
 }
 
 
-void Model::LoadSceneMeshes(const aiScene *scene)
+int Model::FindMaterial(const char *name) const
+{
+    for (size_t i = 0; i < materials.size(); i++) {
+        if (materials[i]->mName == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void Model::LoadSceneMeshes(const aiScene *scene, bool upload)
 {
     for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
-        ProcessMesh(scene->mMeshes[i]);
+        ProcessMesh(scene->mMeshes[i], upload);
     }
 }
 
@@ -364,6 +397,10 @@ void Model::ProcessNode(const aiNode *node, aiMatrix4x4 accTransform, const aiSc
     // Only add the model node if it contains meshes
     if (modelNode->mMeshes.size() > 0) {
         modelNode->mTransform = ToGlmMat4(transform);
+        for (int meshIdx : modelNode->mMeshes) {
+            modelNode->mBounds.Extend(
+                    meshes[meshIdx]->mBounds.Transformed(modelNode->mTransform));
+        }
         nodes.push_back(std::move(modelNode));
     }
     
@@ -374,7 +411,7 @@ void Model::ProcessNode(const aiNode *node, aiMatrix4x4 accTransform, const aiSc
 }
 
 
-void Model::ProcessMesh(aiMesh *mesh)
+void Model::ProcessMesh(aiMesh *mesh, bool upload)
 {
     /* Convert an aiMesh object to a Mesh object */
     std::vector<Vertex> vertices;
@@ -436,14 +473,124 @@ void Model::ProcessMesh(aiMesh *mesh)
 
     // NOTE: There will always be at least one material
     SDL_assert(materials.size() > mesh->mMaterialIndex);
-    
-    std::unique_ptr<Mesh> returnMesh = std::make_unique<Mesh>();
-    returnMesh->Init(vertices, indices, mesh->mMaterialIndex);
-    meshes.push_back(std::move(returnMesh));
+
+    if (upload) {
+        AddMesh(std::move(vertices), std::move(indices), mesh->mMaterialIndex,
+                mesh->mName.C_Str());
+        return;
+    }
+    // Only the CPU data, for BatchStatic() to merge.
+    std::unique_ptr<Mesh> cpuMesh = std::make_unique<Mesh>();
+    cpuMesh->vertices = std::move(vertices);
+    cpuMesh->indices = std::move(indices);
+    cpuMesh->materialIdx = mesh->mMaterialIndex;
+    for (const Vertex &vertex : cpuMesh->vertices) {
+        cpuMesh->mBounds.Extend(vertex.position);
+    }
+    meshes.push_back(std::move(cpuMesh));
+}
+
+
+void Model::AddMesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
+                    unsigned int materialIdx, const char *name)
+{
+    if (optimizeMeshes) {
+        OptimizeMesh(vertices, indices, name);
+    }
+
+    std::unique_ptr<Mesh> newMesh = std::make_unique<Mesh>();
+    newMesh->Init(std::move(vertices), std::move(indices), materialIdx);
+    meshes.push_back(std::move(newMesh));
+}
+
+
+/* Tangents are zero for meshes without UVs, which normalize() turns into
+ * NaNs. */
+static glm::vec3 SafeNormalize(glm::vec3 v)
+{
+    float length = glm::length(v);
+    return length > 0.0f ? v / length : v;
 }
 
 
-Model* LoadModel(std::string path, node_callback_t NodeCallback, light_callback_t LightCallback)
+void Model::BatchStatic(float cellSize)
+{
+    // Material index then cell coordinates
+    using CellKey = std::tuple<unsigned int, int, int, int>;
+    struct Batch {
+        std::vector<Vertex> mVertices;
+        std::vector<unsigned int> mIndices;
+    };
+    // std::map so the meshes come out in the same order on every load.
+    std::map<CellKey, Batch> batches;
+
+    size_t numNodeMeshes = 0;
+    for (const std::unique_ptr<ModelNode> &node : nodes) {
+        const glm::mat4 &transform = node->mTransform;
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+        // Mirrored nodes flip the winding of their triangles.
+        bool flip = glm::determinant(glm::mat3(transform)) < 0.0f;
+
+        for (int meshIdx : node->mMeshes) {
+            const Mesh &mesh = *meshes[meshIdx];
+            // Whole meshes go into the cell of their centre, so a mesh is
+            // never split and cells only grow a little past their edges.
+            glm::vec3 centre = mesh.mBounds.Transformed(transform).Centre();
+            glm::ivec3 cell = glm::ivec3(glm::floor(centre / cellSize));
+            Batch &batch = batches[{mesh.materialIdx, cell.x, cell.y, cell.z}];
+
+            unsigned int baseVertex = batch.mVertices.size();
+            for (const Vertex &vertex : mesh.vertices) {
+                Vertex v;
+                v.position = glm::vec3(transform * glm::vec4(vertex.position, 1.0f));
+                v.normal = SafeNormalize(normalMatrix * vertex.normal);
+                v.tangent = SafeNormalize(glm::mat3(transform) * vertex.tangent);
+                v.bitangent = SafeNormalize(glm::mat3(transform) * vertex.bitangent);
+                v.texCoords = vertex.texCoords;
+                batch.mVertices.push_back(v);
+            }
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                batch.mIndices.push_back(baseVertex + mesh.indices[i]);
+                batch.mIndices.push_back(baseVertex + mesh.indices[flip ? i + 2 : i + 1]);
+                batch.mIndices.push_back(baseVertex + mesh.indices[flip ? i + 1 : i + 2]);
+            }
+            numNodeMeshes++;
+        }
+    }
+
+    // The source meshes were never uploaded, so this only frees their CPU
+    // data. Each batch is optimised and uploaded once below.
+    size_t numOldNodes = nodes.size();
+    nodes.clear();
+    meshes.clear();
+    std::map<std::tuple<int, int, int>, ModelNode*> cellNodes;
+    for (auto &[key, batch] : batches) {
+        auto [materialIdx, x, y, z] = key;
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "batch %u (%d, %d, %d)",
+                     materialIdx, x, y, z);
+        AddMesh(std::move(batch.mVertices), std::move(batch.mIndices),
+                materialIdx, name);
+        const Mesh *mesh = meshes.back().get();
+
+        ModelNode *&node = cellNodes[{x, y, z}];
+        if (node == nullptr) {
+            std::unique_ptr<ModelNode> newNode = std::make_unique<ModelNode>();
+            newNode->mTransform = glm::mat4(1.0f);
+            node = newNode.get();
+            nodes.push_back(std::move(newNode));
+        }
+        node->mMeshes.push_back(meshes.size() - 1);
+        node->mBounds.Extend(mesh->mBounds);
+    }
+
+    SDL_Log("Static batching: %zu meshes in %zu nodes merged into %zu meshes in %zu cells",
+            numNodeMeshes, numOldNodes, meshes.size(), nodes.size());
+}
+
+
+Model* LoadModel(std::string path, node_callback_t NodeCallback, light_callback_t LightCallback,
+                 float staticBatchCellSize)
 {
     //Assimp::Logger *logger = Assimp::DefaultLogger::create(
     //        ASSIMP_DEFAULT_LOG_NAME, Assimp::Logger::NORMAL, 
@@ -467,7 +614,9 @@ Model* LoadModel(std::string path, node_callback_t NodeCallback, light_callback_
     Model *model = new Model;
 
     model->LoadSceneMaterials(scene);
-    model->LoadSceneMeshes(scene);
+    // Batched meshes are only optimised and uploaded after merging.
+    bool batch = staticBatchCellSize > 0.0f;
+    model->LoadSceneMeshes(scene, !batch);
 
     SDL_Log("Num lights: %d", scene->mNumLights);
     if (scene->mNumLights > 0) {
@@ -501,6 +650,27 @@ Model* LoadModel(std::string path, node_callback_t NodeCallback, light_callback_
     // Global transform of root, which is identity matrix
     aiMatrix4x4 transform;
     model->ProcessNode(scene->mRootNode, transform, scene, NodeCallback, LightCallback);
+    if (batch) {
+        model->BatchStatic(staticBatchCellSize);
+    }
+
+    size_t numVertices = 0;
+    size_t gpuMemory = 0;
+    size_t numLODs = 0;
+    // Meshes with wide UVs fall back to the full format, see CanPackUVs().
+    size_t numPacked = 0;
+    for (const std::unique_ptr<Mesh> &mesh : model->meshes) {
+        numVertices += mesh->vertices.size();
+        gpuMemory += mesh->GetGPUMemory();
+        numLODs += mesh->mLODs.size() - 1;
+        if (mesh->mFormat == VERTEX_FORMAT_PACKED) {
+            numPacked++;
+        }
+    }
+    SDL_Log("Loaded %s: %zu vertices, %zu KiB of vertex and index data "
+            "(%zu packed, %zu full meshes), %zu LODs",
+            path.c_str(), numVertices, gpuMemory / 1024, numPacked,
+            model->meshes.size() - numPacked, numLODs);
     return model;
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "texture.h"
+#include "bounds.h"
+#include "geometry_pool.h"
+#include "render_defines.h"
 
 #include <glm/glm.hpp>
 #include <assimp/Importer.hpp>
@@ -9,6 +12,7 @@
 
 #include <vector>
 #include <memory>
+#include <string>
 
 
 // Forward declarations
@@ -17,6 +21,16 @@ struct ShaderProg;
 using node_callback_t = bool (*)(const aiNode *node, aiMatrix4x4 transform);
 using light_callback_t = void (*)(const aiLight *light, const aiNode *node, aiMatrix4x4 transform);
 
+/* Layout of the vertex attribute stream on the GPU. Positions are always full
+ * floats. The packed format stores normals and tangents as 10:10:10:2 snorm
+ * with the bitangent handedness in the tangent's w, and UVs as half floats.
+ * Meshes with UVs outside of [-1, 1] are stored in the full format, as half
+ * floats are too coarse there. */
+enum VertexFormat : int {
+    VERTEX_FORMAT_FULL,
+    VERTEX_FORMAT_PACKED
+};
+
 struct Vertex {
     glm::vec3 position;
     glm::vec3 normal;
@@ -31,12 +45,28 @@ struct Material
     Material();
     ~Material();
     void Destroy();
+    /* Binds the textures and sets the material uniforms of shader. */
+    void Bind(const ShaderProg &shader) const;
     Texture texture;
     Texture normalMap;
     Texture roughnessMap;
     glm::vec3 diffuseColour;
     float roughness = 1.0f;
     float metallic = 0.0f;
+    // Unique id used to sort draws by material.
+    unsigned int mId;
+    // Name from the model file
+    std::string mName;
+};
+
+/* A level of detail of a mesh. Every level uses the same vertices, only the
+ * indices differ. */
+struct MeshLOD {
+    // Relative to the first index of the mesh's allocation
+    uint32_t mFirstIndex;
+    uint32_t mNumIndices;
+    // Largest distance a vertex moved when simplifying, in model units
+    float mError;
 };
 
 struct Mesh {
@@ -47,16 +77,34 @@ struct Mesh {
 
     // Index of material in Model's materials vector
     unsigned int materialIdx;
-    unsigned int vao, vbo, ebo;
+    // Where the vertices and indices are in the geometry pool. Draws must add
+    // mGeometry.mBaseVertex and start at GetIndexOffset(). The indices of
+    // every LOD are in the allocation one after another.
+    GeometryAllocation mGeometry;
+    // mLODs[0] is the full mesh. Coarser levels are only made if
+    // GetGenerateLODs() was set when loading.
+    std::vector<MeshLOD> mLODs;
+    // VAOs of the pool block. vao reads every attribute, depthVao only reads
+    // positions for depth only passes. Shared with other meshes in the block.
+    unsigned int vao = 0;
+    unsigned int depthVao = 0;
+    // Unique id used to sort draws of the same mesh together.
+    unsigned int mId;
+    VertexFormat mFormat = VERTEX_FORMAT_FULL;
+    // Bounds of the vertices in model space
+    AABB mBounds;
 
     void Init(std::vector<Vertex> aVertices,
               std::vector<unsigned int> aIndices,
               unsigned int aMaterialIdx);
-
-
-    void Draw(ShaderProg shader,
-              const std::vector<std::unique_ptr<Material>> &materials,
-              const Material *materialOverride = nullptr) const;
+    /* Size of the vertex and index buffers on the GPU in bytes. */
+    size_t GetGPUMemory() const;
+    /* Byte offset of the first index of a LOD in the block's index buffer,
+     * for the indices argument of glDrawElements*. */
+    void *GetIndexOffset(int lod = 0) const;
+    /* First index of a LOD in the block's index buffer, for indirect draws. */
+    uint32_t GetFirstIndex(int lod = 0) const;
+    uint32_t GetNumIndices(int lod = 0) const;
 
     Mesh();
     ~Mesh();
@@ -68,40 +116,61 @@ struct Mesh {
 struct ModelNode {
     ~ModelNode();
     ModelNode();
-    void Draw(ShaderProg shader,
-              const std::vector<std::unique_ptr<Mesh>> &meshes,
-              const std::vector<std::unique_ptr<Material>> &materials,
-              const Material *materialOverride = nullptr) const;
-    void Draw(ShaderProg shader,
-              const std::vector<std::unique_ptr<Mesh>> &meshes,
-              const std::vector<std::unique_ptr<Material>> &materials,
-              glm::mat4 transform,
-              const Material *materialOverride = nullptr) const;
 
     // Array of indices pointing to location of meshes in the Model's meshes
     // array
     std::vector<int> mMeshes;
     glm::mat4 mTransform;
+    // Bounds of all meshes in this node after applying mTransform
+    AABB mBounds;
 };
 
 
 struct Model {
     ~Model();
-    void Draw(ShaderProg shader, const Material *materialOverride = nullptr) const;
-    void Draw(ShaderProg shader, glm::mat4 transform,
-              const Material *materialOverride = nullptr) const;
 
     void LoadSceneMaterials(const aiScene *scene);
-    void LoadSceneMeshes(const aiScene *scene);
+    /* Converts every mesh of scene. If upload is false, the meshes only get
+     * their CPU data and bounds, and BatchStatic() has to be called after
+     * ProcessNode(). */
+    void LoadSceneMeshes(const aiScene *scene, bool upload = true);
     void ProcessNode(const aiNode *node, aiMatrix4x4 accTransform, const aiScene *scene, node_callback_t NodeCallback = NULL, light_callback_t LightCallback = NULL);
-    void ProcessMesh(aiMesh *mesh);
+    void ProcessMesh(aiMesh *mesh, bool upload = true);
+    /* Runs OptimizeMesh() if enabled, uploads the mesh with its LODs and
+     * appends it to meshes. */
+    void AddMesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
+                 unsigned int materialIdx, const char *name);
+    /* Index of the material called name in materials, or -1. */
+    int FindMaterial(const char *name) const;
+    /* Bakes the node transforms into the vertices and merges all meshes
+     * with the same material whose bounds are centred in the same
+     * cellSize sized cube into one mesh. Each cell becomes one node with an
+     * identity transform, so culling still works per cell. Only for models
+     * that never move, e.g. maps. The meshes must be loaded without
+     * uploading them, so that each merged mesh is optimised and uploaded
+     * only once. */
+    void BatchStatic(float cellSize);
     std::vector<std::unique_ptr<Mesh>> meshes;
     std::vector<std::unique_ptr<Material>> materials;
     std::vector<std::unique_ptr<ModelNode>> nodes;
 };
 
 
-Model* LoadModel(std::string path, node_callback_t NodeCallback=NULL, light_callback_t LightCallback=NULL);
+/* If staticBatchCellSize is more than 0, the model is merged with
+ * Model::BatchStatic() after loading. */
+Model* LoadModel(std::string path, node_callback_t NodeCallback=NULL, light_callback_t LightCallback=NULL,
+                 float staticBatchCellSize = 0.0f);
+/* Vertex format used for models loaded after this is called. Models that are
+ * already loaded keep their format. */
+void SetVertexFormat(VertexFormat format);
+VertexFormat GetVertexFormat();
+/* Whether models loaded after this is called are run through OptimizeMesh(),
+ * see mesh_optimize.h. */
+void SetOptimizeMeshes(bool optimize);
+bool GetOptimizeMeshes();
+/* Whether meshes loaded after this is called get simplified LODs. */
+void SetGenerateLODs(bool generate);
+bool GetGenerateLODs();
 
 std::vector<Texture> LoadMaterialTextures(aiMaterial *mat,
                                           aiTextureType type,
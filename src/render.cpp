@@ -3,11 +3,25 @@
 #include "render_lights.h"
 #include "render_internal.h"
 #include "render_ui.h"
+#include "render_defines.h"
+#include "render_ubo.h"
+#include "render_clusters.h"
+#include "render_queue.h"
+#include "render_shaders.h"
+#include "render_cull.h"
+#include "render_occlusion.h"
+#include "render_post.h"
+#include "render_dynres.h"
+#include "render_deferred.h"
+#include "gpu_timer.h"
 
 #include "convert.h"
 #include "camera.h"
 #include "model.h"
+#include "geometry_pool.h"
 #include "shader.h"
+#include "shader_cache.h"
+#include "gl_ext.h"
 #include "../glad/glad.h"
 #include "player.h"
 #include "glerr.h"
@@ -34,22 +48,43 @@ static unsigned int physFrameCounter = 0;
 static const glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
 static bool doRenderWorld = false;
 
-/*
- * Render the scene without any shader setup
- */
-void Render::RenderSceneRaw(ShaderProg &shader, Player *p)
+
+static void UploadLights()
 {
-    // Draw map
-    DrawMap(shader);
+    Render::LightsBlock block = {};
 
-    // Draw all cars
-    DrawCars(shader);
+    glm::vec3 sunCol = sunLight.mColour / glm::vec3(1.0);
+    block.dirLight.direction = glm::vec4(sunLight.mDirection, 0.0);
+    block.dirLight.colour = glm::vec4(sunCol, 1.0);
+    Render::UploadLightsBlock(block);
 
-    // Draw next checkpoint in race
-    if (p != nullptr) {
-        DrawCheckpoints(shader, p);
+    // Point and spot lights go through the clusters.
+    static std::vector<Render::ClusterLight> clusterLights;
+    clusterLights.clear();
+    for (size_t i = 0; i < lights.size(); i++) {
+        glm::vec3 lightCol = lights[i].mColour / glm::vec3(1.0);
+        //glm::vec3 lightCol = glm::vec3(6000.0);
+        Render::ClusterLight light;
+        light.position = glm::vec4(lights[i].mPosition,
+                                   Render::GetLightRange(lightCol));
+        light.direction = glm::vec4(0.0f);
+        light.colour = glm::vec4(lightCol, 0.0f);
+        light.info = glm::vec4(Render::CLUSTER_LIGHT_POINT, -1.0f, 0.0f, 0.0f);
+        clusterLights.push_back(light);
     }
+    Render::AppendSpotLights(clusterLights);
+    Render::UploadClusterLights(clusterLights);
+}
 
+/* Submits the map and cars to sceneQueue. These are the same for every view
+ * and for the shadow passes, so the queue is built and sorted once per
+ * frame. */
+static void QueueScene()
+{
+    sceneQueue.Clear();
+    Render::DrawMap(sceneQueue);
+    Render::DrawCars(sceneQueue);
+    sceneQueue.SortOpaque();
 }
 
 
@@ -127,8 +162,10 @@ bool Render::Init()
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(
             SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
+    // The scene is anti-aliased in its own targets (see render_post.h), and
+    // only the UI is drawn onto the window.
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 0);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 0);
 
     int flags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
     window = SDL_CreateWindow("Car", 800, 600, flags);
@@ -145,13 +182,21 @@ bool Render::Init()
         SDL_Log("Failed to initialise GLAD");
         return false;
     }
+    LoadGLExtensions();
 
     if (!SDL_GL_SetSwapInterval(1)) {
         SDL_Log("Could not turn on VSync");
     }
 
     uiProj = glm::ortho(0.0f, 800.0f, 0.0f, 600.0f);
+    InitUniformBlocks();
+    InitClusters();
+    InitShaderCache();
     LoadShaders();
+    InitGPUCulling();
+    InitOcclusion();
+    InitDynamicResolution();
+    opaqueGPUTimer.Init();
     GLERR;
 
     InitSkybox();
@@ -183,7 +228,8 @@ bool Render::Init()
 
     GLERR;
     // ----- Framebuffer -----
-    CreateFBOs();
+    // Gets the screen size and creates the screen sized render targets.
+    UpdateWindowSize();
 
     GLERR;
     InitShadows();
@@ -216,7 +262,6 @@ bool Render::Init()
 
 float Render::ScreenAspect()
 {
-    UpdateWindowSize();
     float aspect = (float) screenWidth / (float) screenHeight;
     // Divide aspect by 2.0 for split screen
     if (doSplitScreen && gNumPlayers == 2) {
@@ -251,19 +296,23 @@ void Render::Update(double delta)
 void Render::RenderFrame()
 {
     GLERR;
+    // Also picks the resolution scale of this frame.
+    BeginGPUFrameTimer();
+    opaqueGPUTimer.BeginFrame();
 
     //if (MainGame::gGameState == GAME_IN_WORLD) {
     if (doRenderWorld) {
+        QueueScene();
         ShadowPass();
+        // Light data is in world space, so it is uploaded once here and
+        // shared by every split screen view. Shadows are per view.
+        UploadLights();
     }
 
-    // Get screen width and height
-    UpdateWindowSize();
-
     GLERR;
 
-    // Set up multisampled framebuffer for rendering
-    glBindFramebuffer(GL_FRAMEBUFFER, msFBO);
+    // Set up the (multisampled if MSAA is on) framebuffer for rendering
+    glBindFramebuffer(GL_FRAMEBUFFER, GetSceneDrawTarget().mFBO);
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.7f, 0.6f, 0.2f, 1.0f);
     glClearDepth(1.0f);
@@ -281,31 +330,10 @@ void Render::RenderFrame()
 
     GLERR;
     
-    // Blit multisampled framebuffer onto the regular framebuffer
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, msFBO);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
-    glBlitFramebuffer(0, 0, screenWidth, screenHeight,
-                      0, 0, screenWidth, screenHeight,
-                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-
-    // Render the regular framebuffer to the screen on a quad
-    
-    
-    glDisable(GL_CULL_FACE);
-    
-    
-    glViewport(0, 0, screenWidth, screenHeight);
-    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDisable(GL_DEPTH_TEST);
-    
-    glUseProgram(screenShader.id);
-    glBindVertexArray(quadVAO);
-    glBindTexture(GL_TEXTURE_2D, textureColourBuffer);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Resolve, anti-alias and tonemap the scene onto the screen on a quad
+    PostProcessScene();
+    EndGPUFrameTimer();
+    opaqueGPUTimer.EndFrame();
     
     
     //RenderShadowDepthToScreen();
@@ -320,12 +348,23 @@ void Render::RenderFrame()
 
     
     SDL_GL_SwapWindow(window);
+
+    ResetUniformLookupCounter();
+    ResetQueueStats();
+    ResetOcclusionViews();
 }
 
 
 void Render::RenderScene(const Camera &cam, Player *p)
 {
-    RenderScene(cam.LookAtMatrix(up), cam.projection, true, p);
+    glm::mat4 view = cam.LookAtMatrix(up);
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    // TAA moves the projection by a different subpixel offset every frame.
+    glm::vec2 jitter = GetViewJitter() * 2.0f / glm::vec2(viewport[2], viewport[3]);
+    SetTemporalView(p != nullptr ? (int)(p - gPlayers) : 0,
+                    cam.projection * view, jitter, viewport);
+    RenderScene(view, cam.JitteredProjection(jitter), true, p);
 }
 
 
@@ -335,72 +374,75 @@ void Render::RenderScene(const glm::mat4 &view, const glm::mat4 &projection,
     GLERR;
     glEnable(GL_CULL_FACE);
 
-
-    glUseProgram(pbrShader.id);
-
     GLERR;
-    pbrShader.SetMat4fv((char*)"projection", glm::value_ptr(projection));
-    pbrShader.SetMat4fv((char*)"view", glm::value_ptr(view));
-
-    GLERR;
-
-    // Sun shadow setup
-    SetSunShadowUniforms(pbrShader);
-
-    glm::vec3 sunCol = sunLight.mColour / glm::vec3(1.0);
-    // Sunlight direction in view space
-    glm::vec3 sunDir = glm::vec3(view * glm::vec4(sunLight.mDirection, 0.0));
-    pbrShader.SetVec3((char*)"dirLight.direction", glm::value_ptr(sunDir));
-    pbrShader.SetVec3((char*)"dirLight.ambient", 0.05, 0.05, 0.05);
-    pbrShader.SetVec3((char*)"dirLight.diffuse", glm::value_ptr(sunCol));
-    pbrShader.SetVec3((char*)"dirLight.specular", glm::value_ptr(sunCol));
-
+    // Viewport of this view, for finding a fragment's cluster.
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    UploadCameraBlock(view, projection, viewport);
+    BuildClusters(view, projection);
+    // The sun cascades of this player's view
+    UploadShadowUniforms(p != nullptr ? (int)(p - gPlayers) : 0);
+    BindShadowMaps();
+    BindClusterTextures();
     GLERR;
-    // Set uniforms for point lights.
-    char uniformName[64];
-    int lightNum = 0;
-    for (size_t i = 0; i < lights.size(); i++) {
-        SDL_snprintf(uniformName, 64, "pointLights[%d].position", lightNum);
-        glm::vec3 viewPos = glm::vec3(view * glm::vec4(lights[i].mPosition, 1.0));
-        pbrShader.SetVec3(uniformName, glm::value_ptr(viewPos));
 
-        glm::vec3 lightCol = lights[i].mColour / glm::vec3(1.0);
-        //glm::vec3 lightCol = glm::vec3(6000.0);
-        SDL_snprintf(uniformName, 64, "pointLights[%d].ambient", lightNum);
-        pbrShader.SetVec3(uniformName, 0.0, 0.0, 0.0);
-        SDL_snprintf(uniformName, 64, "pointLights[%d].diffuse", lightNum);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(lightCol));
-        SDL_snprintf(uniformName, 64, "pointLights[%d].specular", lightNum);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(lightCol));
-
-        //SDL_Log("Colour = (%f, %f, %f)", lights[i].mColour.x, lights[i].mColour.y, lights[i].mColour.z);
-
-        SDL_snprintf(uniformName, 64, "pointLights[%d].quadratic", lightNum);
-        pbrShader.SetFloat(uniformName, 1.0f);
-        SDL_snprintf(uniformName, 64, "pointLights[%d].constant", lightNum);
-        pbrShader.SetFloat(uniformName, 0.0f);
-        SDL_snprintf(uniformName, 64, "pointLights[%d].linear", lightNum);
-        pbrShader.SetFloat(uniformName, 0.0f);
-        lightNum++;
+    // The next checkpoint is the only thing that differs between players.
+    sceneQueue.Clear(BUCKET_TRANSPARENT);
+    if (p != nullptr) {
+        DrawCheckpoints(sceneQueue, p);
+    }
+    glm::vec3 camPos = glm::vec3(glm::inverse(view)[3]);
+    sceneQueue.SortTransparent(camPos);
+
+    Frustum viewFrustum;
+    viewFrustum.FromMatrix(projection * view);
+    const Frustum *cullFrustum = doFrustumCulling ? &viewFrustum : nullptr;
+
+    // DrawQueue() picks the shader variant for each packet.
+    uint32_t viewFeatures = GetViewShaderFeatures();
+    LODView lodView = {projection * view, false};
+    BeginOcclusionView(sceneQueue);
+    opaqueGPUTimer.Start();
+    // The deferred renderer draws the opaque surfaces into the G-buffer and
+    // lights them afterwards.
+    bool deferred = GetRenderPath() == RENDER_PATH_DEFERRED;
+    if (deferred) {
+        BeginGBuffer();
+    }
+    if (doDepthPrePass) {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        DrawQueueDepthPrePass(sceneQueue, depthPrePassShader,
+                              depthPrePassInstancedShader, cullFrustum, &lodView);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        // The depth is already there, only the nearest surface is shaded.
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    DrawQueue(sceneQueue, BUCKET_OPAQUE,
+              deferred ? viewFeatures | SHADER_GBUFFER : viewFeatures,
+              cullFrustum, &lodView);
+    if (doDepthPrePass) {
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+    if (deferred) {
+        DeferredLightingPass(viewFeatures, projection * view);
+    }
+    opaqueGPUTimer.Stop();
+    // The opaque depth is the occluder for next frame's tests.
+    if (doFrustumCulling) {
+        QueryOcclusion(sceneQueue, projection * view, viewFrustum, camPos);
     }
-
-    GLERR;
-    
-    // Set spot light shadow uniforms
-    SetSpotShadowUniforms(pbrShader);
-    
-    // Set Spot light uniforms
-    SetSpotLightUniforms(pbrShader, view);
-    GLERR;
-    //SDL_Log("Num spot lights: %d", spotLightNum);
-
-    RenderSceneRaw(pbrShader, p);
     GLERR;
     // Draw skybox
     if (enableSkybox) {
         RenderSkybox(view, projection);
     }
     GLERR;
+    // Transparent things go after the skybox so that it shows through them.
+    DrawQueue(sceneQueue, BUCKET_TRANSPARENT, viewFeatures, cullFrustum, &lodView);
+    EndOcclusionView();
+    GLERR;
     glDisable(GL_CULL_FACE);
 }
 
@@ -417,10 +459,8 @@ void Render::UpdatePlayerCamAspectRatios()
 void Render::HandleEvent(SDL_Event *event)
 {
     if (event->type == SDL_EVENT_WINDOW_RESIZED) {
-        int width = event->window.data1;
-        int height = event->window.data2;
-        glViewport(0, 0, width, height);
-
+        // This is the only place the screen sized render targets get rebuilt.
+        UpdateWindowSize();
         UpdatePlayerCamAspectRatios();
     }
     else if (event->type == SDL_EVENT_KEY_DOWN && event->key.key == SDLK_F11) {
@@ -442,7 +482,16 @@ void Render::CleanUp()
 {
     delete cubeModel;
     delete quadModel;
-    glDeleteFramebuffers(1, &fbo);
+    DestroyAllRenderTargets();
+    DestroyUniformBlocks();
+    DestroyClusters();
+    DestroyQueueBuffers();
+    DestroyGPUCulling();
+    DestroyOcclusion();
+    DestroyDynamicResolution();
+    opaqueGPUTimer.Destroy();
+    // Every model has to be deleted before this.
+    DestroyGeometryPool();
 }
 
 void Render::SetDoRenderWorld(bool value)   { doRenderWorld = value; } 
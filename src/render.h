@@ -30,7 +30,6 @@ namespace Render {
     void RenderScene(const Camera &cam, Player *p = nullptr);
     void RenderScene(const glm::mat4 &view, const glm::mat4 &projection,
                      bool enableSkybox = true, Player *p = nullptr);
-    void RenderSceneRaw(ShaderProg &shader, Player *p = nullptr);
 
     void HandleEvent(SDL_Event *event);
     void DeleteAllLights();
@@ -0,0 +1,301 @@
+#include "render_clusters.h"
+#include "render_defines.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <float.h>
+
+static constexpr int cNumClusters = CLUSTER_TILES_X * CLUSTER_TILES_Y
+                                  * CLUSTER_SLICES_Z;
+
+// Lights dimmer than this are treated as having no effect. Lower values give
+// lights a larger range, which means more lights per cluster.
+static float lightCutoff = 0.05f;
+
+struct ClusterBuffer {
+    unsigned int mBuffer = 0;
+    unsigned int mTexture = 0;
+};
+
+static ClusterBuffer lightDataBuffer;
+static ClusterBuffer clusterTableBuffer;
+static ClusterBuffer lightIndexBuffer;
+
+// Lights for this frame in world space.
+static std::vector<Render::ClusterLight> frameLights;
+
+// View space bounds of each cluster. Only depends on the projection, so they
+// are only rebuilt when it changes.
+struct ClusterBounds {
+    glm::vec3 mMin;
+    glm::vec3 mMax;
+};
+static ClusterBounds clusterBounds[cNumClusters];
+static glm::mat4 clusterBoundsProjection = glm::mat4(0.0f);
+
+// Scratch buffers reused every view
+static std::vector<uint32_t> clusterCounts;
+static std::vector<glm::uvec2> clusterTable;
+static std::vector<uint32_t> lightIndices;
+// Pairs of (cluster, light) found while assigning lights
+static std::vector<glm::uvec2> assignments;
+
+static int lastNumLights = 0;
+static int lastNumIndices = 0;
+static int lastMaxLightsInCluster = 0;
+static bool loggedIndexOverflow = false;
+
+
+static void CreateClusterBuffer(ClusterBuffer *buffer, unsigned int format)
+{
+    glGenBuffers(1, &buffer->mBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer->mBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glGenTextures(1, &buffer->mTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, buffer->mTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer->mBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GLERR;
+}
+
+
+static void DestroyClusterBuffer(ClusterBuffer *buffer)
+{
+    glDeleteTextures(1, &buffer->mTexture);
+    glDeleteBuffers(1, &buffer->mBuffer);
+    buffer->mTexture = buffer->mBuffer = 0;
+}
+
+
+static void UploadClusterBuffer(const ClusterBuffer &buffer, const void *data,
+                                size_t size)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer.mBuffer);
+    // Orphan the old storage so that views later in the frame don't have to
+    // wait for earlier views to finish with it.
+    glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    if (size > 0) {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+
+static float SliceDepth(int slice, float near, float far)
+{
+    if (slice <= 0) return near;
+    // Slice 0 also covers everything in front of CLUSTER_NEAR.
+    float clusterNear = SDL_max(near, CLUSTER_NEAR);
+    return clusterNear * SDL_powf(far / clusterNear, (float)slice / CLUSTER_SLICES_Z);
+}
+
+
+static void BuildClusterBounds(const glm::mat4 &projection)
+{
+    float near, far;
+    Render::GetProjectionNearFar(projection, &near, &far);
+    // Converts NDC to view space x and y at a depth of 1.
+    float invX = 1.0f / projection[0][0];
+    float invY = 1.0f / projection[1][1];
+
+    for (int z = 0; z < CLUSTER_SLICES_Z; z++) {
+        float zNear = SliceDepth(z, near, far);
+        float zFar = SliceDepth(z + 1, near, far);
+        for (int y = 0; y < CLUSTER_TILES_Y; y++) {
+            float ndcY0 = -1.0f + 2.0f * y / CLUSTER_TILES_Y;
+            float ndcY1 = -1.0f + 2.0f * (y + 1) / CLUSTER_TILES_Y;
+            for (int x = 0; x < CLUSTER_TILES_X; x++) {
+                float ndcX0 = -1.0f + 2.0f * x / CLUSTER_TILES_X;
+                float ndcX1 = -1.0f + 2.0f * (x + 1) / CLUSTER_TILES_X;
+
+                // The tile is widest at the far end of the slice, but it
+                // could be on either side of the centre, so take both ends.
+                ClusterBounds &b = clusterBounds[x + y * CLUSTER_TILES_X
+                        + z * CLUSTER_TILES_X * CLUSTER_TILES_Y];
+                b.mMin = glm::vec3(FLT_MAX);
+                b.mMax = glm::vec3(-FLT_MAX);
+                for (float depth : {zNear, zFar}) {
+                    for (float ndcX : {ndcX0, ndcX1}) {
+                        for (float ndcY : {ndcY0, ndcY1}) {
+                            glm::vec3 p = glm::vec3(ndcX * invX * depth,
+                                                    ndcY * invY * depth,
+                                                    -depth);
+                            b.mMin = glm::min(b.mMin, p);
+                            b.mMax = glm::max(b.mMax, p);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    clusterBoundsProjection = projection;
+}
+
+
+static bool SphereIntersectsBounds(glm::vec3 centre, float radius,
+                                   const ClusterBounds &b)
+{
+    glm::vec3 closest = glm::clamp(centre, b.mMin, b.mMax);
+    glm::vec3 d = closest - centre;
+    return glm::dot(d, d) <= radius * radius;
+}
+
+
+void Render::GetProjectionNearFar(const glm::mat4 &projection,
+                                  float *outNear, float *outFar)
+{
+    // Only valid for perspective projections made by glm::perspective.
+    *outNear = projection[3][2] / (projection[2][2] - 1.0f);
+    *outFar = projection[3][2] / (projection[2][2] + 1.0f);
+}
+
+
+void Render::InitClusters()
+{
+    CreateClusterBuffer(&lightDataBuffer, GL_RGBA32F);
+    CreateClusterBuffer(&clusterTableBuffer, GL_RG32UI);
+    CreateClusterBuffer(&lightIndexBuffer, GL_R32UI);
+    clusterCounts.resize(cNumClusters);
+    clusterTable.resize(cNumClusters);
+}
+
+
+void Render::DestroyClusters()
+{
+    DestroyClusterBuffer(&lightDataBuffer);
+    DestroyClusterBuffer(&clusterTableBuffer);
+    DestroyClusterBuffer(&lightIndexBuffer);
+}
+
+
+float Render::GetLightRange(glm::vec3 colour)
+{
+    // Intensity falls off with 1 / d^2, so solve colour / d^2 = cutoff.
+    float maxComponent = SDL_max(colour.r, SDL_max(colour.g, colour.b));
+    return SDL_sqrtf(maxComponent / lightCutoff);
+}
+
+
+void Render::UploadClusterLights(const std::vector<ClusterLight> &lights)
+{
+    frameLights = lights;
+    UploadClusterBuffer(lightDataBuffer, frameLights.data(),
+                        frameLights.size() * sizeof(ClusterLight));
+    lastNumLights = frameLights.size();
+    GLERR;
+}
+
+
+int Render::GetNumClusterLights()
+{
+    return lastNumLights;
+}
+
+
+void Render::BuildClusters(const glm::mat4 &view, const glm::mat4 &projection)
+{
+    if (projection != clusterBoundsProjection) {
+        BuildClusterBounds(projection);
+    }
+
+    float near, far;
+    GetProjectionNearFar(projection, &near, &far);
+
+    // Find every (cluster, light) pair. Only the slices within the light's
+    // depth range are tested.
+    assignments.clear();
+    for (size_t i = 0; i < frameLights.size(); i++) {
+        glm::vec3 centre = glm::vec3(view * glm::vec4(glm::vec3(frameLights[i].position), 1.0f));
+        float radius = frameLights[i].position.w;
+        float depthMin = -centre.z - radius;
+        float depthMax = -centre.z + radius;
+        if (depthMax < near || depthMin > far) continue;
+
+        int sliceMin = 0;
+        int sliceMax = CLUSTER_SLICES_Z - 1;
+        while (sliceMin < sliceMax && SliceDepth(sliceMin + 1, near, far) < depthMin) {
+            sliceMin++;
+        }
+        while (sliceMax > sliceMin && SliceDepth(sliceMax, near, far) > depthMax) {
+            sliceMax--;
+        }
+
+        for (int z = sliceMin; z <= sliceMax; z++) {
+            for (int xy = 0; xy < CLUSTER_TILES_X * CLUSTER_TILES_Y; xy++) {
+                int cluster = xy + z * CLUSTER_TILES_X * CLUSTER_TILES_Y;
+                if (SphereIntersectsBounds(centre, radius, clusterBounds[cluster])) {
+                    assignments.push_back(glm::uvec2(cluster, i));
+                }
+            }
+        }
+    }
+
+    // The index list is limited by the minimum buffer texture size.
+    if (assignments.size() > CLUSTER_MAX_INDICES) {
+        if (!loggedIndexOverflow) {
+            SDL_Log("Warning: Too many lights in clusters (%zu), some lights will be missing.",
+                    assignments.size());
+            loggedIndexOverflow = true;
+        }
+        assignments.resize(CLUSTER_MAX_INDICES);
+    }
+
+    // Counting sort the pairs by cluster to get one index list per cluster.
+    std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+    for (const glm::uvec2 &a : assignments) {
+        clusterCounts[a.x]++;
+    }
+    uint32_t offset = 0;
+    int maxLightsInCluster = 0;
+    for (int i = 0; i < cNumClusters; i++) {
+        clusterTable[i] = glm::uvec2(offset, 0);
+        offset += clusterCounts[i];
+        maxLightsInCluster = SDL_max(maxLightsInCluster, (int)clusterCounts[i]);
+    }
+    lightIndices.resize(assignments.size());
+    for (const glm::uvec2 &a : assignments) {
+        glm::uvec2 &entry = clusterTable[a.x];
+        lightIndices[entry.x + entry.y] = a.y;
+        entry.y++;
+    }
+
+    UploadClusterBuffer(clusterTableBuffer, clusterTable.data(),
+                        clusterTable.size() * sizeof(glm::uvec2));
+    UploadClusterBuffer(lightIndexBuffer, lightIndices.data(),
+                        lightIndices.size() * sizeof(uint32_t));
+    lastNumIndices = lightIndices.size();
+    lastMaxLightsInCluster = maxLightsInCluster;
+    GLERR;
+}
+
+
+void Render::BindClusterTextures()
+{
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHT_DATA_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, lightDataBuffer.mTexture);
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_TABLE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, clusterTableBuffer.mTexture);
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_INDEX_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, lightIndexBuffer.mTexture);
+    glActiveTexture(GL_TEXTURE0);
+    GLERR;
+}
+
+
+void Render::ClustersDebugGUI()
+{
+    ImGui::SliderFloat("Light cutoff", &lightCutoff, 0.001f, 1.0f, "%.3f",
+                       ImGuiSliderFlags_Logarithmic);
+    ImGui::Text("Lights: %d, cluster light indices: %d, most in a cluster: %d",
+                lastNumLights, lastNumIndices, lastMaxLightsInCluster);
+}
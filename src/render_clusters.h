@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+/*
+ * Clustered forward lighting. Each view is split into a grid of froxels
+ * (CLUSTER_TILES_X * CLUSTER_TILES_Y screen tiles, each split into
+ * CLUSTER_SLICES_Z exponential depth slices). Every frame the point and spot
+ * lights are assigned to the clusters their range touches on the CPU, and the
+ * fragment shader only evaluates the lights in its own cluster.
+ *
+ * Everything is stored in buffer textures:
+ *  - lightData:    4 RGBA32F texels per light (see ClusterLight)
+ *  - clusterTable: one RG32UI texel per cluster, the offset and count of its
+ *                  lights in lightIndices
+ *  - lightIndices: one R32UI texel per light in a cluster
+ */
+
+namespace Render {
+    enum ClusterLightType {
+        CLUSTER_LIGHT_POINT = 0,
+        CLUSTER_LIGHT_SPOT = 1
+    };
+
+    /* Layout of one light in the lightData buffer texture. */
+    struct ClusterLight
+    {
+        // xyz: world position, w: range
+        glm::vec4 position;
+        // xyz: direction, w: cosine of the inner cutoff
+        glm::vec4 direction;
+        // rgb: colour, w: cosine of the outer cutoff
+        glm::vec4 colour;
+        // x: ClusterLightType, y: shadow map index or -1
+        glm::vec4 info;
+    };
+
+    /* Gets the near and far planes of a perspective projection matrix. */
+    void GetProjectionNearFar(const glm::mat4 &projection,
+                              float *outNear, float *outFar);
+    void InitClusters();
+    void DestroyClusters();
+    /* Distance at which a light of this colour is dimmer than the cutoff set
+     * in the debug GUI. Lights are faded out to zero at this distance. */
+    float GetLightRange(glm::vec3 colour);
+    /* Uploads the lights for this frame. Call once per frame. */
+    void UploadClusterLights(const std::vector<ClusterLight> &lights);
+    /* Number of lights in the last UploadClusterLights() call. */
+    int GetNumClusterLights();
+    /* Assigns the lights from the last UploadClusterLights() call to the
+     * clusters of the view and uploads the result. Call once per view. */
+    void BuildClusters(const glm::mat4 &view, const glm::mat4 &projection);
+    /* Binds the cluster buffer textures to the units used by the PBR shader. */
+    void BindClusterTextures();
+    void ClustersDebugGUI();
+}
@@ -0,0 +1,157 @@
+#include "render_cull.h"
+#include "render_queue.h"
+#include "bounds.h"
+#include "shader.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+static_assert(sizeof(Render::CullDraw) == 48 + 8 * MAX_MESH_LODS, "CullDraw must match std430");
+
+// Must match local_size_x in c_cull.glsl
+static constexpr uint32_t cCullGroupSize = 64;
+
+static ShaderProg cullShader;
+static unsigned int cullDrawBuffer = 0;
+static unsigned int commandBuffer = 0;
+static unsigned int occludedNodeBuffer = 0;
+static size_t commandBufferSize = 0;
+static bool gpuCulling = true;
+
+static constexpr UniformName cPlaneUniforms[6] = {
+    "planes[0]"_u, "planes[1]"_u, "planes[2]"_u,
+    "planes[3]"_u, "planes[4]"_u, "planes[5]"_u
+};
+
+
+static bool IsGPUCullingSupported()
+{
+    return GLEXT_ARB_compute_shader && GLEXT_ARB_multi_draw_indirect;
+}
+
+
+void Render::InitGPUCulling()
+{
+    if (!IsGPUCullingSupported()) {
+        SDL_Log("GPU culling not supported, culling on the CPU");
+        return;
+    }
+    char defines[64];
+    SDL_snprintf(defines, sizeof(defines), "#define MAX_MESH_LODS %d\n",
+                 MAX_MESH_LODS);
+    cullShader = CreateComputeProgramFromFile("shaders/c_cull.glsl", defines);
+    glGenBuffers(1, &cullDrawBuffer);
+    glGenBuffers(1, &commandBuffer);
+    glGenBuffers(1, &occludedNodeBuffer);
+    // Always has storage, so binding 2 is valid when occlusion is off.
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, occludedNodeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    GLERR;
+}
+
+
+void Render::DestroyGPUCulling()
+{
+    if (cullShader.id != 0) {
+        glDeleteProgram(cullShader.id);
+        cullShader = ShaderProg();
+    }
+    glDeleteBuffers(1, &cullDrawBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &occludedNodeBuffer);
+    cullDrawBuffer = commandBuffer = occludedNodeBuffer = 0;
+    commandBufferSize = 0;
+}
+
+
+bool Render::UseGPUCulling()
+{
+    return gpuCulling && cullShader.id != 0;
+}
+
+
+void Render::UploadCullDraws(const std::vector<CullDraw> &draws)
+{
+    if (draws.empty()) return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullDrawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(CullDraw),
+                 draws.data(), GL_STREAM_DRAW);
+    // The command buffer is only written by the GPU. It only has to be
+    // reallocated when it grows.
+    size_t commandsSize = draws.size() * sizeof(DrawElementsIndirectCommand);
+    if (commandsSize > commandBufferSize) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, commandsSize, nullptr,
+                     GL_DYNAMIC_COPY);
+        commandBufferSize = commandsSize;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    GLERR;
+}
+
+
+void Render::CullDraws(const Frustum *frustum, const CullLOD *lod,
+                       const std::vector<uint32_t> *occludedNodes, int casters,
+                       uint32_t first, uint32_t count)
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (count == 0) return;
+
+    glUseProgram(cullShader.id);
+    if (frustum != nullptr) {
+        for (int i = 0; i < 6; i++) {
+            cullShader.SetVec4(cPlaneUniforms[i], glm::value_ptr(frustum->mPlanes[i]));
+        }
+    }
+    cullShader.SetInt("cullEnabled"_u, frustum != nullptr);
+    if (lod != nullptr) {
+        cullShader.SetMat4fv("lodViewProj"_u, glm::value_ptr(lod->mViewProj));
+        cullShader.SetVec4("lodThresholds"_u, glm::value_ptr(lod->mThresholds));
+        cullShader.SetInt("lodBias"_u, lod->mBias);
+    }
+    cullShader.SetInt("lodEnabled"_u, lod != nullptr);
+    bool occlusion = occludedNodes != nullptr && !occludedNodes->empty();
+    if (occlusion) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, occludedNodeBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, occludedNodes->size() * sizeof(uint32_t),
+                     occludedNodes->data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    cullShader.SetInt("occlusionEnabled"_u, occlusion);
+    cullShader.SetInt("casters"_u, casters);
+    cullShader.SetInt("firstDraw"_u, first);
+    cullShader.SetInt("numDraws"_u, count);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cullDrawBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, occludedNodeBuffer);
+    glDispatchCompute((count + cCullGroupSize - 1) / cCullGroupSize, 1, 1);
+    // The draws read the commands through the indirect buffer binding.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    GLERR;
+}
+
+
+void Render::CullingDebugGUI()
+{
+    if (!IsGPUCullingSupported()) {
+        ImGui::Text("GPU culling: not supported");
+        return;
+    }
+    ImGui::Checkbox("GPU culling", &gpuCulling);
+    if (UseGPUCulling()) {
+        // The results stay on the GPU, so the culled counts below are 0.
+        int numDraws = 0;
+        for (int i = 0; i < NUM_QUEUE_PASSES; i++) {
+            numDraws += GetQueueStats((QueuePass)i).mGPUCullDraws;
+        }
+        ImGui::Text("    %d draws submitted to the cull shader last frame",
+                    numDraws);
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "gl_ext.h"
+#include "render_defines.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <stdint.h>
+
+// Forward declarations
+struct Frustum;
+
+/*
+ * GPU frustum culling. The opaque draws of the scene queue are uploaded once
+ * per frame with a bounding sphere and an indirect draw command each. Every
+ * pass then runs a compute shader that tests the spheres against the pass's
+ * frustum (the view, the sun's ortho box or a spot light's cone) and writes
+ * the commands to an indirect buffer, with the instance count of culled draws
+ * set to 0. The CPU only dispatches and issues the multi draws, it doesn't
+ * test anything.
+ *
+ * The shader also picks each draw's LOD from its size on screen, the same way
+ * as render_queue.cpp but without the hysteresis, as there is no history of
+ * the last frame's choice on the GPU.
+ *
+ * Draws in nodes that were hidden from the view by occlusion queries (see
+ * render_occlusion.h) are culled as well. The occluded nodes are uploaded by
+ * every view pass.
+ *
+ * Needs compute shaders and multi draw indirect (GL 4.3). Otherwise, or when
+ * it's turned off in the debug GUI, render_queue.cpp culls on the CPU.
+ */
+
+namespace Render {
+    /* Input of the cull shader for one draw. Matches CullDraw in
+     * c_cull.glsl with std430 layout. */
+    struct CullDraw
+    {
+        // xyz: world space centre, w: radius
+        glm::vec4 mSphere;
+        DrawElementsIndirectCommand mCommand;
+        uint32_t mNumLODs;
+        // Index of the packet's node in RenderQueue::mNodeBounds
+        uint32_t mNode;
+        // 1 for DrawPacket::mStatic
+        uint32_t mStatic;
+        // x: first index, y: number of indices of each LOD
+        glm::uvec2 mLODs[MAX_MESH_LODS];
+    };
+
+    /* How the cull shader picks LODs, see SelectLOD() in render_queue.cpp. */
+    struct CullLOD
+    {
+        glm::mat4 mViewProj;
+        // Screen height fractions below which each LOD is used
+        glm::vec4 mThresholds;
+        // Levels added to the chosen one, e.g. for shadow passes
+        int mBias;
+    };
+
+    void InitGPUCulling();
+    void DestroyGPUCulling();
+    /* True if the context supports GPU culling and it is enabled. */
+    bool UseGPUCulling();
+    /* Uploads the draws for this frame. */
+    void UploadCullDraws(const std::vector<CullDraw> &draws);
+    /* Culls count draws starting at first against frustum, or keeps all of
+     * them if frustum is null. The LOD is chosen with lod, or LOD 0 is drawn
+     * if it is null. Draws in nodes with a non-zero entry in occludedNodes
+     * are culled, if it is not null. casters is a ShadowCasters value from
+     * render_queue.h, the draws it leaves out are culled. The commands are
+     * written to the same positions in the indirect buffer, which is left
+     * bound to GL_DRAW_INDIRECT_BUFFER. */
+    void CullDraws(const Frustum *frustum, const CullLOD *lod,
+                   const std::vector<uint32_t> *occludedNodes, int casters,
+                   uint32_t first, uint32_t count);
+    void CullingDebugGUI();
+}
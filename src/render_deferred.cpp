@@ -0,0 +1,122 @@
+#include "render_deferred.h"
+#include "render_internal.h"
+#include "render_shaders.h"
+#include "render_post.h"
+
+#include "shader.h"
+#include "glerr.h"
+#include "../glad/glad.h"
+
+#include "../vendor/imgui/imgui.h"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <SDL3/SDL.h>
+
+static Render::RenderPath renderPath = Render::RENDER_PATH_FORWARD;
+
+static const char *renderPathNames[Render::NUM_RENDER_PATHS] = {
+    "forward", "deferred"
+};
+
+
+Render::RenderPath Render::GetRenderPath()  { return renderPath; }
+
+
+void Render::SetRenderPath(RenderPath path)
+{
+    if (path == renderPath) return;
+    renderPath = path;
+    SDL_Log("Using the %s renderer", GetRenderPathName(path));
+    // Before Init() there are no targets yet, and they are created for the
+    // new path anyway.
+    if (sceneTarget.mFBO != 0) {
+        RebuildScreenTargets();
+    }
+}
+
+
+const char* Render::GetRenderPathName(RenderPath path)
+{
+    SDL_assert(path >= 0 && path < NUM_RENDER_PATHS);
+    return renderPathNames[path];
+}
+
+
+void Render::BeginGBuffer()
+{
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, gBufferTarget.mFBO);
+    // Only the depth needs clearing. The lighting pass skips pixels at the
+    // far plane without reading their colours.
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearDepth(1.0f);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+    GLERR;
+}
+
+
+void Render::DeferredLightingPass(uint32_t viewFeatures, const glm::mat4 &viewProj)
+{
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const RenderTarget &scene = GetSceneDrawTarget();
+
+    // The skybox, the transparent bucket and the occlusion queries need the
+    // opaque depth.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gBufferTarget.mFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene.mFBO);
+    int x1 = viewport[0] + viewport[2];
+    int y1 = viewport[1] + viewport[3];
+    glBlitFramebuffer(viewport[0], viewport[1], x1, y1,
+                      viewport[0], viewport[1], x1, y1,
+                      GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene.mFBO);
+    GLERR;
+
+    const ShaderProg &shader = GetDeferredLightingShader(viewFeatures);
+    glUseProgram(shader.id);
+    glm::mat4 invViewProj = glm::inverse(viewProj);
+    shader.SetMat4fv("invViewProj"_u, glm::value_ptr(invViewProj));
+
+    const unsigned int textures[] = {
+        gBufferTarget.mColourTex, gBufferTarget.mExtraColourTex[0],
+        gBufferTarget.mExtraColourTex[1], gBufferTarget.mDepthTex
+    };
+    for (int i = 0; i < 4; i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    glBindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glEnable(GL_BLEND);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+    GLERR;
+}
+
+
+void Render::DeferredDebugGUI()
+{
+    int path = renderPath;
+    const char *names[NUM_RENDER_PATHS] = {"Forward", "Deferred"};
+    if (ImGui::Combo("Renderer", &path, names, NUM_RENDER_PATHS)) {
+        SetRenderPath((RenderPath)path);
+    }
+    if (renderPath == RENDER_PATH_DEFERRED) {
+        AAMode aa = GetAAMode();
+        bool msaa = aa == AA_MSAA_2 || aa == AA_MSAA_4 || aa == AA_MSAA_8;
+        ImGui::Text("    G-buffer: %.1f MB%s",
+                    gBufferTarget.GetGPUMemory() / (1024.0 * 1024.0),
+                    msaa ? ", MSAA is off with this renderer" : "");
+    }
+}
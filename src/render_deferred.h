@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+/*
+ * Deferred shading, as an alternative to the forward renderer for maps with
+ * many local lights. The render path is picked at startup with
+ * --renderer=forward or --renderer=deferred, and can be changed in the debug
+ * GUI.
+ *
+ * The opaque bucket of each view is drawn into gBufferTarget with the GBUFFER
+ * variant of the PBR shader:
+ *  - colour 0, GL_RGBA8:  albedo
+ *  - colour 1, GL_RG16:   octahedral encoded normal
+ *  - colour 2, GL_RG8:    roughness, metallic
+ *  - depth, GL_DEPTH24_STENCIL8 texture
+ * Then f_deferred.glsl lights every pixel of the view in one fullscreen pass.
+ * It finds the lights of each pixel in the light clusters, like the forward
+ * shader does, and uses the same BRDF and shadow atlases (lighting.glsl).
+ * Every pixel is only lit once however much overdraw the opaque bucket has.
+ *
+ * The depth of the G-buffer is copied into the scene target afterwards, so
+ * that the skybox and the transparent bucket are drawn forward as before.
+ *
+ * The G-buffer isn't multisampled, so the MSAA modes draw without
+ * anti-aliasing. FXAA and TAA work with either path.
+ */
+namespace Render {
+    enum RenderPath {
+        RENDER_PATH_FORWARD = 0,
+        RENDER_PATH_DEFERRED,
+        NUM_RENDER_PATHS
+    };
+
+    RenderPath GetRenderPath();
+    /* Rebuilds the screen targets if the path changed. Can be called before
+     * Init() to pick the path at startup. */
+    void SetRenderPath(RenderPath path);
+    /* "forward" or "deferred", as used on the command line. */
+    const char* GetRenderPathName(RenderPath path);
+    /* Binds gBufferTarget and clears the depth of the current viewport. Draw
+     * the opaque bucket with SHADER_GBUFFER added to the view's features
+     * afterwards. */
+    void BeginGBuffer();
+    /* Lights the current viewport of the G-buffer into the scene draw target
+     * with the lighting features of the view, and copies its depth there.
+     * viewProj is the matrix the G-buffer was drawn with. Leaves the scene
+     * draw target bound. */
+    void DeferredLightingPass(uint32_t viewFeatures, const glm::mat4 &viewProj);
+    void DeferredDebugGUI();
+}
@@ -1,5 +1,35 @@
 #pragma once
 
-// These must align with defines in shader
+// Passed to the PBR shader as a #define, see render_shaders.cpp.
 #define MAX_SPOT_SHADOWS 8
-#define MAX_SPOT_LIGHTS 32
+// Sun shadow cascades of each view. Also passed to the PBR shader.
+#define SUN_CASCADES 4
+
+// Clustered lighting grid. See render_clusters.h.
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES_Z 24
+// Depth of the far end of the first slice
+#define CLUSTER_NEAR 1.0f
+// Most light indices in all clusters of a view. This is the minimum size of a
+// buffer texture that GL guarantees.
+#define CLUSTER_MAX_INDICES 65536
+// Texture units of the cluster buffer textures
+#define CLUSTER_LIGHT_DATA_UNIT 10
+#define CLUSTER_TABLE_UNIT 11
+#define CLUSTER_INDEX_UNIT 12
+
+// Uniform block binding points. The blocks are bound to these by name after
+// linking, see BindUniformBlocks().
+#define UBO_BINDING_CAMERA 0
+#define UBO_BINDING_LIGHTS 1
+#define UBO_BINDING_SHADOWS 2
+
+// Vertex attribute locations of the per instance data used by instanced
+// draws. The model matrix takes four locations.
+#define INSTANCE_ATTRIB_MODEL 5
+#define INSTANCE_ATTRIB_PAINT 9
+
+// Most levels of detail a mesh can have, including the full detail one. Also
+// passed to c_cull.glsl.
+#define MAX_MESH_LODS 4
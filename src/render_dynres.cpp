@@ -0,0 +1,89 @@
+#include "render_dynres.h"
+#include "render_internal.h"
+#include "gpu_timer.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+#include <math.h>
+
+// No change while the time is this close to the target, to avoid wobbling.
+static constexpr float cTargetTolerance = 0.05f;
+// Fraction of the way to the ideal scale to move each frame
+static constexpr float cScaleDownRate = 0.5f;
+static constexpr float cScaleUpRate = 0.1f;
+
+static GPUTimer frameTimer;
+
+static bool dynamicResolution = true;
+static float targetGPUTime = 14.0f;
+static float minResolutionScale = 0.5f;
+static float maxResolutionScale = 1.0f;
+static float resolutionScale = 1.0f;
+
+
+void Render::InitDynamicResolution()
+{
+    frameTimer.Init();
+}
+
+
+void Render::DestroyDynamicResolution()
+{
+    frameTimer.Destroy();
+}
+
+
+static void UpdateResolutionScale(float gpuTime)
+{
+    if (!dynamicResolution) return;
+    if (gpuTime > 0.0f
+            && fabsf(gpuTime - targetGPUTime) > targetGPUTime * cTargetTolerance) {
+        // The time goes with the area, which is the square of the scale.
+        float ideal = resolutionScale * sqrtf(targetGPUTime / gpuTime);
+        float rate = gpuTime > targetGPUTime ? cScaleDownRate : cScaleUpRate;
+        resolutionScale += (ideal - resolutionScale) * rate;
+    }
+    resolutionScale = SDL_clamp(resolutionScale, minResolutionScale,
+                                maxResolutionScale);
+}
+
+
+void Render::BeginGPUFrameTimer()
+{
+    if (frameTimer.BeginFrame()) {
+        UpdateResolutionScale(frameTimer.GetMilliseconds());
+    }
+    if (!dynamicResolution) {
+        resolutionScale = 1.0f;
+    }
+    frameTimer.Start();
+}
+
+
+void Render::EndGPUFrameTimer()
+{
+    frameTimer.Stop();
+    frameTimer.EndFrame();
+}
+
+
+float Render::GetResolutionScale()          { return resolutionScale; }
+
+
+void Render::DynamicResolutionDebugGUI()
+{
+    ImGui::Checkbox("Dynamic resolution", &dynamicResolution);
+    ImGui::Text("    Scene GPU time: %.2f ms, scale %.2f (%dx%d)",
+                frameTimer.GetMilliseconds(),
+                resolutionScale, (int)(screenWidth * resolutionScale),
+                (int)(screenHeight * resolutionScale));
+    if (!dynamicResolution) return;
+    ImGui::SliderFloat("Target GPU time (ms)", &targetGPUTime, 2.0f, 33.0f);
+    ImGui::SliderFloat("Min resolution scale", &minResolutionScale, 0.25f, 1.0f);
+    ImGui::SliderFloat("Max resolution scale", &maxResolutionScale, 0.25f, 1.0f);
+    minResolutionScale = SDL_min(minResolutionScale, maxResolutionScale);
+}
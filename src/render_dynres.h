@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+ * Dynamic resolution. The GPU time of the scene (the shadows, every view and
+ * the post processing, but not the UI) is measured with a GPUTimer, and
+ * the views are drawn into a smaller part of the screen sized targets when
+ * it goes over the target time. The post processing scales the result back
+ * up to the screen, see render_post.h.
+ *
+ * The results are read a few frames late so that the CPU never waits for
+ * them. The scale moves towards the one that would hit the target, assuming
+ * the time goes with the number of pixels, and drops faster than it rises so
+ * that a sudden spike is dealt with quickly.
+ */
+
+namespace Render {
+    void InitDynamicResolution();
+    void DestroyDynamicResolution();
+    /* Updates the scale from the finished timings and starts timing this
+     * frame. Call before the shadow pass. */
+    void BeginGPUFrameTimer();
+    /* Call after the post processing, before the UI. */
+    void EndGPUFrameTimer();
+    /* Fraction of the screen width and height that the views are drawn at
+     * this frame. */
+    float GetResolutionScale();
+    void DynamicResolutionDebugGUI();
+}
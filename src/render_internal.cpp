@@ -1,15 +1,28 @@
 #include "render_internal.h"
 #include "render.h"
 #include "render_shadow.h"
+#include "render_clusters.h"
+#include "render_queue.h"
+#include "render_shaders.h"
+#include "render_cull.h"
+#include "render_occlusion.h"
+#include "render_post.h"
+#include "render_dynres.h"
+#include "render_deferred.h"
+#include "render_ubo.h"
+#include "gpu_timer.h"
+#include "render_defines.h"
 
 #include "../glad/glad.h"
 #include "glerr.h"
 #include "convert.h"
 #include "model.h"
+#include "geometry_pool.h"
 #include "world.h"
 #include "vehicle.h"
 #include "player.h"
 #include "shader.h"
+#include "shader_cache.h"
 #include "ui.h"
 
 #include "../vendor/imgui/imgui.h"
@@ -21,17 +34,22 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#include <vector>
+#include <memory>
+
 unsigned int textVAO, textVBO;
 unsigned int quadVAO;
 unsigned int quadVBO;
 unsigned int uiQuadVAO;
 unsigned int uiQuadVBO;
-unsigned int fbo;
-unsigned int rbo;
-unsigned int textureColourBuffer;
-unsigned int msFBO;
-unsigned int msRBO;
-unsigned int msTexColourBuffer;
+RenderTarget sceneMSTarget;
+RenderTarget sceneTarget;
+RenderTarget taaHistoryTargets[2];
+RenderTarget gBufferTarget;
+RenderTarget sunShadowTarget;
+RenderTarget spotShadowTarget;
+RenderTarget sunShadowCacheTarget;
+RenderTarget spotShadowCacheTarget;
 int screenWidth;
 int screenHeight;
 Model *cubeModel;
@@ -42,11 +60,18 @@ Texture tachoNeedleTex;
 glm::mat4 uiProj;
 
 ShaderProg simpleDepthShader;
-ShaderProg pbrShader;
+ShaderProg simpleDepthInstancedShader;
+ShaderProg depthPrePassShader;
+ShaderProg depthPrePassInstancedShader;
 ShaderProg screenShader;
 ShaderProg uiShader;
 ShaderProg textShader;
 
+Render::RenderQueue sceneQueue;
+bool doFrustumCulling = true;
+bool doDepthPrePass = false;
+GPUTimer opaqueGPUTimer;
+
 bool doSplitScreen = true;
 SDL_Window *window;
 
@@ -59,6 +84,16 @@ static Texture grassTex;
 static unsigned int skyboxVAO;
 static unsigned int skyboxVBO;
 
+// Targets that live for the whole program. Listed here so that their memory
+// use can be reported.
+static RenderTarget *persistentTargets[] = {
+    &sceneMSTarget, &sceneTarget, &sunShadowTarget, &spotShadowTarget,
+    &sunShadowCacheTarget, &spotShadowCacheTarget,
+    &taaHistoryTargets[0], &taaHistoryTargets[1], &gBufferTarget
+};
+// Pool of targets that are only needed for part of a frame.
+static std::vector<std::unique_ptr<RenderTarget>> transientTargets;
+
 
 static float skyboxVertices[] = {
     // positions          
@@ -125,93 +160,329 @@ static float uiQuadVertices[] = {
     0.0f, 1.0f,   0.0f, 1.0f     // Top left
 };
 
-void Render::CreateFramebuffer(unsigned int *aFBO, unsigned int *aCbTex, unsigned int *aRBO, 
-                              unsigned int aWidth, unsigned int aHeight)
+static size_t BytesPerTexel(unsigned int format)
+{
+    switch (format) {
+        case GL_RGBA32F:            return 16;
+        case GL_RGB32F:             return 12;
+        case GL_RGBA16F:            return 8;
+        case GL_RGB16F:             return 6;
+        case GL_R11F_G11F_B10F:     return 4;
+        case GL_RGBA8:              return 4;
+        case GL_SRGB8_ALPHA8:       return 4;
+        case GL_RG16F:              return 4;
+        case GL_RG16:               return 4;
+        case GL_RG8:                return 2;
+        case GL_DEPTH24_STENCIL8:   return 4;
+        case GL_DEPTH_COMPONENT32F: return 4;
+        // 24 bit depth is padded to 32 bits by most drivers
+        case GL_DEPTH_COMPONENT24:  return 4;
+        case GL_DEPTH_COMPONENT16:  return 2;
+        case 0:                     return 0;
+        default:
+            SDL_Log("BytesPerTexel: Unknown format 0x%04x", format);
+            return 4;
+    }
+}
+
+
+size_t RenderTarget::GetGPUMemory() const
 {
-    glGenFramebuffers(1, aFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, *aFBO);
+    size_t numSamples = mSamples > 0 ? mSamples : 1;
+    size_t texels = (size_t) mWidth * (size_t) mHeight * numSamples;
+    size_t bytes = BytesPerTexel(mColourFormat) + BytesPerTexel(mDepthFormat);
+    for (unsigned int format : mExtraColourFormats) {
+        bytes += BytesPerTexel(format);
+    }
+    return texels * bytes;
+}
 
-    // Create texture for frame buffer
-    glGenTextures(1, aCbTex);
-    glBindTexture(GL_TEXTURE_2D, *aCbTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, aWidth, aHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+/* Creates a regular colour texture of the target's size and attaches it. */
+static unsigned int CreateColourTexture(unsigned int format, int width,
+                                        int height, unsigned int attachment)
+{
+    unsigned int tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0,
+                 GL_RGBA, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glBindTexture(GL_TEXTURE_2D, 0);
-    // Attach texture to framebuffer
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *aCbTex, 0);
-    // Create renderbuffer for depth and stencil components
-    glGenRenderbuffers(1, aRBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, *aRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, aWidth, aHeight);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-    // Attach render buffer to framebuffer
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, *aRBO);
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        SDL_Log("Error: Framebuffer is not complete!");
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, tex, 0);
+    return tex;
 }
 
 
-void Render::CreateMSFramebuffer(unsigned int *aFBO, unsigned int *aCbTex, unsigned int *aRBO,
-                                unsigned int aWidth, unsigned int aHeight)
+void Render::CreateRenderTarget(RenderTarget *rt, int width, int height)
 {
-    glGenFramebuffers(1, aFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, *aFBO);
-    GLERR;
+    DestroyRenderTarget(rt);
+    rt->mWidth = width;
+    rt->mHeight = height;
 
-    // Create texture for frame buffer
-    glGenTextures(1, aCbTex);
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, *aCbTex);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGB32F, aWidth, aHeight, GL_TRUE);
+    glGenFramebuffers(1, &rt->mFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, rt->mFBO);
     GLERR;
-    //glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    //glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    //glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    //glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
-    GLERR;
-    // Attach texture to framebuffer
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, *aCbTex, 0);
-    GLERR;
-    // Create renderbuffer for depth and stencil components
-    glGenRenderbuffers(1, aRBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, *aRBO);
-    glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_DEPTH24_STENCIL8, aWidth, aHeight);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    const bool isMultisampled = rt->mSamples > 0;
+    const unsigned int texTarget = isMultisampled ? GL_TEXTURE_2D_MULTISAMPLE
+                                                  : GL_TEXTURE_2D;
+
+    if (rt->mColourFormat != 0) {
+        // Create texture for frame buffer
+        if (isMultisampled) {
+            glGenTextures(1, &rt->mColourTex);
+            glBindTexture(texTarget, rt->mColourTex);
+            glTexImage2DMultisample(texTarget, rt->mSamples, rt->mColourFormat,
+                                    width, height, GL_TRUE);
+            glBindTexture(texTarget, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   texTarget, rt->mColourTex, 0);
+        }
+        else {
+            rt->mColourTex = CreateColourTexture(rt->mColourFormat, width,
+                                                 height, GL_COLOR_ATTACHMENT0);
+        }
+
+        unsigned int drawBuffers[1 + cMaxExtraColourAttachments] = {
+            GL_COLOR_ATTACHMENT0
+        };
+        int numDrawBuffers = 1;
+        for (unsigned int format : rt->mExtraColourFormats) {
+            if (format == 0) break;
+            SDL_assert(!isMultisampled);
+            unsigned int attachment = GL_COLOR_ATTACHMENT0 + numDrawBuffers;
+            rt->mExtraColourTex[numDrawBuffers - 1] = CreateColourTexture(
+                    format, width, height, attachment);
+            drawBuffers[numDrawBuffers++] = attachment;
+        }
+        glDrawBuffers(numDrawBuffers, drawBuffers);
+    }
+    else {
+        // Don't draw colours onto this buffer
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
     GLERR;
-    // Attach render buffer to framebuffer
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, *aRBO);
+
+    if (rt->mDepthFormat != 0) {
+        const bool hasStencil = rt->mDepthFormat == GL_DEPTH24_STENCIL8;
+        const unsigned int attachment = hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT
+                                                   : GL_DEPTH_ATTACHMENT;
+        if (rt->mDepthIsTexture) {
+            SDL_assert(!isMultisampled);
+            glGenTextures(1, &rt->mDepthTex);
+            glBindTexture(GL_TEXTURE_2D, rt->mDepthTex);
+            if (hasStencil) {
+                glTexImage2D(GL_TEXTURE_2D, 0, rt->mDepthFormat, width, height,
+                             0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+            }
+            else {
+                glTexImage2D(GL_TEXTURE_2D, 0, rt->mDepthFormat, width, height,
+                             0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+            float borderColour[] = {rt->mBorderDepth, rt->mBorderDepth,
+                                    rt->mBorderDepth, rt->mBorderDepth};
+            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColour);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D,
+                                   rt->mDepthTex, 0);
+        }
+        else {
+            glGenRenderbuffers(1, &rt->mDepthRBO);
+            glBindRenderbuffer(GL_RENDERBUFFER, rt->mDepthRBO);
+            if (isMultisampled) {
+                glRenderbufferStorageMultisample(GL_RENDERBUFFER, rt->mSamples,
+                                                 rt->mDepthFormat, width, height);
+            }
+            else {
+                glRenderbufferStorage(GL_RENDERBUFFER, rt->mDepthFormat,
+                                      width, height);
+            }
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment,
+                                      GL_RENDERBUFFER, rt->mDepthRBO);
+        }
+    }
     GLERR;
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        SDL_Log("Error: Framebuffer is not complete!");
+        SDL_Log("Error: Framebuffer %s is not complete!", rt->mName);
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    SDL_Log("Created render target %s: %dx%d, %d samples, %.1f MB",
+            rt->mName, width, height, rt->mSamples,
+            rt->GetGPUMemory() / (1024.0 * 1024.0));
 }
 
 
-void Render::CreateFBOs()
+void Render::DestroyRenderTarget(RenderTarget *rt)
 {
-    // if any objects are already existant, delete them before creating them
-    // again.
-    if (fbo != 0) glDeleteFramebuffers(1, &fbo);
-    if (textureColourBuffer != 0) glDeleteTextures(1, &textureColourBuffer);
-    if (rbo != 0) glDeleteRenderbuffers(1, &rbo);
-    CreateFramebuffer(&fbo, &textureColourBuffer, &rbo, screenWidth, screenHeight);
-    GLERR;
-    if (msFBO != 0) glDeleteFramebuffers(1, &msFBO);
-    if (msTexColourBuffer != 0) glDeleteTextures(1, &msTexColourBuffer);
-    if (msRBO != 0) glDeleteRenderbuffers(1, &msRBO);
-    CreateMSFramebuffer(&msFBO, &msTexColourBuffer, &msRBO, screenWidth, screenHeight);
+    if (rt->mFBO != 0) glDeleteFramebuffers(1, &rt->mFBO);
+    if (rt->mColourTex != 0) glDeleteTextures(1, &rt->mColourTex);
+    if (rt->mDepthTex != 0) glDeleteTextures(1, &rt->mDepthTex);
+    if (rt->mDepthRBO != 0) glDeleteRenderbuffers(1, &rt->mDepthRBO);
+    for (unsigned int &tex : rt->mExtraColourTex) {
+        if (tex != 0) glDeleteTextures(1, &tex);
+        tex = 0;
+    }
+    rt->mFBO = 0;
+    rt->mColourTex = 0;
+    rt->mDepthTex = 0;
+    rt->mDepthRBO = 0;
+    rt->mWidth = 0;
+    rt->mHeight = 0;
+}
+
+
+void Render::RebuildScreenTargets()
+{
+    sceneTarget.mName = "Scene resolve";
+    sceneTarget.mColourFormat = GetSceneColourFormat();
+    sceneTarget.mDepthFormat = GL_DEPTH24_STENCIL8;
+    // TAA reprojects with the depth.
+    sceneTarget.mDepthIsTexture = true;
+    CreateRenderTarget(&sceneTarget, screenWidth, screenHeight);
+
+    // The scene is drawn straight into sceneTarget without MSAA.
+    sceneMSTarget.mName = "Scene MSAA";
+    sceneMSTarget.mColourFormat = GetSceneColourFormat();
+    sceneMSTarget.mDepthFormat = GL_DEPTH24_STENCIL8;
+    sceneMSTarget.mSamples = GetSceneSamples();
+    if (sceneMSTarget.mSamples > 0) {
+        CreateRenderTarget(&sceneMSTarget, screenWidth, screenHeight);
+    }
+    else {
+        DestroyRenderTarget(&sceneMSTarget);
+    }
+
+    const char *historyNames[] = {"TAA history 0", "TAA history 1"};
+    for (int i = 0; i < 2; i++) {
+        taaHistoryTargets[i].mName = historyNames[i];
+        taaHistoryTargets[i].mColourFormat = GetSceneColourFormat();
+        if (GetAAMode() == AA_TAA) {
+            CreateRenderTarget(&taaHistoryTargets[i], screenWidth, screenHeight);
+        }
+        else {
+            DestroyRenderTarget(&taaHistoryTargets[i]);
+        }
+    }
+    ResetTemporalHistory();
+
+    gBufferTarget.mName = "G-buffer";
+    gBufferTarget.mColourFormat = GL_RGBA8;
+    gBufferTarget.mExtraColourFormats[0] = GL_RG16;
+    gBufferTarget.mExtraColourFormats[1] = GL_RG8;
+    gBufferTarget.mDepthFormat = GL_DEPTH24_STENCIL8;
+    // Read by the lighting pass, and copied into sceneTarget, which has
+    // the same format.
+    gBufferTarget.mDepthIsTexture = true;
+    if (GetRenderPath() == RENDER_PATH_DEFERRED) {
+        CreateRenderTarget(&gBufferTarget, screenWidth, screenHeight);
+    }
+    else {
+        DestroyRenderTarget(&gBufferTarget);
+    }
+
+    // Pooled targets of the old size will never be used again.
+    for (size_t i = 0; i < transientTargets.size();) {
+        RenderTarget *rt = transientTargets[i].get();
+        if (!rt->mInUse && (rt->mWidth != screenWidth || rt->mHeight != screenHeight)) {
+            DestroyRenderTarget(rt);
+            transientTargets.erase(transientTargets.begin() + i);
+        }
+        else {
+            i++;
+        }
+    }
     GLERR;
 }
 
 
+RenderTarget* Render::AcquireTransientTarget(int width, int height,
+                                             unsigned int colourFormat,
+                                             unsigned int depthFormat,
+                                             int samples)
+{
+    for (std::unique_ptr<RenderTarget> &rt : transientTargets) {
+        if (!rt->mInUse && rt->mWidth == width && rt->mHeight == height
+                && rt->mColourFormat == colourFormat
+                && rt->mDepthFormat == depthFormat && rt->mSamples == samples) {
+            rt->mInUse = true;
+            return rt.get();
+        }
+    }
+
+    std::unique_ptr<RenderTarget> &newTarget = transientTargets.emplace_back(
+            std::make_unique<RenderTarget>());
+    newTarget->mName = "Transient";
+    newTarget->mColourFormat = colourFormat;
+    newTarget->mDepthFormat = depthFormat;
+    newTarget->mSamples = samples;
+    CreateRenderTarget(newTarget.get(), width, height);
+    newTarget->mInUse = true;
+    return newTarget.get();
+}
+
+
+void Render::ReleaseTransientTarget(RenderTarget *rt)
+{
+    SDL_assert(rt->mInUse);
+    rt->mInUse = false;
+}
+
+
+void Render::DestroyAllRenderTargets()
+{
+    for (RenderTarget *rt : persistentTargets) {
+        DestroyRenderTarget(rt);
+    }
+    for (std::unique_ptr<RenderTarget> &rt : transientTargets) {
+        DestroyRenderTarget(rt.get());
+    }
+    transientTargets.clear();
+}
+
+
+void Render::RenderTargetsDebugGUI()
+{
+    if (!ImGui::CollapsingHeader("Render targets")) return;
+
+    size_t totalMemory = 0;
+    auto showTarget = [&totalMemory](const RenderTarget *rt) {
+        double mb = rt->GetGPUMemory() / (1024.0 * 1024.0);
+        ImGui::Text("%-16s %5dx%-5d x%d %7.1f MB", rt->mName, rt->mWidth,
+                    rt->mHeight, SDL_max(rt->mSamples, 1), mb);
+        totalMemory += rt->GetGPUMemory();
+    };
+    for (const RenderTarget *rt : persistentTargets) {
+        showTarget(rt);
+    }
+    for (const std::unique_ptr<RenderTarget> &rt : transientTargets) {
+        showTarget(rt.get());
+    }
+    ImGui::Text("Total: %.1f MB", totalMemory / (1024.0 * 1024.0));
+
+    const char *shadowQualities[] = {"Low", "Medium", "High"};
+    int shadowQuality = GetShadowQuality();
+    if (ImGui::Combo("Shadow quality", &shadowQuality, shadowQualities, 3)) {
+        SetShadowQuality(shadowQuality);
+    }
+    SunShadowDebugGUI();
+    SpotShadowDebugGUI();
+    PostDebugGUI();
+    DynamicResolutionDebugGUI();
+}
+
+
 void Render::RenderSkybox(glm::mat4 view, glm::mat4 projection)
 {
     glDepthFunc(GL_LEQUAL);
@@ -221,9 +492,9 @@ void Render::RenderSkybox(glm::mat4 view, glm::mat4 projection)
     glUseProgram(skyboxShader.id);
 
     GLERR;
-    skyboxShader.SetMat4fv((char*)"projection", glm::value_ptr(projection));
-    skyboxShader.SetMat4fv((char*)"view", glm::value_ptr(skyboxView));
-    skyboxShader.SetInt((char*)"skybox", 0);
+    skyboxShader.SetMat4fv("projection"_u, glm::value_ptr(projection));
+    skyboxShader.SetMat4fv("view"_u, glm::value_ptr(skyboxView));
+    skyboxShader.SetInt("skybox"_u, 0);
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex.id);
     glBindVertexArray(skyboxVAO);
@@ -235,20 +506,17 @@ void Render::RenderSkybox(glm::mat4 view, glm::mat4 projection)
 }
 
 
-void Render::DrawMap(ShaderProg &shader)
+void Render::DrawMap(RenderQueue &queue)
 {
-    GLERR;
     Model &mapModel = World::GetCurrentMapModel();
-    glm::mat4 model = glm::mat4(1.0f);
-    GLERR;
-    shader.SetMat4fv((char*)"model", glm::value_ptr(model));
-    GLERR;
-    mapModel.Draw(shader);
-    GLERR;
+    // The map never moves, so it can be cached in the shadow maps.
+    queue.mSubmitStatic = true;
+    queue.SubmitModel(mapModel, glm::mat4(1.0f));
+    queue.mSubmitStatic = false;
 }
 
 
-void Render::DrawCars(ShaderProg &shader)
+void Render::DrawCars(RenderQueue &queue)
 {
     for (Vehicle *car : GetExistingVehicles()) {
         glm::vec3 carPos = ToGlmVec3(car->GetPos());
@@ -256,7 +524,11 @@ void Render::DrawCars(ShaderProg &shader)
         carTrans = glm::translate(carTrans, carPos);
         carTrans = carTrans * QuatToMatrix(car->GetRotation());
 
-        car->GetVehicleModel()->Draw(shader, carTrans);
+        // Cars and wheels that share a model are drawn instanced by the
+        // queue, so each car only adds instances, not draws.
+        queue.SubmitModel(*car->GetVehicleModel(), carTrans, BUCKET_OPAQUE,
+                          nullptr, car->mSettings->paintMaterialIdx,
+                          ToGlmVec3(car->mPaintColour));
 
         // Draw car wheels
         for (int i = 0; i < 4; i++) {
@@ -264,13 +536,13 @@ void Render::DrawCars(ShaderProg &shader)
             if (car->IsWheelFlipped(i)) {
                 wheelTrans = glm::rotate(wheelTrans, SDL_PI_F, glm::vec3(1.0f, 0.0f, 0.0f));
             }
-            car->GetWheelModel()->Draw(shader, wheelTrans);
+            queue.SubmitModel(*car->GetWheelModel(), wheelTrans);
         }
     }
 }
 
 
-void Render::DrawCheckpoints(ShaderProg &shader, Player *p)
+void Render::DrawCheckpoints(RenderQueue &queue, Player *p)
 {
     if (World::GetCheckpoints().size() > 0 && World::GetRaceState() != RACE_NONE
             && World::GetRaceState() != RACE_ENDED) {
@@ -279,7 +551,7 @@ void Render::DrawCheckpoints(ShaderProg &shader, Player *p)
         model = glm::translate(model, ToGlmVec3(checkpoint.GetPosition()));
         // TODO: Add variable for checkpoint size
         model = glm::scale(model, glm::vec3(2.0f, 2.0f, 2.0f));
-        cubeModel->Draw(shader, model, &windowMat);
+        queue.SubmitModel(*cubeModel, model, BUCKET_TRANSPARENT, &windowMat);
     }
 }
 
@@ -288,48 +560,58 @@ void Render::DrawCheckpoints(ShaderProg &shader, Player *p)
 void Render::LoadShaders()
 {
     GLERR;
+    Uint64 startTime = SDL_GetTicksNS();
+    int hitsBefore = GetShaderCacheHits();
+    int missesBefore = GetShaderCacheMisses();
+
     // Create shaders
-    unsigned int vShader = CreateShaderFromFile("shaders/vertex.glsl", 
-                                                 GL_VERTEX_SHADER);
-    unsigned int fShader = CreateShaderFromFile("shaders/fragment.glsl", 
-                                                 GL_FRAGMENT_SHADER);
-    pbrShader = CreateAndLinkShaderProgram(vShader, fShader);
-
-    unsigned int vSkybox = CreateShaderFromFile("shaders/v_skybox.glsl",
-                                                GL_VERTEX_SHADER);
-    unsigned int fSkybox = CreateShaderFromFile("shaders/f_skybox.glsl",
-                                                GL_FRAGMENT_SHADER);
-    skyboxShader = CreateAndLinkShaderProgram(vSkybox, fSkybox);
-
-    unsigned int vScreen = CreateShaderFromFile("shaders/v_screen.glsl",
-                                                GL_VERTEX_SHADER);
-    unsigned int fScreen = CreateShaderFromFile("shaders/f_screen.glsl",
-                                                GL_FRAGMENT_SHADER);
-    screenShader = CreateAndLinkShaderProgram(vScreen, fScreen);
-
-    unsigned int fScreenRaw = CreateShaderFromFile("shaders/f_screen_raw.glsl",
-                                                   GL_FRAGMENT_SHADER);
-
-    rawScreenShader = CreateAndLinkShaderProgram(vScreen, fScreenRaw);
-
-    unsigned int vSimpleDepth = CreateShaderFromFile("shaders/v_simple_depth.glsl", GL_VERTEX_SHADER);
-    unsigned int fSimpleDepth = CreateShaderFromFile("shaders/f_simple_depth.glsl", GL_FRAGMENT_SHADER);
-    simpleDepthShader = CreateAndLinkShaderProgram(vSimpleDepth, fSimpleDepth);
-
-    unsigned int vText = CreateShaderFromFile("shaders/v_text.glsl", GL_VERTEX_SHADER);
-    unsigned int fText = CreateShaderFromFile("shaders/f_text.glsl", GL_FRAGMENT_SHADER);
-    textShader = CreateAndLinkShaderProgram(vText, fText);
-
-    unsigned int vUI = CreateShaderFromFile("shaders/v_ui.glsl", GL_VERTEX_SHADER);
-    unsigned int fUI = CreateShaderFromFile("shaders/f_ui.glsl", GL_FRAGMENT_SHADER);
-    uiShader = CreateAndLinkShaderProgram(vUI, fUI);
+    LoadPBRShaders();
+
+    skyboxShader = CreateShaderProgramFromFiles("shaders/v_skybox.glsl",
+                                                "shaders/f_skybox.glsl");
+    screenShader = CreateShaderProgramFromFiles("shaders/v_screen.glsl",
+                                                "shaders/f_screen.glsl");
+    LoadPostShaders();
+    rawScreenShader = CreateShaderProgramFromFiles("shaders/v_screen.glsl",
+                                                   "shaders/f_screen_raw.glsl");
+    simpleDepthShader = CreateShaderProgramFromFiles("shaders/v_simple_depth.glsl",
+                                                     "shaders/f_simple_depth.glsl");
+    char instancedDefines[128];
+    SDL_snprintf(instancedDefines, sizeof(instancedDefines),
+                 "#define INSTANCED\n#define INSTANCE_ATTRIB_MODEL %d\n",
+                 INSTANCE_ATTRIB_MODEL);
+    simpleDepthInstancedShader = CreateShaderProgramFromFiles(
+            "shaders/v_simple_depth.glsl", "shaders/f_simple_depth.glsl",
+            instancedDefines);
+    depthPrePassShader = CreateShaderProgramFromFiles(
+            "shaders/v_simple_depth.glsl", "shaders/f_simple_depth.glsl",
+            "#define VIEW_DEPTH\n");
+    BindUniformBlocks(depthPrePassShader);
+    char prePassDefines[160];
+    SDL_snprintf(prePassDefines, sizeof(prePassDefines), "#define VIEW_DEPTH\n%s",
+                 instancedDefines);
+    depthPrePassInstancedShader = CreateShaderProgramFromFiles(
+            "shaders/v_simple_depth.glsl", "shaders/f_simple_depth.glsl",
+            prePassDefines);
+    BindUniformBlocks(depthPrePassInstancedShader);
+    textShader = CreateShaderProgramFromFiles("shaders/v_text.glsl",
+                                              "shaders/f_text.glsl");
+    uiShader = CreateShaderProgramFromFiles("shaders/v_ui.glsl",
+                                            "shaders/f_ui.glsl");
     glUseProgram(uiShader.id);
     // Initialise uniform for ui shader
-    uiShader.SetVec4((char*)"colourMod", 1.0, 1.0, 1.0, 1.0);
-
-    unsigned int fSamplerArrayTest = CreateShaderFromFile("shaders/f_samplerarray_test.glsl",
-                                                          GL_FRAGMENT_SHADER);
-    samplerArrayTestShader = CreateAndLinkShaderProgram(vScreen, fSamplerArrayTest);
+    uiShader.SetVec4("colourMod"_u, 1.0, 1.0, 1.0, 1.0);
+
+    samplerArrayTestShader = CreateShaderProgramFromFiles(
+            "shaders/v_screen.glsl", "shaders/f_samplerarray_test.glsl");
+
+    // Compare a run with an empty cache to one with a full cache to see how
+    // much time the cache saves.
+    int hits = GetShaderCacheHits() - hitsBefore;
+    int misses = GetShaderCacheMisses() - missesBefore;
+    double ms = (SDL_GetTicksNS() - startTime) / (double)SDL_NS_PER_MS;
+    SDL_Log("Loaded shaders in %.1f ms (program binary cache %s: %d hits, %d misses)",
+            ms, IsShaderCacheEnabled() ? "on" : "off", hits, misses);
 }
 
 
@@ -358,7 +640,7 @@ void Render::InitText()
 {
     GLERR;
     glUseProgram(textShader.id);
-    textShader.SetMat4fv((char*)"projection", glm::value_ptr(uiProj));
+    textShader.SetMat4fv("projection"_u, glm::value_ptr(uiProj));
     GLERR;
     GLERR;
 
@@ -492,6 +774,76 @@ void Render::DebugGUI()
         }
     }
     SDL_free(displayModes);
+
+    ImGui::Text("Uniform lookups avoided last frame: %d",
+                GetUniformLookupsAvoided());
+
+    // Only applies to models loaded afterwards, e.g. when changing map.
+    const char *vertexFormats[] = {"Full", "Packed"};
+    int vertexFormat = GetVertexFormat();
+    if (ImGui::Combo("Vertex format (next load)", &vertexFormat,
+                     vertexFormats, IM_ARRAYSIZE(vertexFormats))) {
+        SetVertexFormat((VertexFormat)vertexFormat);
+    }
+    bool optimizeMeshes = GetOptimizeMeshes();
+    if (ImGui::Checkbox("Optimize meshes (next load)", &optimizeMeshes)) {
+        SetOptimizeMeshes(optimizeMeshes);
+    }
+    bool generateLODs = GetGenerateLODs();
+    if (ImGui::Checkbox("Generate LODs (next load)", &generateLODs)) {
+        SetGenerateLODs(generateLODs);
+    }
+    LODDebugGUI();
+
+    ClustersDebugGUI();
+    ShadersDebugGUI();
+    DeferredDebugGUI();
+    ImGui::Checkbox("Frustum culling", &doFrustumCulling);
+    ImGui::Checkbox("Depth pre-pass", &doDepthPrePass);
+    {
+        // Averaged separately for each renderer with the pre-pass on and
+        // off, so that they can be compared on the same map. With the
+        // deferred renderer this includes the lighting pass.
+        static float opaqueTimes[NUM_RENDER_PATHS][2] = {};
+        float time = opaqueGPUTimer.GetMilliseconds();
+        float *times = opaqueTimes[GetRenderPath()];
+        float &average = times[doDepthPrePass];
+        average = average == 0.0f ? time : average + (time - average) * 0.05f;
+        ImGui::Text("    Opaque GPU time: %.2f ms (pre-pass off: %.2f ms, on: %.2f ms)",
+                    time, times[0], times[1]);
+    }
+    if (GetMultiDrawIndirectSupported()) {
+        bool mdi = GetMultiDrawIndirectEnabled();
+        if (ImGui::Checkbox("Multi draw indirect", &mdi)) {
+            SetMultiDrawIndirectEnabled(mdi);
+        }
+    } else {
+        ImGui::Text("Multi draw indirect: not supported");
+    }
+    CullingDebugGUI();
+    OcclusionDebugGUI();
+    const char *passNames[NUM_QUEUE_PASSES] = {"View", "Shadow", "Pre-pass"};
+    for (int i = 0; i < NUM_QUEUE_PASSES; i++) {
+        const QueueStats &stats = GetQueueStats((QueuePass)i);
+        ImGui::Text("%s: %d draws (%d culled), %d vertices (%d culled)",
+                    passNames[i], stats.mDraws, stats.mCulled,
+                    stats.mVerticesDrawn, stats.mVerticesCulled);
+        ImGui::Text("    %d packets drawn instanced, %d occluded",
+                    stats.mInstances, stats.mOccluded);
+        if (stats.mGPUCullDraws > 0) {
+            ImGui::Text("    %d draws submitted to the cull shader",
+                        stats.mGPUCullDraws);
+        }
+        ImGui::Text("    program binds: %d, material binds: %d, VAO binds: %d",
+                    stats.mProgramBinds, stats.mMaterialBinds, stats.mVAOBinds);
+        static_assert(MAX_MESH_LODS == 4, "Update the LOD stats below");
+        ImGui::Text("    packets per LOD: %d / %d / %d / %d",
+                    stats.mLODPackets[0], stats.mLODPackets[1],
+                    stats.mLODPackets[2], stats.mLODPackets[3]);
+    }
+
+    GeometryPoolDebugGUI();
+    RenderTargetsDebugGUI();
     ImGui::End();
 }
 
@@ -547,16 +899,22 @@ void Render::GetPlayerSplitScreenBounds(int playerNum, float *outX, float *outY,
 
 void Render::RenderSceneSplitScreen()
 {
-    GLERR;
-    glUseProgram(pbrShader.id);
     GLERR;
     float playerScreenWidth, playerScreenHeight, xOffset, yOffset;
+    // Views are drawn into the bottom left part of the scene target when the
+    // resolution is scaled down, and the post processing scales them back up.
+    float scale = GetResolutionScale();
     for (int i = 0; i < gNumPlayers; i++) {
         GetPlayerSplitScreenBounds(i, &xOffset, &yOffset, 
                                    &playerScreenWidth, &playerScreenHeight);
         GLERR;
         //SDL_Log("%d, %d", playerScreenWidth, playerScreenHeight);
-        glViewport(xOffset, yOffset, playerScreenWidth, playerScreenHeight);
+        // Round both edges so that neighbouring views still meet.
+        int x0 = SDL_lroundf(xOffset * scale);
+        int y0 = SDL_lroundf(yOffset * scale);
+        int x1 = SDL_lroundf((xOffset + playerScreenWidth) * scale);
+        int y1 = SDL_lroundf((yOffset + playerScreenHeight) * scale);
+        glViewport(x0, y0, x1 - x0, y1 - y0);
         GLERR;
         Render::RenderScene(gPlayers[i].cam.cam, &gPlayers[i]);
         GLERR;
@@ -569,21 +927,29 @@ void Render::RenderSceneSplitScreen()
 
 void Render::UpdateWindowSize()
 {
-    bool screenSuccess = SDL_GetWindowSize(window, &screenWidth, &screenHeight);
-    if (screenSuccess) {
-        glViewport(0, 0, screenWidth, screenHeight);
-        // Update projection uniforms in shaders.
-        uiProj = glm::ortho(0.0f, (float)screenWidth, 0.0f, (float)screenHeight);
-        glUseProgram(uiShader.id);
-        uiShader.SetMat4fv((char*)"proj", glm::value_ptr(uiProj));
-        glUseProgram(textShader.id);
-        textShader.SetMat4fv((char*)"projection", glm::value_ptr(uiProj));
-        // Delete and recreate screen frame buffer objects with new screen
-        // size.
-        CreateFBOs();
-    }
-    else {
+    int newWidth, newHeight;
+    bool screenSuccess = SDL_GetWindowSize(window, &newWidth, &newHeight);
+    if (!screenSuccess) {
         SDL_Log("Could not get screen size.");
+        return;
+    }
+    // Minimised windows can have no size. Keep the old targets until the
+    // window is restored.
+    if (newWidth <= 0 || newHeight <= 0) return;
+
+    screenWidth = newWidth;
+    screenHeight = newHeight;
+    glViewport(0, 0, screenWidth, screenHeight);
+    // Update projection uniforms in shaders.
+    uiProj = glm::ortho(0.0f, (float)screenWidth, 0.0f, (float)screenHeight);
+    glUseProgram(uiShader.id);
+    uiShader.SetMat4fv("proj"_u, glm::value_ptr(uiProj));
+    glUseProgram(textShader.id);
+    textShader.SetMat4fv("projection"_u, glm::value_ptr(uiProj));
+    // Delete and recreate screen frame buffer objects if the size actually
+    // changed.
+    if (sceneTarget.mWidth != screenWidth || sceneTarget.mHeight != screenHeight) {
+        RebuildScreenTargets();
     }
 }
 
@@ -599,8 +965,8 @@ void Render::RenderShadowDepthToScreen()
     glActiveTexture(GL_TEXTURE9);
     glBindTexture(GL_TEXTURE_2D, Render::GetSpotShadowTexAtlas());
     //glBindTexture(GL_TEXTURE_2D, Render::GetTestShadowTex());
-    samplerArrayTestShader.SetInt((char*)"spotLightShadowMapAtlas", 9);
-    //samplerArrayTestShader.SetInt((char*)"tex", 0);
+    samplerArrayTestShader.SetInt("spotLightShadowMapAtlas"_u, 9);
+    //samplerArrayTestShader.SetInt("tex"_u, 0);
     glBindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -4,9 +4,13 @@
  */
 #pragma once
 
+#include "render_queue.h"
+
 #include <glm/glm.hpp>
 #include <SDL3/SDL.h>
 
+#include <stddef.h>
+
 // Forward declarations
 struct ShaderProg;
 struct Texture;
@@ -14,14 +18,66 @@ struct Model;
 struct Material;
 struct Player;
 struct Rect;
+struct GPUTimer;
 enum UIAnchor : unsigned int;
 
-extern unsigned int fbo;
-extern unsigned int rbo;
-extern unsigned int textureColourBuffer;
-extern unsigned int msFBO;
-extern unsigned int msRBO;
-extern unsigned int msTexColourBuffer;
+// Colour attachments of a render target after the first one
+constexpr int cMaxExtraColourAttachments = 3;
+
+/*
+ * A framebuffer with an optional colour texture and an optional depth
+ * attachment. The fields above mFBO describe the target and are filled in
+ * before calling Render::CreateRenderTarget(). Render targets are owned by the
+ * render target manager in render_internal.cpp, which only rebuilds them when
+ * the window is resized or a quality setting changes.
+ */
+struct RenderTarget {
+    const char *mName = "";
+    // GL internal format of the colour texture. 0 for no colour attachment.
+    unsigned int mColourFormat = 0;
+    // GL internal formats of more colour textures for drawing to several
+    // targets at once (e.g. the G-buffer), attached after the first one. The
+    // first 0 ends the list. Only used with mColourFormat and without MSAA.
+    unsigned int mExtraColourFormats[cMaxExtraColourAttachments] = {};
+    // GL internal format of the depth attachment. 0 for no depth attachment.
+    unsigned int mDepthFormat = 0;
+    // Number of MSAA samples. 0 for a regular (not multisampled) target.
+    int mSamples = 0;
+    // Store depth in a texture that can be sampled (e.g. shadow maps) instead
+    // of a renderbuffer.
+    bool mDepthIsTexture = false;
+    // Value returned when sampling the depth texture outside of its bounds.
+    float mBorderDepth = 1.0f;
+
+    unsigned int mFBO = 0;
+    unsigned int mColourTex = 0;
+    unsigned int mExtraColourTex[cMaxExtraColourAttachments] = {};
+    unsigned int mDepthTex = 0;
+    unsigned int mDepthRBO = 0;
+    int mWidth = 0;
+    int mHeight = 0;
+    // Only used by transient targets. True while a pass is using the target.
+    bool mInUse = false;
+
+    /* Approximate amount of GPU memory used by the attachments in bytes. */
+    size_t GetGPUMemory() const;
+};
+
+// Multisampled target that the scene is rendered onto.
+extern RenderTarget sceneMSTarget;
+// Target that the multisampled scene is resolved onto.
+extern RenderTarget sceneTarget;
+// This and last frame's output of temporal anti-aliasing, see render_post.h
+extern RenderTarget taaHistoryTargets[2];
+// Surfaces of the opaque bucket for the deferred renderer, see
+// render_deferred.h. Only created when the deferred renderer is used.
+extern RenderTarget gBufferTarget;
+extern RenderTarget sunShadowTarget;
+extern RenderTarget spotShadowTarget;
+// Static casters only, copied into the shadow targets above before the
+// dynamic casters are drawn. Same layout as the targets they cache.
+extern RenderTarget sunShadowCacheTarget;
+extern RenderTarget spotShadowCacheTarget;
 extern unsigned int textVAO, textVBO;
 extern unsigned int quadVAO, quadVBO;
 extern unsigned int uiQuadVAO, uiQuadVBO;
@@ -35,24 +91,52 @@ extern Texture tachoNeedleTex;
 extern glm::mat4 uiProj;
 
 extern ShaderProg simpleDepthShader;
-extern ShaderProg pbrShader;
+// Reads the model matrix from the instance attributes, see render_queue.h
+extern ShaderProg simpleDepthInstancedShader;
+// Depth pre-pass of the views. Read the camera from the Camera block.
+extern ShaderProg depthPrePassShader;
+extern ShaderProg depthPrePassInstancedShader;
 extern ShaderProg screenShader;
 extern ShaderProg uiShader;
 extern ShaderProg textShader;
 
+// Map and cars for the current frame. Built once per frame and shared by the
+// shadow passes and every view.
+extern Render::RenderQueue sceneQueue;
+extern bool doFrustumCulling;
+// Draw the depth of the opaque bucket of each view before its colour, so that
+// the PBR shader only runs once per pixel.
+extern bool doDepthPrePass;
+// GPU time of the depth pre-pass and opaque bucket of every view, and the
+// lighting pass with the deferred renderer
+extern GPUTimer opaqueGPUTimer;
+
 extern bool doSplitScreen;
 extern SDL_Window *window;
 
 namespace Render {
-    void CreateFramebuffer(unsigned int *aFBO, unsigned int *aCbTex, unsigned int *aRBO, 
-                              unsigned int aWidth, unsigned int aHeight);
-    void CreateMSFramebuffer(unsigned int *aFBO, unsigned int *aCbTex, unsigned int *aRBO,
-                                    unsigned int aWidth, unsigned int aHeight);
-    void CreateFBOs();
+    /* Creates the attachments of rt with the given size. If rt already
+     * exists, it is destroyed first. */
+    void CreateRenderTarget(RenderTarget *rt, int width, int height);
+    void DestroyRenderTarget(RenderTarget *rt);
+    /* Recreates the screen sized targets. Only call this when the screen size
+     * or a quality setting has changed. */
+    void RebuildScreenTargets();
+    /* Returns an unused pooled target with the given size and format, creating
+     * one if none exist. Give it back with ReleaseTransientTarget() once the
+     * pass that needs it is finished. */
+    RenderTarget* AcquireTransientTarget(int width, int height,
+                                         unsigned int colourFormat,
+                                         unsigned int depthFormat = 0,
+                                         int samples = 0);
+    void ReleaseTransientTarget(RenderTarget *rt);
+    void DestroyAllRenderTargets();
+    void RenderTargetsDebugGUI();
     void RenderSkybox(glm::mat4 view, glm::mat4 projection);
-    void DrawMap(ShaderProg &shader);
-    void DrawCars(ShaderProg &shader);
-    void DrawCheckpoints(ShaderProg &shader, Player *p);
+    /* Submit the map, cars, and the player's next checkpoint to queue. */
+    void DrawMap(RenderQueue &queue);
+    void DrawCars(RenderQueue &queue);
+    void DrawCheckpoints(RenderQueue &queue, Player *p);
     void DebugGUI();
     bool LoadFont();
     void LoadShaders();
@@ -1,6 +1,8 @@
 #include "render_internal.h"
 #include "render_lights.h"
 #include "render_defines.h"
+#include "render_ubo.h"
+#include "render_clusters.h"
 //#include "render_shaders.h"
 #include "render_shadow.h"
 #include "shader.h"
@@ -87,72 +89,35 @@ void Render::DestroySpotLight(SpotLight *spotLight)
 
 void Render::ResetSpotLightsGPU()
 {
-    glUseProgram(pbrShader.id);
-    char uniformName[64];
-    glm::vec3 zero = glm::vec3(0, 0, 0);
-    for (int i = 0; i < MAX_SPOT_LIGHTS; i++) {
-        SDL_snprintf(uniformName, 64, "spotLights[%d].diffuse", i);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(zero));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].specular", i);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(zero));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].position", i);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(zero));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].direction", i);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(zero));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].cutoffInner", i);
-        pbrShader.SetFloat(uniformName, 0.0);
-        SDL_snprintf(uniformName, 64, "spotLights[%d].cutoffOuter", i);
-        pbrShader.SetFloat(uniformName, 0.0);
-        SDL_snprintf(uniformName, 64, "spotLights[%d].shadowMapIdx", i);
-        pbrShader.SetInt(uniformName, -1);
-        GLERR;
-    }
+    // The lights are rebuilt from the CPU side lights every frame, so empty
+    // lights are enough to stop stale lights from being drawn.
+    LightsBlock block = {};
+    UploadLightsBlock(block);
+    UploadClusterLights(std::vector<ClusterLight>());
+    GLERR;
 }
 
 
-void Render::SetSpotLightUniforms(ShaderProg pbrShader, glm::mat4 view)
+void Render::AppendSpotLights(std::vector<ClusterLight> &outLights)
 {
-    char uniformName[64];
-    int spotLightNum = 0;
-    for (size_t i = 0; i < spotLights.size() && spotLightNum < MAX_SPOT_LIGHTS; i++) {
+    for (size_t i = 0; i < spotLights.size(); i++) {
         if (spotLights[i] == nullptr) continue;
         
-        glActiveTexture(GL_TEXTURE0);
-
         //if (!spotLights[i]->mEnableShadows) continue;
         glm::vec3 lightCol = spotLights[i]->mColour / glm::vec3(1.0);
         //glm::vec3 lightCol = glm::vec3(6000.0);
-        SDL_snprintf(uniformName, 64, "spotLights[%d].diffuse", spotLightNum);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(lightCol));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].specular", spotLightNum);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(lightCol));
-
-        glm::vec3 viewPos = glm::vec3(view * glm::vec4(spotLights[i]->mPosition, 1.0));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].position", spotLightNum);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(viewPos));
-
-        glm::vec3 viewDir = glm::vec3(view * glm::vec4(spotLights[i]->mDirection, 0.0));
-        SDL_snprintf(uniformName, 64, "spotLights[%d].direction", spotLightNum);
-        pbrShader.SetVec3(uniformName, glm::value_ptr(viewDir));
-
-        SDL_snprintf(uniformName, 64, "spotLights[%d].quadratic", spotLightNum);
-        pbrShader.SetFloat(uniformName, spotLights[i]->mQuadratic);
-        SDL_snprintf(uniformName, 64, "spotLights[%d].cutoffInner", spotLightNum);
-        pbrShader.SetFloat(uniformName, spotLights[i]->mCutoffInner);
-        SDL_snprintf(uniformName, 64, "spotLights[%d].cutoffOuter", spotLightNum);
-        pbrShader.SetFloat(uniformName, spotLights[i]->mCutoffOuter);
-        GLERR;
-
-        // Search for the shadow corresponding to this light
-        int spotShadowNum = -1;
-        spotShadowNum = GetSpotLightShadowNumForLightIdx(spotLightNum);
-        // Set the shadow uniform for this light: -1 for no shadow.
-        SDL_snprintf(uniformName, 64, "spotLights[%d].shadowMapIdx", spotLightNum);
-        pbrShader.SetInt(uniformName, spotShadowNum);
-
-        spotLightNum++;
+        ClusterLight out;
+        out.position = glm::vec4(spotLights[i]->mPosition, GetLightRange(lightCol));
+        out.direction = glm::vec4(spotLights[i]->mDirection,
+                                  spotLights[i]->mCutoffInner);
+        out.colour = glm::vec4(lightCol, spotLights[i]->mCutoffOuter);
+
+        // Search for the shadow corresponding to this light: -1 for no shadow.
+        // Shadows store the index in the spotLights vector.
+        int spotShadowNum = GetSpotLightShadowNumForLightIdx(i);
+        out.info = glm::vec4(CLUSTER_LIGHT_SPOT, spotShadowNum, 0.0f, 0.0f);
+        outLights.push_back(out);
     }
-
 }
 
 
@@ -2,10 +2,12 @@
 
 #include <glm/glm.hpp>
 
-// Forward declarations
-struct ShaderProg;
+#include <vector>
 
 namespace Render {
+    // Forward declarations
+    struct ClusterLight;
+
     struct Light
     {
         glm::vec3 mPosition;
@@ -44,14 +46,10 @@ namespace Render {
     Render::SpotLight* CreateSpotLight();
     void DestroySpotLight(SpotLight *spotLight);
 
-    /* Resets the spotlight shader uniforms. */
+    /* Clears the lights on the GPU. */
     void ResetSpotLightsGPU();
-    /* Sets all uniforms for the spotlights in the PBR shader to keep them
-     * synced with the array of spotlights on the CPU. View is the camera's
-     * view matrix. This function should be called if the camera's view
-     * changes, a light changes, or a light's shadow is changed. Should
-     * probably call it every frame. */
-    void SetSpotLightUniforms(ShaderProg pbrShader, glm::mat4 view);
+    /* Adds all spotlights to outLights for the cluster light buffer. */
+    void AppendSpotLights(std::vector<ClusterLight> &outLights);
     /* Sorts the spotlights from closest to the player to farthest from the
      * player. This is used for giving shadows to the spotlights closest to the
      * player. */
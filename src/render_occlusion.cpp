@@ -0,0 +1,220 @@
+#include "render_occlusion.h"
+#include "render_internal.h"
+#include "render_queue.h"
+#include "bounds.h"
+#include "player.h"
+#include "shader.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <stdint.h>
+
+// Boxes are grown by this much so that they are in front of the surfaces of
+// their own node, which are already in the depth buffer.
+static constexpr float cBoxPadding = 0.1f;
+// Nodes whose box is closer to the camera than this are always drawn, as
+// the near plane could clip the box and hide it.
+static constexpr float cCameraMargin = 1.0f;
+
+struct OcclusionView {
+    // One query per node of the queue
+    std::vector<unsigned int> mQueries;
+    // 1 while the node's query has no result yet
+    std::vector<uint8_t> mPending;
+    std::vector<uint8_t> mOccluded;
+    int mNumOccluded = 0;
+    int mNumQueries = 0;
+};
+
+static OcclusionView views[MAX_PLAYERS];
+static OcclusionView *currentView = nullptr;
+// Index of the next view in this frame
+static int nextView = 0;
+static bool occlusionCulling = true;
+
+static unsigned int boxVAO = 0;
+static unsigned int boxVBO = 0;
+static unsigned int boxEBO = 0;
+
+static const float boxVertices[] = {
+    -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,
+    -1.0f,  1.0f, -1.0f,   1.0f,  1.0f, -1.0f,
+    -1.0f, -1.0f,  1.0f,   1.0f, -1.0f,  1.0f,
+    -1.0f,  1.0f,  1.0f,   1.0f,  1.0f,  1.0f
+};
+
+// Face culling is off while querying, so the winding doesn't matter.
+static const uint8_t boxIndices[] = {
+    0, 1, 3,  0, 3, 2, // -z
+    4, 6, 7,  4, 7, 5, // +z
+    0, 2, 6,  0, 6, 4, // -x
+    1, 5, 7,  1, 7, 3, // +x
+    0, 4, 5,  0, 5, 1, // -y
+    2, 3, 7,  2, 7, 6  // +y
+};
+
+
+static void ResizeView(OcclusionView &view, size_t numNodes)
+{
+    if (!view.mQueries.empty()) {
+        glDeleteQueries(view.mQueries.size(), view.mQueries.data());
+    }
+    view.mQueries.resize(numNodes);
+    if (numNodes > 0) {
+        glGenQueries(numNodes, view.mQueries.data());
+    }
+    view.mPending.assign(numNodes, 0);
+    view.mOccluded.assign(numNodes, 0);
+}
+
+
+void Render::InitOcclusion()
+{
+    glGenVertexArrays(1, &boxVAO);
+    glGenBuffers(1, &boxVBO);
+    glGenBuffers(1, &boxEBO);
+    glBindVertexArray(boxVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(boxVertices), boxVertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(boxIndices), boxIndices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GLERR;
+}
+
+
+void Render::DestroyOcclusion()
+{
+    for (OcclusionView &view : views) {
+        ResizeView(view, 0);
+    }
+    glDeleteVertexArrays(1, &boxVAO);
+    glDeleteBuffers(1, &boxVBO);
+    glDeleteBuffers(1, &boxEBO);
+    boxVAO = boxVBO = boxEBO = 0;
+}
+
+
+void Render::BeginOcclusionView(const RenderQueue &queue)
+{
+    currentView = nullptr;
+    int viewIdx = nextView++;
+    if (!occlusionCulling || viewIdx >= MAX_PLAYERS) return;
+
+    OcclusionView &view = views[viewIdx];
+    size_t numNodes = queue.mNodeBounds.size();
+    // The nodes are only the same as last frame if the same number of them
+    // were submitted. Otherwise start over with everything visible.
+    if (view.mQueries.size() != numNodes) {
+        ResizeView(view, numNodes);
+    }
+
+    view.mNumOccluded = 0;
+    for (size_t i = 0; i < numNodes; i++) {
+        if (view.mPending[i]) {
+            // Results that aren't ready yet are left for the next frame
+            // instead of waiting, and the node keeps its last state.
+            GLuint available = 0;
+            glGetQueryObjectuiv(view.mQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint anySamples = 0;
+                glGetQueryObjectuiv(view.mQueries[i], GL_QUERY_RESULT, &anySamples);
+                view.mOccluded[i] = anySamples == 0;
+                view.mPending[i] = 0;
+            }
+        } else {
+            // Not queried last frame, e.g. outside of the frustum.
+            view.mOccluded[i] = 0;
+        }
+        view.mNumOccluded += view.mOccluded[i];
+    }
+    currentView = &view;
+    GLERR;
+}
+
+
+void Render::QueryOcclusion(const RenderQueue &queue, const glm::mat4 &viewProj,
+                            const Frustum &frustum, glm::vec3 camPos)
+{
+    if (currentView == nullptr) return;
+    OcclusionView &view = *currentView;
+
+    glUseProgram(simpleDepthShader.id);
+    simpleDepthShader.SetMat4fv("lightSpaceMatrix"_u, glm::value_ptr(viewProj));
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(boxVAO);
+
+    view.mNumQueries = 0;
+    for (size_t i = 0; i < queue.mNodeBounds.size(); i++) {
+        const AABB &bounds = queue.mNodeBounds[i];
+        if (view.mPending[i] || !bounds.IsValid() || !frustum.Intersects(bounds)) {
+            continue;
+        }
+        glm::vec3 centre = bounds.Centre();
+        glm::vec3 extents = bounds.Extents() + glm::vec3(cBoxPadding);
+        glm::vec3 toCam = glm::abs(camPos - centre);
+        if (glm::all(glm::lessThan(toCam, extents + glm::vec3(cCameraMargin)))) {
+            continue;
+        }
+
+        glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), centre), extents);
+        simpleDepthShader.SetMat4fv("model"_u, glm::value_ptr(model));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, view.mQueries[i]);
+        glDrawElements(GL_TRIANGLES, sizeof(boxIndices), GL_UNSIGNED_BYTE, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        view.mPending[i] = 1;
+        view.mNumQueries++;
+    }
+
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    GLERR;
+}
+
+
+void Render::EndOcclusionView()
+{
+    currentView = nullptr;
+}
+
+
+bool Render::IsNodeOccluded(uint32_t nodeIdx)
+{
+    return currentView != nullptr && nodeIdx < currentView->mOccluded.size()
+        && currentView->mOccluded[nodeIdx];
+}
+
+
+void Render::ResetOcclusionViews()
+{
+    nextView = 0;
+}
+
+
+void Render::OcclusionDebugGUI()
+{
+    ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+    if (!occlusionCulling) return;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        const OcclusionView &view = views[i];
+        if (view.mQueries.empty()) continue;
+        ImGui::Text("    View %d: %d of %zu nodes occluded, %d queries",
+                    i, view.mNumOccluded, view.mQueries.size(), view.mNumQueries);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+// Forward declarations
+struct Frustum;
+
+/*
+ * Occlusion culling with hardware occlusion queries. After the opaque bucket
+ * of a view is drawn, the bounding box of every node of the queue that is in
+ * the frustum is drawn against the depth buffer with colour and depth writes
+ * off, each in its own GL_ANY_SAMPLES_PASSED query. The results are read
+ * back when the same view is drawn in the next frame, so the CPU never waits
+ * for the GPU, and nodes with no visible samples are skipped by DrawQueue()
+ * like nodes outside of the frustum.
+ *
+ * Because the results are a frame old, a node that comes into view shows up
+ * one frame late. Nodes whose box contains the camera are never queried.
+ *
+ * Views are told apart by the order they are drawn in within a frame, the
+ * same as the split screen players.
+ */
+
+namespace Render {
+    struct RenderQueue;
+
+    void InitOcclusion();
+    void DestroyOcclusion();
+    /* Reads the results of the next view's queries from the last frame and
+     * makes IsNodeOccluded() answer for it. Call before drawing a view. */
+    void BeginOcclusionView(const RenderQueue &queue);
+    /* Queries the nodes of queue that are inside of frustum against the
+     * current depth buffer. Call after drawing the opaque bucket of the view
+     * and before EndOcclusionView(). */
+    void QueryOcclusion(const RenderQueue &queue, const glm::mat4 &viewProj,
+                        const Frustum &frustum, glm::vec3 camPos);
+    void EndOcclusionView();
+    /* True if the node had no visible samples when the current view was last
+     * drawn. Always false outside of Begin/EndOcclusionView(), e.g. in shadow
+     * passes. */
+    bool IsNodeOccluded(uint32_t nodeIdx);
+    /* Call at the end of the frame. */
+    void ResetOcclusionViews();
+    void OcclusionDebugGUI();
+}
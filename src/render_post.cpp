@@ -0,0 +1,367 @@
+#include "render_post.h"
+#include "render_internal.h"
+#include "render_dynres.h"
+#include "render_deferred.h"
+#include "player.h"
+#include "shader.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <math.h>
+
+// Number of jitter offsets TAA cycles through
+static constexpr int cJitterPhases = 8;
+
+struct TemporalView {
+    // Without the jitter
+    glm::mat4 mViewProj = glm::mat4(1.0f);
+    glm::mat4 mPrevViewProj = glm::mat4(1.0f);
+    glm::vec2 mJitter = glm::vec2(0.0f);
+    int mViewport[4] = {};
+    // Where the view was in the history, which moves with the resolution
+    // scale.
+    int mPrevViewport[4] = {};
+    bool mDrawn = false;
+    // The view was drawn last frame, so the history has it.
+    bool mHasHistory = false;
+};
+
+static ShaderProg resolveShader;
+static ShaderProg fxaaShader;
+static ShaderProg taaShader;
+// Bilinear sampler for the passes that read between texels.
+static unsigned int linearSampler = 0;
+static unsigned int sceneColourFormat = GL_R11F_G11F_B10F;
+static Render::AAMode aaMode = Render::AA_MSAA_4;
+static int tonemapper = Render::TONEMAP_ACES;
+static float exposure = -1.0f;
+
+static TemporalView temporalViews[MAX_PLAYERS];
+// Index of the history target written this frame
+static int historyWrite = 0;
+static int jitterPhase = 0;
+// How much of the history is kept each frame
+static float taaHistoryWeight = 0.9f;
+
+struct SceneColourFormat {
+    unsigned int mFormat;
+    const char *mName;
+    // Bytes per sample
+    int mBytes;
+};
+
+static constexpr SceneColourFormat cSceneColourFormats[] = {
+    {GL_R11F_G11F_B10F, "R11F_G11F_B10F", 4},
+    {GL_RGBA16F,        "RGBA16F",        8},
+    {GL_RGB32F,         "RGB32F",         12}
+};
+
+
+void Render::LoadPostShaders()
+{
+    resolveShader = CreateShaderProgramFromFiles("shaders/v_screen.glsl",
+                                                 "shaders/f_resolve.glsl");
+    glUseProgram(resolveShader.id);
+    resolveShader.SetInt("sceneSamples"_u, 0);
+    fxaaShader = CreateShaderProgramFromFiles("shaders/v_screen.glsl",
+                                              "shaders/f_fxaa.glsl");
+    glUseProgram(fxaaShader.id);
+    fxaaShader.SetInt("screenTexture"_u, 0);
+    taaShader = CreateShaderProgramFromFiles("shaders/v_screen.glsl",
+                                             "shaders/f_taa.glsl");
+    glUseProgram(taaShader.id);
+    taaShader.SetInt("currentColour"_u, 0);
+    taaShader.SetInt("currentDepth"_u, 1);
+    taaShader.SetInt("history"_u, 2);
+    glUseProgram(0);
+
+    if (linearSampler == 0) {
+        glGenSamplers(1, &linearSampler);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    GLERR;
+}
+
+
+unsigned int Render::GetSceneColourFormat()     { return sceneColourFormat; }
+
+
+void Render::SetSceneColourFormat(unsigned int format)
+{
+    if (format == sceneColourFormat) return;
+    sceneColourFormat = format;
+    RebuildScreenTargets();
+}
+
+
+Render::AAMode Render::GetAAMode()              { return aaMode; }
+
+
+void Render::SetAAMode(AAMode mode)
+{
+    if (mode == aaMode) return;
+    aaMode = mode;
+    jitterPhase = 0;
+    RebuildScreenTargets();
+}
+
+
+int Render::GetSceneSamples()
+{
+    // The G-buffer isn't multisampled, see render_deferred.h.
+    if (GetRenderPath() == RENDER_PATH_DEFERRED) return 0;
+    switch (aaMode) {
+        case AA_MSAA_2: return 2;
+        case AA_MSAA_4: return 4;
+        case AA_MSAA_8: return 8;
+        default:        return 0;
+    }
+}
+
+
+const RenderTarget& Render::GetSceneDrawTarget()
+{
+    return sceneMSTarget.mFBO != 0 ? sceneMSTarget : sceneTarget;
+}
+
+
+static float Halton(int index, int base)
+{
+    float result = 0.0f;
+    float fraction = 1.0f;
+    while (index > 0) {
+        fraction /= base;
+        result += fraction * (index % base);
+        index /= base;
+    }
+    return result;
+}
+
+
+glm::vec2 Render::GetViewJitter()
+{
+    if (aaMode != AA_TAA) return glm::vec2(0.0f);
+    // Skip index 0, which is (0, 0) for every base.
+    int index = jitterPhase + 1;
+    return glm::vec2(Halton(index, 2), Halton(index, 3)) - 0.5f;
+}
+
+
+void Render::SetTemporalView(int viewIdx, const glm::mat4 &viewProj,
+                             glm::vec2 jitter, const int viewport[4])
+{
+    if (viewIdx < 0 || viewIdx >= MAX_PLAYERS) return;
+    TemporalView &view = temporalViews[viewIdx];
+    for (int i = 0; i < 4; i++) {
+        view.mViewport[i] = viewport[i];
+    }
+    view.mViewProj = viewProj;
+    view.mJitter = jitter;
+    view.mDrawn = true;
+}
+
+
+void Render::ResetTemporalHistory()
+{
+    for (TemporalView &view : temporalViews) {
+        view.mHasHistory = false;
+    }
+}
+
+
+/* Resolves the bottom left width x height of the multisampled ms onto
+ * resolved with the tonemapping aware weights. Leaves resolved bound as the
+ * framebuffer. */
+static void ResolveScene(const RenderTarget &ms, const RenderTarget &resolved,
+                         int width, int height)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, resolved.mFBO);
+    glViewport(0, 0, width, height);
+
+    glUseProgram(resolveShader.id);
+    resolveShader.SetInt("numSamples"_u, SDL_max(ms.mSamples, 1));
+    resolveShader.SetFloat("exposureScale"_u, exp2f(exposure));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, ms.mColourTex);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    GLERR;
+}
+
+
+/* Blends the views of scene with the history onto the other history target,
+ * and returns that target. */
+static const RenderTarget& TemporalResolve(const RenderTarget &scene)
+{
+    const RenderTarget &history = taaHistoryTargets[1 - historyWrite];
+    const RenderTarget &output = taaHistoryTargets[historyWrite];
+    glBindFramebuffer(GL_FRAMEBUFFER, output.mFBO);
+
+    glUseProgram(taaShader.id);
+    taaShader.SetFloat("exposureScale"_u, exp2f(exposure));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scene.mColourTex);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, scene.mDepthTex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, history.mColourTex);
+    glBindSampler(2, linearSampler);
+
+    for (TemporalView &view : temporalViews) {
+        if (!view.mDrawn) continue;
+        const int *vp = view.mViewport;
+        glViewport(vp[0], vp[1], vp[2], vp[3]);
+        // The depth is from the jittered projection, so the jitter is taken
+        // off before going back to world space.
+        glm::mat4 unjitter = glm::translate(glm::mat4(1.0f),
+                                            glm::vec3(-view.mJitter, 0.0f));
+        glm::mat4 reprojection = view.mPrevViewProj * glm::inverse(view.mViewProj)
+                               * unjitter;
+        taaShader.SetMat4fv("reprojection"_u, glm::value_ptr(reprojection));
+        const int *prev = view.mPrevViewport;
+        taaShader.SetVec4("viewRect"_u, vp[0], vp[1], vp[2], vp[3]);
+        taaShader.SetVec4("prevViewRect"_u, prev[0], prev[1], prev[2], prev[3]);
+        taaShader.SetFloat("historyWeight"_u, view.mHasHistory ? taaHistoryWeight : 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+
+    glBindSampler(2, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    GLERR;
+    return output;
+}
+
+
+/* Draws the bottom left uvScale of the colour of scene over the whole
+ * bound framebuffer with exposure, tonemapping and gamma correction. */
+static void Tonemap(const RenderTarget &scene, glm::vec2 uvScale)
+{
+    glUseProgram(screenShader.id);
+    screenShader.SetFloat("exposure"_u, exposure);
+    screenShader.SetInt("tonemapper"_u, tonemapper);
+    screenShader.SetVec2("uvScale"_u, uvScale.x, uvScale.y);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scene.mColourTex);
+    // Upsamples when the resolution is scaled down.
+    glBindSampler(0, linearSampler);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindSampler(0, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    GLERR;
+}
+
+
+void Render::PostProcessScene()
+{
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    glBindVertexArray(quadVAO);
+
+    // Part of the scene targets that the views were drawn into
+    float scale = GetResolutionScale();
+    int sceneWidth = SDL_min((int)ceilf(screenWidth * scale), sceneTarget.mWidth);
+    int sceneHeight = SDL_min((int)ceilf(screenHeight * scale), sceneTarget.mHeight);
+    glm::vec2 uvScale = glm::vec2(screenWidth, screenHeight) * scale
+                      / glm::vec2(SDL_max(sceneTarget.mWidth, 1),
+                                  SDL_max(sceneTarget.mHeight, 1));
+
+    const RenderTarget *scene = &sceneTarget;
+    if (sceneMSTarget.mFBO != 0) {
+        ResolveScene(sceneMSTarget, sceneTarget, sceneWidth, sceneHeight);
+    }
+    if (aaMode == AA_TAA) {
+        scene = &TemporalResolve(sceneTarget);
+    }
+
+    glViewport(0, 0, screenWidth, screenHeight);
+    if (aaMode == AA_FXAA) {
+        // FXAA works on the final colours, so tonemap first.
+        RenderTarget *ldr = AcquireTransientTarget(screenWidth, screenHeight,
+                                                   GL_RGBA8);
+        glBindFramebuffer(GL_FRAMEBUFFER, ldr->mFBO);
+        Tonemap(*scene, uvScale);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glUseProgram(fxaaShader.id);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, ldr->mColourTex);
+        glBindSampler(0, linearSampler);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindSampler(0, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        ReleaseTransientTarget(ldr);
+    }
+    else {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        Tonemap(*scene, uvScale);
+    }
+    glEnable(GL_BLEND);
+
+    // Next frame
+    for (TemporalView &view : temporalViews) {
+        view.mHasHistory = view.mDrawn && aaMode == AA_TAA;
+        view.mPrevViewProj = view.mViewProj;
+        for (int i = 0; i < 4; i++) {
+            view.mPrevViewport[i] = view.mViewport[i];
+        }
+        view.mDrawn = false;
+    }
+    historyWrite = 1 - historyWrite;
+    jitterPhase = (jitterPhase + 1) % cJitterPhases;
+    GLERR;
+}
+
+
+void Render::PostDebugGUI()
+{
+    int formatIdx = 0;
+    const char *formatNames[IM_ARRAYSIZE(cSceneColourFormats)];
+    for (int i = 0; i < IM_ARRAYSIZE(cSceneColourFormats); i++) {
+        formatNames[i] = cSceneColourFormats[i].mName;
+        if (cSceneColourFormats[i].mFormat == sceneColourFormat) {
+            formatIdx = i;
+        }
+    }
+    if (ImGui::Combo("Scene colour format", &formatIdx, formatNames,
+                     IM_ARRAYSIZE(formatNames))) {
+        SetSceneColourFormat(cSceneColourFormats[formatIdx].mFormat);
+    }
+    // The multisampled target is written once and read by the resolve, and
+    // the resolved target is written by the resolve and read by the
+    // tonemapping. Blending and overdraw come on top of this.
+    size_t pixels = (size_t)sceneTarget.mWidth * sceneTarget.mHeight;
+    int samples = sceneMSTarget.mFBO != 0 ? sceneMSTarget.mSamples : 0;
+    int bytes = cSceneColourFormats[formatIdx].mBytes;
+    double traffic = 2.0 * pixels * bytes * (samples + 1);
+    ImGui::Text("    Scene colour traffic: %.1f MB per frame",
+                traffic / (1024.0 * 1024.0));
+
+    const char *aaModes[NUM_AA_MODES] = {
+        "Off", "MSAA 2x", "MSAA 4x", "MSAA 8x", "FXAA", "TAA"
+    };
+    int mode = aaMode;
+    if (ImGui::Combo("Anti-aliasing", &mode, aaModes, NUM_AA_MODES)) {
+        SetAAMode((AAMode)mode);
+    }
+    if (aaMode == AA_TAA) {
+        ImGui::SliderFloat("TAA history weight", &taaHistoryWeight, 0.5f, 0.98f);
+    }
+
+    const char *tonemappers[NUM_TONEMAPPERS] = {"Linear", "Reinhard", "ACES"};
+    ImGui::Combo("Tonemapper", &tonemapper, tonemappers, NUM_TONEMAPPERS);
+    ImGui::SliderFloat("Exposure", &exposure, -4.0f, 4.0f);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Forward declarations
+struct RenderTarget;
+
+/*
+ * Resolve and tonemapping of the HDR scene. The scene is drawn into a
+ * multisampled target in the scene colour format, resolved by a shader into
+ * sceneTarget, and then tonemapped onto the screen.
+ *
+ * The resolve weights each sample by 1 / (1 + luminance) of its exposed
+ * colour, so that a very bright sample on an edge doesn't take over the whole
+ * pixel after tonemapping, which a plain average (or a blit) does.
+ *
+ * The colour format trades precision for bandwidth:
+ *  - GL_R11F_G11F_B10F: 4 bytes, no sign and no alpha
+ *  - GL_RGBA16F:        8 bytes
+ *  - GL_RGB32F:         12 bytes (often padded to 16 by the driver)
+ *
+ * Anti-aliasing is one of:
+ *  - MSAA: the scene is drawn into sceneMSTarget with 2, 4 or 8 samples and
+ *    resolved as above.
+ *  - FXAA: the scene is drawn straight into sceneTarget, tonemapped into a
+ *    transient LDR target and filtered onto the screen.
+ *  - TAA: the projection of every view is moved by a different subpixel
+ *    offset each frame. The scene is drawn straight into sceneTarget and
+ *    blended with the last frame's result, which is found by reprojecting
+ *    with the depth and the camera of each view. The history is clamped to
+ *    the colours around the pixel so that moving objects don't leave trails.
+ *    One frame of history is kept in taaHistoryTargets.
+ * Without MSAA, sceneMSTarget isn't created at all.
+ *
+ * With dynamic resolution (see render_dynres.h) the views only cover the
+ * bottom left of the scene targets, and the tonemapping scales them up to the
+ * screen with bilinear filtering.
+ */
+
+namespace Render {
+    enum Tonemapper {
+        TONEMAP_LINEAR = 0,
+        TONEMAP_REINHARD = 1,
+        TONEMAP_ACES = 2,
+        NUM_TONEMAPPERS
+    };
+
+    enum AAMode {
+        AA_OFF = 0,
+        AA_MSAA_2,
+        AA_MSAA_4,
+        AA_MSAA_8,
+        AA_FXAA,
+        AA_TAA,
+        NUM_AA_MODES
+    };
+
+    void LoadPostShaders();
+    /* GL internal format of the scene colour targets. */
+    unsigned int GetSceneColourFormat();
+    /* Rebuilds the screen targets if the format changed. */
+    void SetSceneColourFormat(unsigned int format);
+    AAMode GetAAMode();
+    /* Rebuilds the screen targets if the mode changed. */
+    void SetAAMode(AAMode mode);
+    /* MSAA samples of sceneMSTarget for the AA mode, 0 without MSAA or with
+     * the deferred renderer. */
+    int GetSceneSamples();
+    /* Target the views are drawn into, sceneMSTarget or sceneTarget. */
+    const RenderTarget& GetSceneDrawTarget();
+    /* Subpixel offset in pixels for this frame's projections. 0 unless TAA
+     * is on. */
+    glm::vec2 GetViewJitter();
+    /* Remembers a view drawn this frame for TAA. viewProj is without the
+     * jitter, jitter is in NDC and viewport is x, y, width, height in
+     * pixels. */
+    void SetTemporalView(int viewIdx, const glm::mat4 &viewProj, glm::vec2 jitter,
+                         const int viewport[4]);
+    /* Forgets the TAA history, e.g. after the targets are rebuilt. */
+    void ResetTemporalHistory();
+    /* Resolve, anti-aliasing and tonemapping of the scene onto the default
+     * framebuffer. Call once per frame after every view is drawn. */
+    void PostProcessScene();
+    void PostDebugGUI();
+}
@@ -0,0 +1,937 @@
+#include "render_queue.h"
+#include "render_shaders.h"
+#include "render_defines.h"
+#include "render_cull.h"
+#include "render_occlusion.h"
+#include "model.h"
+#include "shader.h"
+#include "glerr.h"
+#include "gl_ext.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <unordered_map>
+#include <string.h>
+#include <stddef.h>
+
+// Stats for the current frame and the last finished frame.
+static Render::QueueStats stats[Render::NUM_QUEUE_PASSES];
+static Render::QueueStats lastStats[Render::NUM_QUEUE_PASSES];
+
+// Visibility of each node for the current draw call. 0 is untested, 1 is
+// visible, 2 is outside of the frustum and 3 is occluded.
+static std::vector<uint8_t> nodeVisibility;
+// Per node input of the GPU cull shader, non-zero for occluded nodes
+static std::vector<uint32_t> occludedNodes;
+
+// Per instance data of instanced draws. Must match the instance attributes in
+// vertex.glsl and v_simple_depth.glsl.
+struct InstanceData {
+    glm::mat4 mTransform;
+    glm::vec4 mPaint;
+};
+
+/* A run of visible packets with the same mesh. Without multi draw indirect,
+ * each batch is one draw call and single packets set the model uniform
+ * instead of using the instance buffer. With it, every batch is one command
+ * in indirectCommands and runs of batches with the same state are drawn
+ * with one call. */
+struct DrawBatch {
+    const Render::DrawPacket *mPacket;
+    uint32_t mCount;
+    int mLOD;
+    // Offset into the instance buffer of the first instance in bytes
+    size_t mInstanceOffset;
+};
+
+static unsigned int instanceVBO = 0;
+static unsigned int indirectBuffer = 0;
+// Scratch buffers reused for every draw call
+static std::vector<const Render::DrawPacket*> visiblePackets;
+// LOD of each packet in visiblePackets
+static std::vector<uint8_t> visibleLODs;
+static std::vector<DrawBatch> batches;
+static std::vector<InstanceData> instances;
+// One command per batch, only filled in when multiDrawIndirect is used
+static std::vector<DrawElementsIndirectCommand> indirectCommands;
+
+// Can be turned off in the debug GUI to compare with the fallback path.
+static bool multiDrawIndirect = true;
+
+// A mesh is drawn at LOD i when its height on screen, as a fraction of the
+// view's height, is below lodThresholds[i]. lodThresholds[0] is unused.
+static float lodThresholds[MAX_MESH_LODS] = {1.0f, 0.25f, 0.1f, 0.04f};
+// How far past a threshold a mesh has to go before it changes LOD, as a
+// fraction of the threshold.
+static float lodHysteresis = 0.15f;
+// Levels added in shadow passes, where the lost detail is hard to see.
+static int shadowLODBias = 1;
+// LOD of each packet in each pass of this frame ([0]) and the last one
+// ([1]), for the hysteresis. Keyed by the pass number in the frame, the
+// node and the mesh, which stay the same as long as the same things are
+// submitted in the same order. If they change it just starts over.
+static std::unordered_map<uint64_t, uint8_t> lodHistory[2];
+static uint32_t lodPass = 0;
+
+/* A run of draws in the GPU culling command buffer that share all state and
+ * are drawn with one glMultiDrawElementsIndirect. */
+struct CullRun {
+    uint32_t mFirst;
+    uint32_t mCount;
+    const Render::DrawPacket *mPacket;
+};
+
+// GPU culling input for the opaque bucket of cullQueue. The draws are in
+// opaque order followed by depth order, and both use the instances in
+// cullInstanceVBO, which are in opaque order. Kept apart from instanceVBO,
+// which is rewritten by every CPU culled draw call.
+static const Render::RenderQueue *cullQueue = nullptr;
+static uint32_t cullQueueVersion = 0;
+static unsigned int cullInstanceVBO = 0;
+static std::vector<Render::CullDraw> cullDraws;
+static std::vector<CullRun> cullViewRuns;
+static std::vector<CullRun> cullDepthRuns;
+
+
+// Opaque key: shader features in the top 8 bits, then the low 24 bits of the
+// material id, then the geometry pool block, then the mesh id, so that
+// program changes are the rarest state change and material changes the next
+// rarest. Meshes in the same block share a VAO.
+static uint64_t MaterialKey(const Render::DrawPacket &packet)
+{
+    return ((uint64_t)packet.mFeatures << 56)
+         | ((uint64_t)(packet.mMaterial->mId & 0xFFFFFF) << 32)
+         | ((uint64_t)(packet.mMesh->mGeometry.mBlock & 0xFF) << 24)
+         | (packet.mMesh->mId & 0xFFFFFF);
+}
+
+
+static bool UseMultiDrawIndirect()
+{
+    return multiDrawIndirect && GLEXT_ARB_multi_draw_indirect;
+}
+
+
+static void ResetNodeVisibility(const Render::RenderQueue &queue)
+{
+    nodeVisibility.assign(queue.mNodeBounds.size(), 0);
+}
+
+
+/* Tests the packet's node first so that a whole node outside of the frustum
+ * or occluded only costs one test. Updates the cull stats of pass. */
+static bool IsPacketVisible(const Render::RenderQueue &queue,
+                            const Render::DrawPacket &packet,
+                            const Frustum *frustum, Render::QueueStats &passStats)
+{
+    if (frustum == nullptr) return true;
+
+    uint8_t &nodeVis = nodeVisibility[packet.mNodeIdx];
+    if (nodeVis == 0) {
+        nodeVis = frustum->Intersects(queue.mNodeBounds[packet.mNodeIdx]) ? 1 : 2;
+        if (nodeVis == 1 && Render::IsNodeOccluded(packet.mNodeIdx)) {
+            nodeVis = 3;
+        }
+    }
+    if (nodeVis == 3) {
+        passStats.mOccluded++;
+    }
+    if (nodeVis != 1 || !frustum->Intersects(packet.mBounds)) {
+        passStats.mCulled++;
+        passStats.mVerticesCulled += packet.mMesh->vertices.size();
+        return false;
+    }
+    return true;
+}
+
+
+/* Height of bounds on screen as a fraction of the view's height. Works for
+ * perspective and orthographic matrices: w is the view depth for
+ * perspective and 1 for orthographic. */
+static float ProjectedSize(const AABB &bounds, const glm::mat4 &viewProj)
+{
+    glm::vec4 clip = viewProj * glm::vec4(bounds.Centre(), 1.0f);
+    // Clip space y per world unit, the same in every direction for a
+    // rigid view matrix.
+    float scaleY = glm::length(glm::vec3(viewProj[0][1], viewProj[1][1], viewProj[2][1]));
+    float radius = glm::length(bounds.Extents());
+    // NDC is 2 high, so the diameter over 2 is the fraction of the height.
+    return radius * scaleY / SDL_max(clip.w, 0.001f);
+}
+
+
+/* Picks the LOD of a packet for a pass. Meshes are only moved to another
+ * level when they are lodHysteresis past the threshold. */
+static int SelectLOD(const Render::DrawPacket &packet, const Render::LODView *view,
+                     uint32_t pass)
+{
+    const Mesh &mesh = *packet.mMesh;
+    int numLODs = mesh.mLODs.size();
+    if (view == nullptr || numLODs == 1) return 0;
+
+    float size = ProjectedSize(packet.mBounds, view->mViewProj);
+    uint64_t key = ((uint64_t)pass << 56) | ((uint64_t)packet.mNodeIdx << 24)
+                 | (mesh.mId & 0xFFFFFF);
+    int level = 0;
+    float coarser = 1.0f;
+    float finer = 1.0f;
+    auto last = lodHistory[1].find(key);
+    if (last != lodHistory[1].end()) {
+        level = SDL_min((int)last->second, numLODs - 1);
+        coarser = 1.0f - lodHysteresis;
+        finer = 1.0f + lodHysteresis;
+    }
+    while (level + 1 < numLODs && size < lodThresholds[level + 1] * coarser) {
+        level++;
+    }
+    while (level > 0 && size > lodThresholds[level] * finer) {
+        level--;
+    }
+    lodHistory[0][key] = level;
+
+    if (view->mShadowPass) {
+        level = SDL_min(level + shadowLODBias, numLODs - 1);
+    }
+    return level;
+}
+
+
+/* Splits visiblePackets into batches of packets with the same mesh and LOD,
+ * and the same material if matchMaterial is true. The instances of every batch with
+ * more than one packet are uploaded to instanceVBO in one go. If indirect is
+ * true every batch is uploaded as instances, and a draw command for each
+ * batch is uploaded to indirectBuffer. */
+static void BuildBatches(bool matchMaterial, bool indirect)
+{
+    batches.clear();
+    instances.clear();
+    indirectCommands.clear();
+    for (size_t i = 0; i < visiblePackets.size();) {
+        const Render::DrawPacket *first = visiblePackets[i];
+        size_t end = i + 1;
+        while (end < visiblePackets.size()
+                && visiblePackets[end]->mMesh == first->mMesh
+                && visibleLODs[end] == visibleLODs[i]
+                && (!matchMaterial
+                    || (visiblePackets[end]->mMaterial == first->mMaterial
+                        && visiblePackets[end]->mFeatures == first->mFeatures))) {
+            end++;
+        }
+
+        DrawBatch batch;
+        batch.mPacket = first;
+        batch.mCount = end - i;
+        batch.mLOD = visibleLODs[i];
+        batch.mInstanceOffset = instances.size() * sizeof(InstanceData);
+        if (indirect) {
+            // baseInstance offsets the instance attribute fetch, so every
+            // command can read its own instances from one binding.
+            const Mesh &mesh = *first->mMesh;
+            DrawElementsIndirectCommand command;
+            command.count = mesh.GetNumIndices(batch.mLOD);
+            command.instanceCount = batch.mCount;
+            command.firstIndex = mesh.GetFirstIndex(batch.mLOD);
+            command.baseVertex = mesh.mGeometry.mBaseVertex;
+            command.baseInstance = instances.size();
+            indirectCommands.push_back(command);
+        }
+        if (batch.mCount > 1 || indirect) {
+            for (size_t j = i; j < end; j++) {
+                instances.push_back({visiblePackets[j]->mTransform,
+                                     visiblePackets[j]->mPaint});
+            }
+        }
+        batches.push_back(batch);
+        i = end;
+    }
+
+    if (!indirectCommands.empty()) {
+        if (indirectBuffer == 0) {
+            glGenBuffers(1, &indirectBuffer);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        size_t size = indirectCommands.size() * sizeof(DrawElementsIndirectCommand);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, indirectCommands.data());
+        // Left bound for the glMultiDrawElementsIndirect calls.
+    }
+
+    if (instances.empty()) return;
+    if (instanceVBO == 0) {
+        glGenBuffers(1, &instanceVBO);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    // Orphan the old data, which may still be in use by earlier draws.
+    size_t size = instances.size() * sizeof(InstanceData);
+    glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/* Points the instance attributes of the bound VAO at a batch's instances. */
+static void BindInstanceAttributes(size_t offset, unsigned int buffer = instanceVBO)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (int i = 0; i < 4; i++) {
+        unsigned int loc = INSTANCE_ATTRIB_MODEL + i;
+        glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (void*)(offset + offsetof(InstanceData, mTransform) + i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(loc, 1);
+        glEnableVertexAttribArray(loc);
+    }
+    glVertexAttribPointer(INSTANCE_ATTRIB_PAINT, 4, GL_FLOAT, GL_FALSE,
+            sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, mPaint)));
+    glVertexAttribDivisor(INSTANCE_ATTRIB_PAINT, 1);
+    glEnableVertexAttribArray(INSTANCE_ATTRIB_PAINT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/* The instance attributes are part of the VAO, so they are turned off again
+ * after an instanced draw. Otherwise a later single draw with the same VAO
+ * would still fetch from the instance buffer at an offset that may no longer
+ * be inside it. */
+static void UnbindInstanceAttributes()
+{
+    for (int i = 0; i < 4; i++) {
+        glDisableVertexAttribArray(INSTANCE_ATTRIB_MODEL + i);
+    }
+    glDisableVertexAttribArray(INSTANCE_ATTRIB_PAINT);
+}
+
+
+void Render::RenderQueue::Clear()
+{
+    mVersion++;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        mPackets[i].clear();
+    }
+    mDepthOrder.clear();
+    mNodeBounds.clear();
+}
+
+
+void Render::RenderQueue::Clear(RenderBucket bucket)
+{
+    mPackets[bucket].clear();
+    if (bucket == BUCKET_OPAQUE) {
+        mVersion++;
+        mDepthOrder.clear();
+    }
+}
+
+
+void Render::RenderQueue::SubmitModel(const Model &model,
+                                      const glm::mat4 &transform,
+                                      RenderBucket bucket,
+                                      const Material *materialOverride,
+                                      int paintMaterialIdx,
+                                      glm::vec3 paintColour)
+{
+    std::vector<DrawPacket> &packets = mPackets[bucket];
+    for (const std::unique_ptr<ModelNode> &node : model.nodes) {
+        glm::mat4 nodeTrans = transform * node->mTransform;
+        uint32_t nodeIdx = mNodeBounds.size();
+        mNodeBounds.push_back(node->mBounds.Transformed(transform));
+        for (int meshIdx : node->mMeshes) {
+            const Mesh *mesh = model.meshes[meshIdx].get();
+            DrawPacket packet;
+            packet.mKey = 0;
+            packet.mMesh = mesh;
+            packet.mMaterial = materialOverride ? materialOverride
+                             : model.materials[mesh->materialIdx].get();
+            packet.mTransform = nodeTrans;
+            packet.mBounds = mesh->mBounds.Transformed(nodeTrans);
+            packet.mNodeIdx = nodeIdx;
+            packet.mFeatures = GetMaterialShaderFeatures(
+                    *packet.mMaterial, bucket == BUCKET_TRANSPARENT);
+            bool painted = (int)mesh->materialIdx == paintMaterialIdx;
+            packet.mPaint = glm::vec4(paintColour, painted ? 1.0f : 0.0f);
+            packet.mStatic = mSubmitStatic;
+            packets.push_back(packet);
+        }
+    }
+}
+
+
+void Render::RenderQueue::SortOpaque()
+{
+    mVersion++;
+    std::vector<DrawPacket> &opaque = mPackets[BUCKET_OPAQUE];
+    for (DrawPacket &packet : opaque) {
+        packet.mKey = MaterialKey(packet);
+    }
+    std::sort(opaque.begin(), opaque.end(),
+              [](const DrawPacket &a, const DrawPacket &b) {
+                  return a.mKey < b.mKey;
+              });
+
+    // The depth only pass ignores materials, so only the position only VAO
+    // matters.
+    mDepthOrder.resize(opaque.size());
+    for (size_t i = 0; i < opaque.size(); i++) {
+        mDepthOrder[i] = i;
+    }
+    std::stable_sort(mDepthOrder.begin(), mDepthOrder.end(),
+                     [&opaque](uint32_t a, uint32_t b) {
+                         const Mesh *meshA = opaque[a].mMesh;
+                         const Mesh *meshB = opaque[b].mMesh;
+                         if (meshA->depthVao != meshB->depthVao) {
+                             return meshA->depthVao < meshB->depthVao;
+                         }
+                         return meshA->mId < meshB->mId;
+                     });
+}
+
+
+void Render::RenderQueue::SortTransparent(glm::vec3 camPos)
+{
+    // Transparent packets are drawn back to front. The key is the distance
+    // to the camera, flipped so that an ascending sort puts far ones first.
+    std::vector<DrawPacket> &transparent = mPackets[BUCKET_TRANSPARENT];
+    for (DrawPacket &packet : transparent) {
+        glm::vec3 pos = glm::vec3(packet.mTransform[3]);
+        float dist = glm::length(pos - camPos);
+        uint32_t distBits;
+        memcpy(&distBits, &dist, sizeof(distBits));
+        // Positive floats sort the same as their bits.
+        packet.mKey = ~(uint64_t)distBits;
+    }
+    std::sort(transparent.begin(), transparent.end(),
+              [](const DrawPacket &a, const DrawPacket &b) {
+                  return a.mKey < b.mKey;
+              });
+}
+
+
+static Render::CullDraw MakeCullDraw(const Render::DrawPacket &packet,
+                                     uint32_t instance)
+{
+    const Mesh &mesh = *packet.mMesh;
+    Render::CullDraw draw = {};
+    draw.mSphere = glm::vec4(packet.mBounds.Centre(),
+                             glm::length(packet.mBounds.Extents()));
+    draw.mCommand.count = mesh.GetNumIndices();
+    draw.mCommand.instanceCount = 1;
+    draw.mCommand.firstIndex = mesh.GetFirstIndex();
+    draw.mCommand.baseVertex = mesh.mGeometry.mBaseVertex;
+    draw.mCommand.baseInstance = instance;
+    draw.mNumLODs = mesh.mLODs.size();
+    draw.mNode = packet.mNodeIdx;
+    draw.mStatic = packet.mStatic;
+    for (size_t i = 0; i < mesh.mLODs.size(); i++) {
+        draw.mLODs[i] = glm::uvec2(mesh.GetFirstIndex(i), mesh.GetNumIndices(i));
+    }
+    return draw;
+}
+
+
+/* Uploads the opaque bucket of queue for GPU culling, unless it's the same
+ * as last time. The opaque bucket only changes once per frame, so this only
+ * does any work in the first pass of the frame. */
+static void PrepareGPUCulling(const Render::RenderQueue &queue)
+{
+    using namespace Render;
+    if (&queue == cullQueue && queue.mVersion == cullQueueVersion) return;
+    cullQueue = &queue;
+    cullQueueVersion = queue.mVersion;
+
+    const std::vector<DrawPacket> &opaque = queue.mPackets[BUCKET_OPAQUE];
+    instances.clear();
+    cullDraws.clear();
+    cullViewRuns.clear();
+    cullDepthRuns.clear();
+    for (size_t i = 0; i < opaque.size(); i++) {
+        const DrawPacket &packet = opaque[i];
+        instances.push_back({packet.mTransform, packet.mPaint});
+        cullDraws.push_back(MakeCullDraw(packet, i));
+        const DrawPacket *runPacket = cullViewRuns.empty() ? nullptr
+                                    : cullViewRuns.back().mPacket;
+        if (runPacket != nullptr && runPacket->mFeatures == packet.mFeatures
+                && runPacket->mMaterial == packet.mMaterial
+                && runPacket->mMesh->vao == packet.mMesh->vao) {
+            cullViewRuns.back().mCount++;
+        } else {
+            cullViewRuns.push_back({(uint32_t)i, 1, &packet});
+        }
+    }
+    for (uint32_t idx : queue.mDepthOrder) {
+        const DrawPacket &packet = opaque[idx];
+        uint32_t drawIdx = cullDraws.size();
+        cullDraws.push_back(MakeCullDraw(packet, idx));
+        if (!cullDepthRuns.empty() && cullDepthRuns.back().mPacket->mMesh->depthVao
+                                      == packet.mMesh->depthVao) {
+            cullDepthRuns.back().mCount++;
+        } else {
+            cullDepthRuns.push_back({drawIdx, 1, &packet});
+        }
+    }
+
+    if (cullInstanceVBO == 0) {
+        glGenBuffers(1, &cullInstanceVBO);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, cullInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData),
+                 instances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    UploadCullDraws(cullDraws);
+    GLERR;
+}
+
+
+/* LOD settings for the cull shader. It has no history, so there is no
+ * hysteresis on the GPU. */
+static Render::CullLOD MakeCullLOD(const Render::LODView &view)
+{
+    static_assert(MAX_MESH_LODS == 4, "lodThresholds must fit in a vec4");
+    Render::CullLOD lod;
+    lod.mViewProj = view.mViewProj;
+    lod.mThresholds = glm::vec4(lodThresholds[0], lodThresholds[1],
+                                lodThresholds[2], lodThresholds[3]);
+    lod.mBias = view.mShadowPass ? shadowLODBias : 0;
+    return lod;
+}
+
+
+/* Occlusion is only known per view, so it is passed with every cull instead
+ * of being part of the draws. Returns null if no nodes are occluded. */
+static const std::vector<uint32_t>* GatherOccludedNodes(const Render::RenderQueue &queue)
+{
+    occludedNodes.resize(queue.mNodeBounds.size());
+    bool anyOccluded = false;
+    for (size_t i = 0; i < occludedNodes.size(); i++) {
+        occludedNodes[i] = Render::IsNodeOccluded(i);
+        anyOccluded |= occludedNodes[i] != 0;
+    }
+    return anyOccluded ? &occludedNodes : nullptr;
+}
+
+
+/* Draws the opaque bucket with the commands written by CullDraws(). Nothing
+ * is tested on the CPU, so the cull stats stay at 0. */
+static void DrawQueueGPUCulled(const Render::RenderQueue &queue,
+                               uint32_t viewFeatures, const Frustum *frustum,
+                               const Render::LODView *lod,
+                               Render::QueueStats &passStats)
+{
+    using namespace Render;
+    PrepareGPUCulling(queue);
+    uint32_t numDraws = queue.mPackets[BUCKET_OPAQUE].size();
+    CullLOD cullLOD;
+    if (lod != nullptr) {
+        cullLOD = MakeCullLOD(*lod);
+    }
+    CullDraws(frustum, lod ? &cullLOD : nullptr, GatherOccludedNodes(queue),
+              CASTERS_ALL, 0, numDraws);
+    passStats.mGPUCullDraws += numDraws;
+
+    const ShaderProg *shader = nullptr;
+    const Material *lastMaterial = nullptr;
+    unsigned int lastVAO = 0;
+    for (const CullRun &run : cullViewRuns) {
+        const DrawPacket &packet = *run.mPacket;
+        const ShaderProg &variant = GetPBRShader(viewFeatures | packet.mFeatures
+                                                 | SHADER_INSTANCED);
+        if (shader == nullptr || variant.id != shader->id) {
+            glUseProgram(variant.id);
+            lastMaterial = nullptr;
+            passStats.mProgramBinds++;
+        }
+        shader = &variant;
+        if (packet.mMaterial != lastMaterial) {
+            packet.mMaterial->Bind(*shader);
+            lastMaterial = packet.mMaterial;
+            passStats.mMaterialBinds++;
+        }
+        if (packet.mMesh->vao != lastVAO) {
+            if (lastVAO != 0) {
+                UnbindInstanceAttributes();
+            }
+            glBindVertexArray(packet.mMesh->vao);
+            BindInstanceAttributes(0, cullInstanceVBO);
+            lastVAO = packet.mMesh->vao;
+            passStats.mVAOBinds++;
+        }
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(run.mFirst * sizeof(DrawElementsIndirectCommand)),
+                run.mCount, 0);
+        passStats.mDraws++;
+        passStats.mInstances += run.mCount;
+    }
+    if (lastVAO != 0) {
+        UnbindInstanceAttributes();
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    GLERR;
+}
+
+
+static void DrawQueueDepthOnlyGPUCulled(const Render::RenderQueue &queue,
+                                        const ShaderProg &instancedShader,
+                                        const Frustum *frustum,
+                                        const Render::LODView *lod,
+                                        Render::ShadowCasters casters,
+                                        const std::vector<uint32_t> *occluded,
+                                        Render::QueueStats &passStats)
+{
+    using namespace Render;
+    PrepareGPUCulling(queue);
+    uint32_t numDraws = queue.mPackets[BUCKET_OPAQUE].size();
+    CullLOD cullLOD;
+    if (lod != nullptr) {
+        cullLOD = MakeCullLOD(*lod);
+    }
+    CullDraws(frustum, lod ? &cullLOD : nullptr, occluded, casters, numDraws, numDraws);
+    passStats.mGPUCullDraws += numDraws;
+
+    glUseProgram(instancedShader.id);
+    passStats.mProgramBinds++;
+    for (const CullRun &run : cullDepthRuns) {
+        glBindVertexArray(run.mPacket->mMesh->depthVao);
+        BindInstanceAttributes(0, cullInstanceVBO);
+        passStats.mVAOBinds++;
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(run.mFirst * sizeof(DrawElementsIndirectCommand)),
+                run.mCount, 0);
+        UnbindInstanceAttributes();
+        passStats.mDraws++;
+        passStats.mInstances += run.mCount;
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    GLERR;
+}
+
+
+/* Draws runs of batches that share a program, material and VAO with one
+ * glMultiDrawElementsIndirect each. Every packet reads its transform and
+ * paint from the instance attributes. */
+static void DrawBatchesIndirect(uint32_t viewFeatures, Render::QueueStats &passStats)
+{
+    using namespace Render;
+    const ShaderProg *shader = nullptr;
+    const Material *lastMaterial = nullptr;
+    unsigned int lastVAO = 0;
+    for (size_t i = 0; i < batches.size();) {
+        const DrawPacket &packet = *batches[i].mPacket;
+        size_t end = i + 1;
+        while (end < batches.size()
+                && batches[end].mPacket->mFeatures == packet.mFeatures
+                && batches[end].mPacket->mMaterial == packet.mMaterial
+                && batches[end].mPacket->mMesh->vao == packet.mMesh->vao) {
+            end++;
+        }
+
+        const ShaderProg &variant = GetPBRShader(viewFeatures | packet.mFeatures
+                                                 | SHADER_INSTANCED);
+        if (shader == nullptr || variant.id != shader->id) {
+            glUseProgram(variant.id);
+            lastMaterial = nullptr;
+            passStats.mProgramBinds++;
+        }
+        shader = &variant;
+        if (packet.mMaterial != lastMaterial) {
+            packet.mMaterial->Bind(*shader);
+            lastMaterial = packet.mMaterial;
+            passStats.mMaterialBinds++;
+        }
+        if (packet.mMesh->vao != lastVAO) {
+            if (lastVAO != 0) {
+                UnbindInstanceAttributes();
+            }
+            glBindVertexArray(packet.mMesh->vao);
+            BindInstanceAttributes(0);
+            lastVAO = packet.mMesh->vao;
+            passStats.mVAOBinds++;
+        }
+
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(i * sizeof(DrawElementsIndirectCommand)), end - i, 0);
+        for (size_t j = i; j < end; j++) {
+            passStats.mInstances += batches[j].mCount;
+            passStats.mVerticesDrawn += batches[j].mPacket->mMesh->vertices.size()
+                                      * batches[j].mCount;
+        }
+        passStats.mDraws++;
+        i = end;
+    }
+    if (lastVAO != 0) {
+        UnbindInstanceAttributes();
+    }
+}
+
+
+void Render::DrawQueue(const RenderQueue &queue, RenderBucket bucket,
+                       uint32_t viewFeatures, const Frustum *frustum,
+                       const LODView *lod)
+{
+    QueueStats &passStats = stats[QUEUE_PASS_VIEW];
+    uint32_t pass = lodPass++;
+    if (bucket == BUCKET_OPAQUE && UseGPUCulling()) {
+        DrawQueueGPUCulled(queue, viewFeatures, frustum, lod, passStats);
+        return;
+    }
+    ResetNodeVisibility(queue);
+    visiblePackets.clear();
+    visibleLODs.clear();
+    for (const DrawPacket &packet : queue.mPackets[bucket]) {
+        if (IsPacketVisible(queue, packet, frustum, passStats)) {
+            int level = SelectLOD(packet, lod, pass);
+            visiblePackets.push_back(&packet);
+            visibleLODs.push_back(level);
+            passStats.mLODPackets[level]++;
+        }
+    }
+    // Transparent packets must keep their back to front order, which would
+    // mostly give runs of one, so they are not worth the indirect path.
+    bool indirect = UseMultiDrawIndirect() && bucket == BUCKET_OPAQUE;
+    BuildBatches(true, indirect);
+
+    if (indirect) {
+        DrawBatchesIndirect(viewFeatures, passStats);
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        GLERR;
+        return;
+    }
+
+    const ShaderProg *shader = nullptr;
+    uint32_t lastFeatures = 0;
+    const Material *lastMaterial = nullptr;
+    // Paint uniform of the current program. Only used by single draws.
+    glm::vec4 lastPaint = glm::vec4(-1.0f);
+    unsigned int lastVAO = 0;
+    for (const DrawBatch &batch : batches) {
+        const DrawPacket &packet = *batch.mPacket;
+        const Mesh &mesh = *packet.mMesh;
+        bool instanced = batch.mCount > 1;
+        uint32_t features = viewFeatures | packet.mFeatures
+                          | (instanced ? SHADER_INSTANCED : 0);
+        if (shader == nullptr || features != lastFeatures) {
+            const ShaderProg &variant = GetPBRShader(features);
+            // Different features can give the same program.
+            if (shader == nullptr || variant.id != shader->id) {
+                glUseProgram(variant.id);
+                // Material uniforms belong to the program, so they have to
+                // be set again.
+                lastMaterial = nullptr;
+                lastPaint = glm::vec4(-1.0f);
+                passStats.mProgramBinds++;
+            }
+            shader = &variant;
+            lastFeatures = features;
+        }
+        if (packet.mMaterial != lastMaterial) {
+            packet.mMaterial->Bind(*shader);
+            lastMaterial = packet.mMaterial;
+            passStats.mMaterialBinds++;
+        }
+        if (mesh.vao != lastVAO) {
+            glBindVertexArray(mesh.vao);
+            lastVAO = mesh.vao;
+            passStats.mVAOBinds++;
+        }
+
+        if (instanced) {
+            BindInstanceAttributes(batch.mInstanceOffset);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.GetNumIndices(batch.mLOD),
+                    GL_UNSIGNED_INT, mesh.GetIndexOffset(batch.mLOD), batch.mCount,
+                    mesh.mGeometry.mBaseVertex);
+            UnbindInstanceAttributes();
+            passStats.mInstances += batch.mCount;
+        } else {
+            shader->SetMat4fv("model"_u, glm::value_ptr(packet.mTransform));
+            if (packet.mPaint != lastPaint) {
+                shader->SetVec4("paint"_u, glm::value_ptr(packet.mPaint));
+                lastPaint = packet.mPaint;
+            }
+            glDrawElementsBaseVertex(GL_TRIANGLES, mesh.GetNumIndices(batch.mLOD),
+                    GL_UNSIGNED_INT, mesh.GetIndexOffset(batch.mLOD),
+                    mesh.mGeometry.mBaseVertex);
+        }
+        passStats.mDraws++;
+        passStats.mVerticesDrawn += mesh.vertices.size() * batch.mCount;
+    }
+    glBindVertexArray(0);
+    GLERR;
+}
+
+
+/* Body of DrawQueueDepthOnly() and DrawQueueDepthPrePass(). pass is the
+ * LOD history to use. GPU culled draws only skip occluded nodes if
+ * useOcclusion is set, CPU culling always checks IsNodeOccluded(). */
+static void DrawDepthOnly(const Render::RenderQueue &queue, const ShaderProg &shader,
+                          const ShaderProg &instancedShader, const Frustum *frustum,
+                          const Render::LODView *lod, Render::ShadowCasters casters,
+                          uint32_t pass, bool useOcclusion,
+                          Render::QueueStats &passStats)
+{
+    using namespace Render;
+    if (UseGPUCulling()) {
+        const std::vector<uint32_t> *occluded = useOcclusion
+                                              ? GatherOccludedNodes(queue) : nullptr;
+        DrawQueueDepthOnlyGPUCulled(queue, instancedShader, frustum, lod, casters,
+                                    occluded, passStats);
+        return;
+    }
+    ResetNodeVisibility(queue);
+    const std::vector<DrawPacket> &opaque = queue.mPackets[BUCKET_OPAQUE];
+    visiblePackets.clear();
+    visibleLODs.clear();
+    for (uint32_t idx : queue.mDepthOrder) {
+        if (casters != CASTERS_ALL
+                && opaque[idx].mStatic != (casters == CASTERS_STATIC)) {
+            continue;
+        }
+        if (IsPacketVisible(queue, opaque[idx], frustum, passStats)) {
+            int level = SelectLOD(opaque[idx], lod, pass);
+            visiblePackets.push_back(&opaque[idx]);
+            visibleLODs.push_back(level);
+            passStats.mLODPackets[level]++;
+        }
+    }
+    bool indirect = UseMultiDrawIndirect();
+    BuildBatches(false, indirect);
+
+    if (indirect) {
+        // Nothing but the VAO changes, so each block is one call.
+        glUseProgram(instancedShader.id);
+        passStats.mProgramBinds++;
+        for (size_t i = 0; i < batches.size();) {
+            unsigned int vao = batches[i].mPacket->mMesh->depthVao;
+            size_t end = i + 1;
+            while (end < batches.size()
+                    && batches[end].mPacket->mMesh->depthVao == vao) {
+                end++;
+            }
+            glBindVertexArray(vao);
+            BindInstanceAttributes(0);
+            passStats.mVAOBinds++;
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                    (void*)(i * sizeof(DrawElementsIndirectCommand)), end - i, 0);
+            UnbindInstanceAttributes();
+            for (size_t j = i; j < end; j++) {
+                passStats.mInstances += batches[j].mCount;
+                passStats.mVerticesDrawn += batches[j].mPacket->mMesh->vertices.size()
+                                          * batches[j].mCount;
+            }
+            passStats.mDraws++;
+            i = end;
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        GLERR;
+        return;
+    }
+
+    unsigned int lastProgram = 0;
+    unsigned int lastVAO = 0;
+    for (const DrawBatch &batch : batches) {
+        const DrawPacket &packet = *batch.mPacket;
+        const Mesh &mesh = *packet.mMesh;
+        bool instanced = batch.mCount > 1;
+        const ShaderProg &program = instanced ? instancedShader : shader;
+        if (program.id != lastProgram) {
+            glUseProgram(program.id);
+            lastProgram = program.id;
+            passStats.mProgramBinds++;
+        }
+        if (mesh.depthVao != lastVAO) {
+            glBindVertexArray(mesh.depthVao);
+            lastVAO = mesh.depthVao;
+            passStats.mVAOBinds++;
+        }
+
+        if (instanced) {
+            BindInstanceAttributes(batch.mInstanceOffset);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.GetNumIndices(batch.mLOD),
+                    GL_UNSIGNED_INT, mesh.GetIndexOffset(batch.mLOD), batch.mCount,
+                    mesh.mGeometry.mBaseVertex);
+            UnbindInstanceAttributes();
+            passStats.mInstances += batch.mCount;
+        } else {
+            shader.SetMat4fv("model"_u, glm::value_ptr(packet.mTransform));
+            glDrawElementsBaseVertex(GL_TRIANGLES, mesh.GetNumIndices(batch.mLOD),
+                    GL_UNSIGNED_INT, mesh.GetIndexOffset(batch.mLOD),
+                    mesh.mGeometry.mBaseVertex);
+        }
+        passStats.mDraws++;
+        passStats.mVerticesDrawn += mesh.vertices.size() * batch.mCount;
+    }
+    glBindVertexArray(0);
+    GLERR;
+}
+
+
+void Render::DrawQueueDepthOnly(const RenderQueue &queue, const ShaderProg &shader,
+                                const ShaderProg &instancedShader,
+                                const Frustum *frustum, const LODView *lod,
+                                ShadowCasters casters)
+{
+    DrawDepthOnly(queue, shader, instancedShader, frustum, lod, casters,
+                  lodPass++, false, stats[QUEUE_PASS_SHADOW]);
+}
+
+
+void Render::DrawQueueDepthPrePass(const RenderQueue &queue, const ShaderProg &shader,
+                                   const ShaderProg &instancedShader,
+                                   const Frustum *frustum, const LODView *lod)
+{
+    // The colour pass takes the next LOD pass, so sharing it gives both the
+    // same history and the same LODs.
+    DrawDepthOnly(queue, shader, instancedShader, frustum, lod, CASTERS_ALL,
+                  lodPass, true, stats[QUEUE_PASS_PREPASS]);
+}
+
+
+const Render::QueueStats& Render::GetQueueStats(QueuePass pass)
+{
+    return lastStats[pass];
+}
+
+
+void Render::DestroyQueueBuffers()
+{
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteBuffers(1, &cullInstanceVBO);
+    instanceVBO = indirectBuffer = cullInstanceVBO = 0;
+    cullQueue = nullptr;
+}
+
+
+bool Render::GetMultiDrawIndirectSupported()    { return GLEXT_ARB_multi_draw_indirect; }
+bool Render::GetMultiDrawIndirectEnabled()      { return multiDrawIndirect; }
+void Render::SetMultiDrawIndirectEnabled(bool enabled)  { multiDrawIndirect = enabled; }
+
+
+void Render::ResetQueueStats()
+{
+    for (int i = 0; i < NUM_QUEUE_PASSES; i++) {
+        lastStats[i] = stats[i];
+        stats[i] = QueueStats();
+    }
+    std::swap(lodHistory[0], lodHistory[1]);
+    lodHistory[0].clear();
+    lodPass = 0;
+}
+
+
+void Render::LODDebugGUI()
+{
+    for (int i = 1; i < MAX_MESH_LODS; i++) {
+        char label[32];
+        SDL_snprintf(label, sizeof(label), "LOD %d below screen height", i);
+        ImGui::SliderFloat(label, &lodThresholds[i], 0.0f, 1.0f, "%.3f",
+                           ImGuiSliderFlags_Logarithmic);
+    }
+    ImGui::SliderFloat("LOD hysteresis", &lodHysteresis, 0.0f, 0.5f);
+    ImGui::SliderInt("Shadow LOD bias", &shadowLODBias, 0, MAX_MESH_LODS - 1);
+}
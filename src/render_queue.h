@@ -0,0 +1,170 @@
+#pragma once
+
+#include "bounds.h"
+#include "render_defines.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <stdint.h>
+
+// Forward declarations
+struct Mesh;
+struct Material;
+struct Model;
+struct ShaderProg;
+
+namespace Render {
+    enum RenderBucket {
+        BUCKET_OPAQUE,
+        BUCKET_TRANSPARENT,
+        NUM_BUCKETS
+    };
+
+    /* A single mesh draw. The sort key is filled in by RenderQueue::Sort(). */
+    struct DrawPacket
+    {
+        uint64_t mKey;
+        const Mesh *mMesh;
+        const Material *mMaterial;
+        glm::mat4 mTransform;
+        // World space bounds of the mesh
+        AABB mBounds;
+        // Index into RenderQueue::mNodeBounds of the node this mesh is in
+        uint32_t mNodeIdx;
+        // Shader features the material needs, see render_shaders.h
+        uint32_t mFeatures;
+        // rgb replaces the material colour when a is 1, see SubmitModel()
+        glm::vec4 mPaint;
+        // Never moves, so it can be drawn into cached shadow maps, see
+        // RenderQueue::mSubmitStatic
+        bool mStatic;
+    };
+
+    /* Which packets a depth only draw includes. Static casters are drawn
+     * into cached shadow maps once and dynamic casters are drawn on top
+     * every frame. Also used by c_cull.glsl. */
+    enum ShadowCasters {
+        CASTERS_ALL = 0,
+        CASTERS_STATIC = 1,
+        CASTERS_DYNAMIC = 2
+    };
+
+    /* How a pass picks the LOD of each mesh, see DrawQueue(). */
+    struct LODView
+    {
+        // Matrix the pass is drawn with, for the screen size of meshes
+        glm::mat4 mViewProj;
+        // Shadow passes add the shadow LOD bias from the debug GUI
+        bool mShadowPass = false;
+    };
+
+    struct QueueStats
+    {
+        int mDraws = 0;
+        // Packets drawn by instanced or multi draw indirect draws, which are
+        // counted once in mDraws
+        int mInstances = 0;
+        int mProgramBinds = 0;
+        int mMaterialBinds = 0;
+        int mVAOBinds = 0;
+        int mCulled = 0;
+        // Packets in nodes hidden by occlusion queries, also counted in
+        // mCulled. Not counted with GPU culling.
+        int mOccluded = 0;
+        // Draws given to the cull shader with GPU culling. Which of them it
+        // culls stays on the GPU.
+        int mGPUCullDraws = 0;
+        int mVerticesDrawn = 0;
+        int mVerticesCulled = 0;
+        // Packets drawn at each LOD. Not counted with GPU culling.
+        int mLODPackets[MAX_MESH_LODS] = {};
+    };
+
+    enum QueuePass {
+        QUEUE_PASS_VIEW,
+        QUEUE_PASS_SHADOW,
+        QUEUE_PASS_PREPASS,
+        NUM_QUEUE_PASSES
+    };
+
+    /* Draws are submitted to the queue instead of being drawn straight away.
+     * The queue is sorted by shader variant, material and VAO before drawing,
+     * so that state is only changed when it differs from the previous draw.
+     * Visible packets next to each other with the same mesh and material are
+     * drawn with one instanced draw. When multi draw indirect is available,
+     * opaque packets with the same program, material and geometry pool block
+     * are drawn with one glMultiDrawElementsIndirect. With GPU culling the
+     * opaque bucket is culled by a compute shader instead, see
+     * render_cull.h. */
+    struct RenderQueue
+    {
+        void Clear();
+        void Clear(RenderBucket bucket);
+        /* Submits every mesh of every node of model. Meshes that use the
+         * material at paintMaterialIdx are drawn with paintColour instead of
+         * the material's colour. */
+        void SubmitModel(const Model &model, const glm::mat4 &transform,
+                         RenderBucket bucket = BUCKET_OPAQUE,
+                         const Material *materialOverride = nullptr,
+                         int paintMaterialIdx = -1,
+                         glm::vec3 paintColour = glm::vec3(1.0f));
+        /* Sorts the opaque bucket by shader variant, material then VAO, and
+         * by VAO alone for depth only drawing. */
+        void SortOpaque();
+        /* Sorts the transparent bucket back to front from camPos. */
+        void SortTransparent(glm::vec3 camPos);
+
+        std::vector<DrawPacket> mPackets[NUM_BUCKETS];
+        // World space bounds of each submitted model node. Packets are only
+        // tested against the frustum if their node is at least partly inside.
+        std::vector<AABB> mNodeBounds;
+        // Opaque packet indices sorted by a depth only key.
+        std::vector<uint32_t> mDepthOrder;
+        // Changed whenever the opaque bucket may have changed, so that data
+        // derived from it (see render_cull.h) is only rebuilt when needed.
+        uint32_t mVersion = 0;
+        // Packets submitted while this is set are static, e.g. the map.
+        bool mSubmitStatic = false;
+    };
+
+    /* Draws a bucket of the queue with the PBR shader variant for
+     * viewFeatures combined with each packet's features, binding materials
+     * and only changing state that differs from the previous packet. Packets
+     * outside of frustum are skipped if frustum is not null. If lod is not
+     * null, each mesh is drawn at the LOD for its size on screen, with some
+     * hysteresis so that meshes near a threshold don't flicker between
+     * levels. Otherwise meshes are drawn at full detail. */
+    void DrawQueue(const RenderQueue &queue, RenderBucket bucket,
+                   uint32_t viewFeatures, const Frustum *frustum = nullptr,
+                   const LODView *lod = nullptr);
+    /* Draws the opaque bucket with the position only VAOs of the meshes and
+     * without binding any materials. Single packets are drawn with shader
+     * and instanced draws with instancedShader, which reads the model matrix
+     * from the instance attributes. Only the packets chosen by casters are
+     * drawn. */
+    void DrawQueueDepthOnly(const RenderQueue &queue, const ShaderProg &shader,
+                            const ShaderProg &instancedShader,
+                            const Frustum *frustum = nullptr,
+                            const LODView *lod = nullptr,
+                            ShadowCasters casters = CASTERS_ALL);
+    /* DrawQueueDepthOnly() of a view's opaque bucket before the colour pass.
+     * Uses the same culling, occlusion and LODs as the next DrawQueue() of
+     * the opaque bucket with the same frustum and lod, so that the colour
+     * pass can draw with GL_LEQUAL and no depth writes without any gaps. */
+    void DrawQueueDepthPrePass(const RenderQueue &queue, const ShaderProg &shader,
+                               const ShaderProg &instancedShader,
+                               const Frustum *frustum, const LODView *lod);
+    void DestroyQueueBuffers();
+    /* Multi draw indirect is only used if the context supports it and it
+     * is enabled. Otherwise every batch is its own draw call. */
+    bool GetMultiDrawIndirectSupported();
+    bool GetMultiDrawIndirectEnabled();
+    void SetMultiDrawIndirectEnabled(bool enabled);
+    /* Number of draws, state changes and culled packets in the last frame,
+     * for the debug GUI. */
+    const QueueStats& GetQueueStats(QueuePass pass);
+    void ResetQueueStats();
+    /* Screen size thresholds and shadow bias of the LODs. */
+    void LODDebugGUI();
+}
@@ -0,0 +1,254 @@
+#include "render_shaders.h"
+#include "render_defines.h"
+#include "render_shadow.h"
+#include "render_clusters.h"
+#include "render_ubo.h"
+#include "render_deferred.h"
+#include "texture.h"
+#include "model.h"
+#include "glerr.h"
+
+#include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
+
+#include <SDL3/SDL.h>
+
+// The spot shadow bucket has 3 bits, so the largest bucket is 7.
+static_assert(MAX_SPOT_SHADOWS <= 64, "Spot shadow buckets only go up to 64");
+
+static ShaderProg pbrShaders[Render::cNumShaderPermutations];
+static ShaderProg deferredShaders[Render::cNumShaderPermutations];
+static int numCompiledShaders = 0;
+// Debug view that draws everything without lighting
+static bool drawUnlit = false;
+
+
+/* Smallest bucket that holds numShadows spot shadows. */
+static uint32_t SpotShadowBucket(int numShadows)
+{
+    uint32_t bucket = 0;
+    while (numShadows > 0 && (1 << bucket) < numShadows) {
+        bucket++;
+    }
+    return numShadows > 0 ? bucket + 1 : 0;
+}
+
+
+static int SpotShadowsInBucket(uint32_t bucket)
+{
+    if (bucket == 0) return 0;
+    return SDL_min(1 << (bucket - 1), MAX_SPOT_SHADOWS);
+}
+
+
+/* Drops features that have no effect with the other features. */
+static uint32_t NormaliseFeatures(uint32_t features)
+{
+    uint32_t flags = features & Render::cShaderFeatureMask;
+    uint32_t spotBucket = features >> Render::cSpotShadowBucketShift;
+    if (!(flags & Render::SHADER_LIGHTING)) {
+        flags &= ~(Render::SHADER_LOCAL_LIGHTS | Render::SHADER_SUN_SHADOW
+                   | Render::SHADER_NORMAL_MAP);
+    }
+    if (flags & Render::SHADER_GBUFFER) {
+        // Only the surface is written, the lighting pass does the rest. The
+        // normal is needed though.
+        flags |= Render::SHADER_LIGHTING;
+        flags &= ~(Render::SHADER_LOCAL_LIGHTS | Render::SHADER_SUN_SHADOW
+                   | Render::SHADER_ALPHA);
+    }
+    if (!(flags & Render::SHADER_LOCAL_LIGHTS)) {
+        spotBucket = 0;
+    }
+    spotBucket = SDL_min(spotBucket, SpotShadowBucket(MAX_SPOT_SHADOWS));
+    return flags | (spotBucket << Render::cSpotShadowBucketShift);
+}
+
+
+/* Fills defines with the #defines of a variant with features. */
+static void GetFeatureDefines(uint32_t features, char *defines, size_t size)
+{
+    int numSpotShadows = SpotShadowsInBucket(
+            features >> Render::cSpotShadowBucketShift);
+    SDL_snprintf(defines, size,
+                 "#define MAX_SPOT_SHADOWS %d\n"
+                 "#define NUM_SPOT_SHADOWS %d\n"
+                 "#define SUN_CASCADES %d\n"
+                 "#define CLUSTER_TILES_X %d\n"
+                 "#define CLUSTER_TILES_Y %d\n"
+                 "#define CLUSTER_SLICES_Z %d\n"
+                 "#define INSTANCE_ATTRIB_MODEL %d\n"
+                 "#define INSTANCE_ATTRIB_PAINT %d\n"
+                 "%s%s%s%s%s%s%s",
+                 MAX_SPOT_SHADOWS, numSpotShadows, SUN_CASCADES,
+                 CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES_Z,
+                 INSTANCE_ATTRIB_MODEL, INSTANCE_ATTRIB_PAINT,
+                 features & Render::SHADER_LIGHTING ? "#define LIGHTING\n" : "",
+                 features & Render::SHADER_LOCAL_LIGHTS ? "#define LOCAL_LIGHTS\n" : "",
+                 features & Render::SHADER_SUN_SHADOW ? "#define SUN_SHADOW\n" : "",
+                 features & Render::SHADER_NORMAL_MAP ? "#define NORMAL_MAP\n" : "",
+                 features & Render::SHADER_ALPHA ? "#define ALPHA\n" : "",
+                 features & Render::SHADER_INSTANCED ? "#define INSTANCED\n" : "",
+                 features & Render::SHADER_GBUFFER ? "#define GBUFFER\n" : "");
+}
+
+
+/* Sets the samplers of lighting.glsl to their texture units. */
+static void SetLightingSamplers(const ShaderProg &shader)
+{
+    shader.SetInt("shadowMap"_u, 8);
+    shader.SetInt("spotLightShadowMapAtlas"_u, 9);
+    shader.SetInt("lightData"_u, CLUSTER_LIGHT_DATA_UNIT);
+    shader.SetInt("clusterTable"_u, CLUSTER_TABLE_UNIT);
+    shader.SetInt("lightIndices"_u, CLUSTER_INDEX_UNIT);
+}
+
+
+static ShaderProg CompilePBRShader(uint32_t features)
+{
+    char defines[512];
+    GetFeatureDefines(features, defines, sizeof(defines));
+    ShaderProg shader = CreateShaderProgramFromFiles(
+            "shaders/vertex.glsl", "shaders/fragment.glsl", defines);
+
+    Render::BindUniformBlocks(shader);
+    // Texture units for samplers never change, so they are only set once.
+    glUseProgram(shader.id);
+    shader.SetInt("material.albedo"_u, 0);
+    shader.SetInt("material.normalMap"_u, 1);
+    shader.SetInt("material.roughnessMap"_u, 2);
+    SetLightingSamplers(shader);
+    glUseProgram(0);
+    GLERR;
+
+    SDL_Log("Created PBR shader variant 0x%03x (%d spot shadows)", features,
+            SpotShadowsInBucket(features >> Render::cSpotShadowBucketShift));
+    numCompiledShaders++;
+    return shader;
+}
+
+
+static ShaderProg CompileDeferredLightingShader(uint32_t features)
+{
+    char defines[512];
+    GetFeatureDefines(features, defines, sizeof(defines));
+    ShaderProg shader = CreateShaderProgramFromFiles(
+            "shaders/v_screen.glsl", "shaders/f_deferred.glsl", defines);
+
+    Render::BindUniformBlocks(shader);
+    glUseProgram(shader.id);
+    // The material units of the G-buffer pass are free again by now.
+    shader.SetInt("gAlbedo"_u, 0);
+    shader.SetInt("gNormal"_u, 1);
+    shader.SetInt("gMaterial"_u, 2);
+    shader.SetInt("gDepth"_u, 3);
+    SetLightingSamplers(shader);
+    glUseProgram(0);
+    GLERR;
+
+    SDL_Log("Created deferred lighting variant 0x%03x (%d spot shadows)",
+            features,
+            SpotShadowsInBucket(features >> Render::cSpotShadowBucketShift));
+    numCompiledShaders++;
+    return shader;
+}
+
+
+uint32_t Render::GetViewShaderFeatures()
+{
+    if (drawUnlit) return 0;
+
+    uint32_t features = SHADER_LIGHTING;
+    if (GetNumClusterLights() > 0) {
+        features |= SHADER_LOCAL_LIGHTS;
+    }
+    if (GetShadowsEnabled()) {
+        features |= SHADER_SUN_SHADOW;
+        features |= SpotShadowBucket(GetNumActiveSpotShadows())
+                 << cSpotShadowBucketShift;
+    }
+    return features;
+}
+
+
+uint32_t Render::GetMaterialShaderFeatures(const Material &material,
+                                           bool transparent)
+{
+    uint32_t features = 0;
+    // The default normal map is flat, so the vertex normal gives the same
+    // result.
+    if (material.normalMap.id != 0
+            && material.normalMap.id != gDefaultNormalMap.id) {
+        features |= SHADER_NORMAL_MAP;
+    }
+    if (transparent) {
+        features |= SHADER_ALPHA;
+    }
+    return features;
+}
+
+
+const ShaderProg& Render::GetPBRShader(uint32_t features)
+{
+    features = NormaliseFeatures(features);
+    SDL_assert(features < (uint32_t)cNumShaderPermutations);
+    ShaderProg &shader = pbrShaders[features];
+    if (shader.id == 0) {
+        shader = CompilePBRShader(features);
+    }
+    return shader;
+}
+
+
+const ShaderProg& Render::GetDeferredLightingShader(uint32_t viewFeatures)
+{
+    uint32_t features = NormaliseFeatures(viewFeatures)
+                      & ~(SHADER_NORMAL_MAP | SHADER_ALPHA | SHADER_INSTANCED
+                          | SHADER_GBUFFER);
+    SDL_assert(features < (uint32_t)cNumShaderPermutations);
+    ShaderProg &shader = deferredShaders[features];
+    if (shader.id == 0) {
+        shader = CompileDeferredLightingShader(features);
+    }
+    return shader;
+}
+
+
+void Render::LoadPBRShaders()
+{
+    uint32_t maxSpotShadows = SpotShadowBucket(MAX_SPOT_SHADOWS)
+                            << cSpotShadowBucketShift;
+    uint32_t lit = SHADER_LIGHTING | SHADER_LOCAL_LIGHTS | SHADER_SUN_SHADOW;
+    if (GetRenderPath() == RENDER_PATH_DEFERRED) {
+        for (uint32_t material : {0u, (uint32_t)SHADER_NORMAL_MAP}) {
+            for (uint32_t instanced : {0u, (uint32_t)SHADER_INSTANCED}) {
+                GetPBRShader(SHADER_GBUFFER | material | instanced);
+            }
+        }
+        GetDeferredLightingShader(lit);
+        GetDeferredLightingShader(lit | maxSpotShadows);
+        // The transparent bucket is still drawn forward.
+        GetPBRShader(lit | SHADER_ALPHA);
+        return;
+    }
+    for (uint32_t material : {0u, (uint32_t)SHADER_NORMAL_MAP}) {
+        for (uint32_t instanced : {0u, (uint32_t)SHADER_INSTANCED}) {
+            GetPBRShader(lit | material | instanced);
+            GetPBRShader(lit | material | instanced | maxSpotShadows);
+        }
+    }
+    GetPBRShader(lit | SHADER_ALPHA);
+}
+
+
+void Render::ShadersDebugGUI()
+{
+    bool shadows = GetShadowsEnabled();
+    if (ImGui::Checkbox("Shadows", &shadows)) {
+        SetShadowsEnabled(shadows);
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Unlit", &drawUnlit);
+    ImGui::Text("PBR shader variants compiled: %d, view features: 0x%03x",
+                numCompiledShaders, GetViewShaderFeatures());
+}
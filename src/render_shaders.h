@@ -1,3 +1,56 @@
 #pragma once
 #include "shader.h"
 
+#include <stdint.h>
+
+// Forward declarations
+struct Material;
+
+/*
+ * Variants of the PBR shader (vertex.glsl and fragment.glsl). Each variant is
+ * compiled with #defines for the features it needs, so that draws which
+ * don't need shadows, normal maps or local lights don't pay for them. Variants
+ * are compiled the first time they are asked for and kept until exit.
+ */
+namespace Render {
+    enum ShaderFeature : uint32_t {
+        // Lighting from the sun. Without it the albedo is drawn unlit.
+        SHADER_LIGHTING     = 1 << 0,
+        // Clustered point and spot lights
+        SHADER_LOCAL_LIGHTS = 1 << 1,
+        SHADER_SUN_SHADOW   = 1 << 2,
+        SHADER_NORMAL_MAP   = 1 << 3,
+        // Output the alpha of the albedo texture instead of 1
+        SHADER_ALPHA        = 1 << 4,
+        // Model matrix and paint colour come from instance attributes
+        SHADER_INSTANCED    = 1 << 5,
+        // Write the surface to the G-buffer instead of lighting it, see
+        // render_deferred.h
+        SHADER_GBUFFER      = 1 << 6,
+    };
+
+    // The number of spot light shadows is stored above the feature bits as
+    // a bucket: 0, 1, 2, 4, ... up to MAX_SPOT_SHADOWS.
+    constexpr int cSpotShadowBucketShift = 7;
+    constexpr uint32_t cShaderFeatureMask = (1 << cSpotShadowBucketShift) - 1;
+    constexpr int cNumShaderPermutations = 1 << (cSpotShadowBucketShift + 3);
+
+    /* Features that a view needs, from the shadow settings and the lights of
+     * the current frame. Call after ShadowPass() and UploadLights(). */
+    uint32_t GetViewShaderFeatures();
+    /* Features that a material needs. transparent is true for the transparent
+     * bucket, which needs the texture alpha. */
+    uint32_t GetMaterialShaderFeatures(const Material &material, bool transparent);
+    /* Returns the variant of the PBR shader with the given features, compiling
+     * it if needed. Features that don't apply (e.g. shadows without lighting)
+     * are dropped so that equivalent combinations share a program. */
+    const ShaderProg& GetPBRShader(uint32_t features);
+    /* Returns the lighting pass of the deferred renderer (f_deferred.glsl)
+     * with the lighting features of a view, compiling it if needed. Material
+     * features are ignored, they are already in the G-buffer. */
+    const ShaderProg& GetDeferredLightingShader(uint32_t viewFeatures);
+    /* Compiles the variants used by a normal frame with the current render
+     * path ahead of time. */
+    void LoadPBRShaders();
+    void ShadersDebugGUI();
+}
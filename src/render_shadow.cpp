@@ -2,36 +2,118 @@
 #include "render_internal.h"
 #include "render_lights.h"
 #include "render_defines.h"
+#include "render_ubo.h"
+#include "render_queue.h"
+#include "render_clusters.h"
 //#include "render_shaders.h"
 #include "render.h" // TODO: Remove this include
+#include "model.h"
+#include "shadow_atlas.h"
 #include "glerr.h"
 #include "player.h"
 #include "shader.h"
 
 #include "../glad/glad.h"
+#include "../vendor/imgui/imgui.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <SDL3/SDL.h>
 
+#include <algorithm>
+
 // TODO: Remove this because it is duplicated in render.cpp
 static const glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
 
-// For sun light
-static unsigned int depthMapFBO;
-static unsigned int depthMap; // Depth map texture
-static glm::mat4 lightSpaceMatrix;
-static const unsigned int SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
-
-// For spot lights
+// Cascaded shadow maps for the sun. Every split screen view has its own
+// SUN_CASCADES cascades, fitted to slices of its view frustum. They are all
+// in one atlas, sunShadowTarget, with a row per view and the cascades of a
+// view side by side in the row.
+struct SunCascade {
+    glm::mat4 mLightSpaceMatrix = glm::mat4(1.0f);
+    // View depth of the far end of the cascade
+    float mSplitFar = 0.0f;
+    // False until the cascade is first drawn into the current atlas
+    bool mValid = false;
+    // Matrix the cascade's tile of sunShadowCacheTarget was drawn with
+    glm::mat4 mCachedMatrix = glm::mat4(1.0f);
+    bool mCacheValid = false;
+};
+static SunCascade sunCascades[MAX_PLAYERS][SUN_CASCADES];
+// Views the atlas has rows for
+static int sunShadowViews = 0;
+// Resolution of each cascade, set by the shadow quality or the debug GUI
+static int sunCascadeSizes[SUN_CASCADES];
+// Frames between updates of each cascade. The far cascades barely change
+// from one frame to the next and cover the most casters, so they are the
+// cheapest to update less often.
+static int sunCascadeIntervals[SUN_CASCADES] = {1, 1, 2, 4};
+// View depth covered by the cascades
+static float sunShadowDistance = 150.0f;
+// Blend of logarithmic (1) and uniform (0) split depths
+static float sunCascadeSplitLambda = 0.75f;
+// Casters this far towards the sun from a cascade's bounds still cast
+// shadows into it.
+static constexpr float cSunCasterDistance = 100.0f;
+static uint32_t shadowFrame = 0;
+static int lastCascadesDrawn = 0;
+
+// Shadow caching. Static casters (the map) are drawn into a cache target
+// only when a shadow map's matrix changes, and every frame the cached tile
+// is copied into the shadow target before the dynamic casters (the cars)
+// are drawn on top of it.
+static bool shadowCaching = true;
+// Changes when the static casters in the queue change, e.g. a new map
+static uint64_t staticCasterSignature = 0;
+static int lastStaticRedraws = 0;
+// Sun cascades are moved in steps of 1/cSunCacheSteps of their size while
+// caching, so that they stay put for several frames at a time.
+static constexpr float cSunCacheSteps = 16.0f;
+// Cascade sizes are rounded up to powers of this while caching, so that
+// small field of view changes don't move them.
+static constexpr float cSunCacheSizeBase = 1.0625f;
+
+// For spot lights. The render target is spotShadowTarget, a square atlas
+// that spotShadowAtlas hands out tiles of. Each shadow's tile is sized by
+// how big its light is on screen, and is reallocated when that changes.
 static Render::SpotLightShadow spotLightShadows[MAX_SPOT_SHADOWS];
 //static unsigned int spotShadowTexArray;
-static unsigned int spotShadowTexAtlas;
-static unsigned int spotShadowFBO;
-
-// TODO: rename to cSpotShadowSize
-static constexpr unsigned int SPOT_SHADOW_SIZE = 2048;
+static ShadowAtlas spotShadowAtlas;
+static ShadowTile spotShadowTiles[MAX_SPOT_SHADOWS];
+// Size each tile was last allocated for. The tile may be smaller if the
+// atlas was full, and isn't reallocated until the wanted size changes.
+static int spotShadowRequests[MAX_SPOT_SHADOWS];
+// Shadow map texels per pixel of the light's range on screen
+static float spotShadowResolutionScale = 1.0f;
+
+// What each spot shadow's tile of spotShadowCacheTarget was drawn for. The
+// tile is redrawn when the slot gets another light or its light moves.
+struct SpotShadowCache {
+    int mLightIdx = -1;
+    glm::mat4 mMatrix = glm::mat4(1.0f);
+    ShadowTile mTile;
+    bool mValid = false;
+};
+static SpotShadowCache spotShadowCache[MAX_SPOT_SHADOWS];
+
+// Resolution of each sun cascade and of each spot light shadow map for each
+// shadow quality level.
+static constexpr int cSunCascadeSizes[][SUN_CASCADES] = {
+    {1024, 512,  512,  256},
+    {2048, 1024, 1024, 512},
+    {2048, 2048, 1024, 1024}
+};
+// Largest spot shadow tile and size of the spot shadow atlas for each shadow
+// quality level.
+static constexpr int cSpotShadowSizes[] = {512,  1024, 2048};
+static constexpr int cSpotAtlasSizes[]  = {2048, 4096, 4096};
+static constexpr int cMinSpotShadowSize = 128;
+static int shadowQuality = 2;
+static int spotShadowSize = cSpotShadowSizes[2];
+static bool shadowsEnabled = true;
+// Spot light shadows drawn this frame. They always use the first slots.
+static int numActiveSpotShadows = 0;
 
 static constexpr float cSpotShadowNear = 0.2f;
 static constexpr float cSpotShadowFar = 40.0f;
@@ -39,6 +121,167 @@ static constexpr float cSpotShadowFar = 40.0f;
 //unsigned int testShadowFBO;
 //unsigned int testShadowTex;
 
+
+static void InvalidateShadowCache()
+{
+    for (int v = 0; v < MAX_PLAYERS; v++) {
+        for (SunCascade &cascade : sunCascades[v]) {
+            cascade.mCacheValid = false;
+        }
+    }
+    for (SpotShadowCache &cache : spotShadowCache) {
+        cache.mValid = false;
+    }
+}
+
+
+/* Makes the cache targets match the shadow targets, or frees them when
+ * caching is off. */
+static void UpdateShadowCacheTargets()
+{
+    struct { RenderTarget *mCache; const RenderTarget *mTarget; } pairs[] = {
+        {&sunShadowCacheTarget, &sunShadowTarget},
+        {&spotShadowCacheTarget, &spotShadowTarget}
+    };
+    for (auto &pair : pairs) {
+        if (!shadowCaching) {
+            Render::DestroyRenderTarget(pair.mCache);
+        } else if (pair.mCache->mWidth != pair.mTarget->mWidth
+                || pair.mCache->mHeight != pair.mTarget->mHeight) {
+            Render::CreateRenderTarget(pair.mCache, pair.mTarget->mWidth,
+                                       pair.mTarget->mHeight);
+            InvalidateShadowCache();
+        }
+    }
+}
+
+
+static uint64_t GetStaticCasterSignature()
+{
+    uint64_t signature = 0;
+    for (const Render::DrawPacket &packet : sceneQueue.mPackets[Render::BUCKET_OPAQUE]) {
+        if (packet.mStatic) {
+            signature = signature * 31 + packet.mMesh->mId + 1;
+        }
+    }
+    return signature;
+}
+
+
+static void ClearShadowTile(int x, int y, int size)
+{
+    glViewport(x, y, size, size);
+    glScissor(x, y, size, size);
+    glEnable(GL_SCISSOR_TEST);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+
+/* Draws the shadow map tile at x, y of target. With caching, the static
+ * casters are only drawn into the same tile of cache if cacheValid is false,
+ * and the tile is copied from there before the dynamic casters are drawn.
+ * Leaves target bound. */
+static void DrawShadowTile(const RenderTarget &target, const RenderTarget &cache,
+                           int x, int y, int size, const glm::mat4 &lightSpaceMatrix,
+                           bool cacheValid)
+{
+    using namespace Render;
+    if (!shadowCaching) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target.mFBO);
+        ClearShadowTile(x, y, size);
+        RenderSceneShadow(lightSpaceMatrix);
+        return;
+    }
+    if (!cacheValid) {
+        glBindFramebuffer(GL_FRAMEBUFFER, cache.mFBO);
+        ClearShadowTile(x, y, size);
+        RenderSceneShadow(lightSpaceMatrix, CASTERS_STATIC);
+        lastStaticRedraws++;
+    }
+    // Both are GL_DEPTH_COMPONENT24, so the depth can be blitted.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, cache.mFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.mFBO);
+    glBlitFramebuffer(x, y, x + size, y + size, x, y, x + size, y + size,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.mFBO);
+    glViewport(x, y, size, size);
+    RenderSceneShadow(lightSpaceMatrix, CASTERS_DYNAMIC);
+    GLERR;
+}
+
+
+/* Tile size for a spot light's shadow from the height of its range on
+ * screen in the view where it is biggest. Sizes are powers of two, and only
+ * change when the height is well past the next size up or down, so that
+ * tiles aren't reallocated every frame near a boundary. current is the size
+ * the light had last frame, or 0. */
+static int GetWantedSpotShadowSize(const Render::SpotLight &sl, int numViews,
+                                   int current)
+{
+    float range = SDL_min(Render::GetLightRange(sl.mColour), cSpotShadowFar);
+    float pixels = 0.0f;
+    for (int i = 0; i < numViews; i++) {
+        const Camera &cam = gPlayers[i].cam.cam;
+        float x, y, width, height;
+        Render::GetPlayerSplitScreenBounds(i, &x, &y, &width, &height);
+        float dist = glm::length(cam.pos - sl.mPosition);
+        // The whole view when the camera is inside of the light's range
+        float fraction = range * cam.projection[1][1] / SDL_max(dist, range);
+        pixels = SDL_max(pixels, SDL_min(fraction, 1.0f) * height);
+    }
+    float wanted = SDL_clamp(pixels * spotShadowResolutionScale,
+                             (float)cMinSpotShadowSize, (float)spotShadowSize);
+    if (current != 0 && wanted > current * 0.375f && wanted <= current * 1.25f) {
+        return current;
+    }
+    int size = cMinSpotShadowSize;
+    while (size < wanted && size < spotShadowSize) {
+        size *= 2;
+    }
+    return size;
+}
+
+
+/* Gives each of the numShadows spot shadows a tile of the atlas for the
+ * lights in lightIdxs. Tiles that change size are freed first so that there
+ * is room for the tiles that grow, and then allocated biggest first, which
+ * leaves no gaps in a quadtree. If there is no room the tile gets smaller. */
+static void AssignSpotShadowTiles(const int *lightIdxs, int numShadows, int numViews)
+{
+    int wanted[MAX_SPOT_SHADOWS] = {};
+    int order[MAX_SPOT_SHADOWS];
+    for (int s = 0; s < MAX_SPOT_SHADOWS; s++) {
+        order[s] = s;
+        ShadowTile &tile = spotShadowTiles[s];
+        if (s >= numShadows) {
+            spotShadowAtlas.Free(&tile);
+            spotShadowRequests[s] = 0;
+            continue;
+        }
+        bool sameLight = spotLightShadows[s].mForLightIdx == lightIdxs[s];
+        int current = sameLight ? spotShadowRequests[s] : 0;
+        wanted[s] = GetWantedSpotShadowSize(*Render::GetSpotLightByIdx(lightIdxs[s]),
+                                            numViews, current);
+        if (wanted[s] != spotShadowRequests[s]) {
+            spotShadowAtlas.Free(&tile);
+        }
+    }
+    std::sort(order, order + numShadows,
+              [&wanted](int a, int b) { return wanted[a] > wanted[b]; });
+    for (int i = 0; i < numShadows; i++) {
+        int s = order[i];
+        ShadowTile &tile = spotShadowTiles[s];
+        if (tile.mSize != 0) continue;
+        spotShadowRequests[s] = wanted[s];
+        for (int size = wanted[s]; size >= cMinSpotShadowSize && tile.mSize == 0;
+             size /= 2) {
+            tile = spotShadowAtlas.Allocate(size);
+        }
+    }
+}
+
+
 void Render::PrepareShadowForLight(int spotShadowNum, int spotLightIdx)
 {
     SpotLight *sl = GetSpotLightByIdx(spotLightIdx);
@@ -56,65 +299,28 @@ void Render::PrepareShadowForLight(int spotShadowNum, int spotLightIdx)
     spotShadow.mForLightIdx = spotLightIdx; // Render the scene onto the shadow framebuffer
     glActiveTexture(GL_TEXTURE9);
     glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, spotShadowFBO);
-    // Individual shadow textures are next to each other in the texture atlas.
-    float x = SPOT_SHADOW_SIZE * spotShadowNum;
-    glViewport(x, 0, SPOT_SHADOW_SIZE, SPOT_SHADOW_SIZE);
-    //glClear(GL_DEPTH_BUFFER_BIT);
-    RenderSceneShadow(spotShadow.lightSpaceMatrix);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    GLERR;
-}
-
-
-void Render::CreateShadowFBO(unsigned int *inFBO, unsigned int *inTex,
-        unsigned int resW, unsigned int resH, float defaultLighting)
-{
-    glGenFramebuffers(1, inFBO);
-    glGenTextures(1, inTex);
-
-    glBindTexture(GL_TEXTURE_2D, *inTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-                 resW, resH, 0, GL_DEPTH_COMPONENT,
-                 GL_FLOAT, NULL);
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColour[] = {defaultLighting, defaultLighting, 
-                            defaultLighting, defaultLighting};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColour);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, *inFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           *inTex, 0);
-    // Don't draw colours onto this buffer
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-}
-
+    glActiveTexture(GL_TEXTURE0);
 
-void Render::CreateShadowFBOForExistingTex(unsigned int *outFBO, unsigned int tex)
-{
-    glGenFramebuffers(1, outFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, *outFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           tex, 0);
-    // Don't draw colours onto this buffer
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        SDL_Log("Error: Framebuffer is not complete!");
-    }
+    // The atlas was too full for this light, the shader skips its shadow.
+    const ShadowTile &tile = spotShadowTiles[spotShadowNum];
+    if (tile.mSize == 0) return;
+
+    SpotShadowCache &cache = spotShadowCache[spotShadowNum];
+    bool cacheValid = cache.mValid && cache.mLightIdx == spotLightIdx
+                   && cache.mMatrix == spotShadow.lightSpaceMatrix
+                   && cache.mTile.mX == tile.mX && cache.mTile.mY == tile.mY
+                   && cache.mTile.mSize == tile.mSize;
+    cache.mLightIdx = spotLightIdx;
+    cache.mMatrix = spotShadow.lightSpaceMatrix;
+    cache.mTile = tile;
+    cache.mValid = true;
+    DrawShadowTile(spotShadowTarget, spotShadowCacheTarget, tile.mX, tile.mY,
+                   tile.mSize, spotShadow.lightSpaceMatrix, cacheValid);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLERR;
 }
 
 
-
 void Render::CreateShadowTextureArray(unsigned int *outTex,
         unsigned int resW, unsigned int resH, float defaultLighting)
 {
@@ -141,29 +347,6 @@ void Render::CreateShadowTextureArray(unsigned int *outTex,
 }
 
 
-void Render::CreateShadowTextureAtlas(unsigned int *outTex)
-{
-    const unsigned int resW = SPOT_SHADOW_SIZE * MAX_SPOT_SHADOWS;
-    const unsigned int resH = SPOT_SHADOW_SIZE;
-    const float defaultLighting = 1.0f;
-
-    glGenTextures(1, outTex);
-    glBindTexture(GL_TEXTURE_2D, *outTex);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, resW, resH, 0, 
-                 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColour[] = {defaultLighting, defaultLighting, 
-                            defaultLighting, defaultLighting};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColour);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-}
-
 void Render::CreateShadowFBOForTexLayer(unsigned int *outFBO, unsigned int tex, int layer)
 {
     glGenFramebuffers(1, outFBO);
@@ -187,44 +370,196 @@ void Render::CreateShadowFBOForTexLayer(unsigned int *outFBO, unsigned int tex,
 }
 
 
+/* Position of a cascade in the atlas in pixels. */
+static void GetSunCascadeRect(int view, int cascade, int *outX, int *outY,
+                              int *outSize)
+{
+    int x = 0;
+    int rowHeight = 0;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        if (c < cascade) x += sunCascadeSizes[c];
+        rowHeight = SDL_max(rowHeight, sunCascadeSizes[c]);
+    }
+    *outX = x;
+    *outY = view * rowHeight;
+    *outSize = sunCascadeSizes[cascade];
+}
+
+
+static void CreateSunShadowAtlas(int numViews)
+{
+    int width = 0;
+    int rowHeight = 0;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        width += sunCascadeSizes[c];
+        rowHeight = SDL_max(rowHeight, sunCascadeSizes[c]);
+    }
+    Render::CreateRenderTarget(&sunShadowTarget, width, rowHeight * numViews);
+    sunShadowViews = numViews;
+    UpdateShadowCacheTargets();
+    for (int v = 0; v < MAX_PLAYERS; v++) {
+        for (SunCascade &cascade : sunCascades[v]) {
+            cascade.mValid = false;
+        }
+    }
+    GLERR;
+}
+
+
+/* Light space matrix of an ortho box around the slice of the view frustum
+ * between nearDepth and farDepth. The box is the bounding sphere of the
+ * slice, so its size doesn't change when the camera turns, and it is moved
+ * in whole texels so that shadow edges don't shimmer when the camera
+ * moves. */
+static glm::mat4 FitSunCascade(const glm::mat4 &view, const glm::mat4 &projection,
+                               float nearDepth, float farDepth, int size)
+{
+    glm::mat4 invView = glm::inverse(view);
+    float tanX = 1.0f / projection[0][0];
+    float tanY = 1.0f / projection[1][1];
+    glm::vec3 corners[8];
+    glm::vec3 centre = glm::vec3(0.0f);
+    int n = 0;
+    for (float depth : {nearDepth, farDepth}) {
+        for (float x : {-1.0f, 1.0f}) {
+            for (float y : {-1.0f, 1.0f}) {
+                glm::vec4 p = glm::vec4(x * tanX * depth, y * tanY * depth, -depth, 1.0f);
+                corners[n] = glm::vec3(invView * p);
+                centre += corners[n];
+                n++;
+            }
+        }
+    }
+    centre /= 8.0f;
+    float radius = 0.0f;
+    for (const glm::vec3 &corner : corners) {
+        radius = SDL_max(radius, glm::length(corner - centre));
+    }
+    glm::vec3 lightDir = glm::normalize(Render::GetSunLight().mDirection);
+    glm::vec3 lightUp = SDL_fabsf(glm::dot(lightDir, up)) > 0.99f
+                      ? glm::vec3(0.0f, 0.0f, 1.0f) : up;
+    if (shadowCaching) {
+        // Grow the box enough that the slice stays inside of it when its
+        // centre is moved by up to a step on each axis, and round the size
+        // up so that it only changes when the field of view changes a lot.
+        radius *= 1.0f + 2.0f / cSunCacheSteps;
+        radius = SDL_powf(cSunCacheSizeBase,
+                          SDL_ceilf(SDL_logf(radius) / SDL_logf(cSunCacheSizeBase)));
+        // A step is a whole number of texels, so the texel snapping below
+        // stays a no-op.
+        float step = radius * 2.0f / cSunCacheSteps;
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), lightDir, lightUp);
+        glm::vec3 lightCentre = glm::vec3(lightRotation * glm::vec4(centre, 1.0f));
+        lightCentre = glm::round(lightCentre / step) * step;
+        centre = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightCentre, 1.0f));
+    } else {
+        // Float error would change the size a little every frame otherwise.
+        radius = SDL_ceilf(radius * 16.0f) / 16.0f;
+    }
+    float back = radius + cSunCasterDistance;
+    glm::mat4 lightView = glm::lookAt(centre - lightDir * back, centre, lightUp);
+    glm::mat4 lightProjection = glm::ortho(-radius, radius, -radius, radius,
+                                           0.0f, back + radius);
+
+    // Snap the world origin to a texel, which snaps everything else too.
+    glm::vec4 origin = lightProjection * lightView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    glm::vec2 texels = glm::vec2(origin) * (size * 0.5f);
+    glm::vec2 offset = (glm::round(texels) - texels) * (2.0f / size);
+    lightProjection[3][0] += offset.x;
+    lightProjection[3][1] += offset.y;
+    return lightProjection * lightView;
+}
+
+
+/* Fits and draws the cascades of a view that are due for an update. */
+static void UpdateSunCascades(int viewIdx, const glm::mat4 &view,
+                              const glm::mat4 &projection)
+{
+    float near, far;
+    Render::GetProjectionNearFar(projection, &near, &far);
+    float shadowFar = SDL_min(far, sunShadowDistance);
+
+    float splitNear = near;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        float t = (float)(c + 1) / SUN_CASCADES;
+        float logSplit = near * SDL_powf(shadowFar / near, t);
+        float uniformSplit = near + (shadowFar - near) * t;
+        float splitFar = sunCascadeSplitLambda * logSplit
+                       + (1.0f - sunCascadeSplitLambda) * uniformSplit;
+
+        SunCascade &cascade = sunCascades[viewIdx][c];
+        int interval = SDL_max(sunCascadeIntervals[c], 1);
+        // Offset by the cascade so that cascades with the same interval
+        // don't all update in the same frame.
+        bool due = !cascade.mValid || (shadowFrame + c) % interval == 0;
+        if (due) {
+            int x, y, size;
+            GetSunCascadeRect(viewIdx, c, &x, &y, &size);
+            cascade.mLightSpaceMatrix = FitSunCascade(view, projection,
+                                                      splitNear, splitFar, size);
+            cascade.mSplitFar = splitFar;
+            cascade.mValid = true;
+
+            bool cacheValid = cascade.mCacheValid
+                           && cascade.mCachedMatrix == cascade.mLightSpaceMatrix;
+            cascade.mCachedMatrix = cascade.mLightSpaceMatrix;
+            cascade.mCacheValid = true;
+            DrawShadowTile(sunShadowTarget, sunShadowCacheTarget, x, y, size,
+                           cascade.mLightSpaceMatrix, cacheValid);
+            lastCascadesDrawn++;
+        }
+        splitNear = splitFar;
+    }
+}
+
+
 void Render::ShadowPass()
 {
-    // For sunlight shadows
-    float nearPlane = 1.0f, farPlane = 140.0f;
-    // TODO: Make sunlight shadow work in splitscreen
-    const glm::vec3 shadowOrigin = gPlayers[0].cam.cam.pos;
-    constexpr float SHADOW_START_FAC = 70.0f;
-    glm::mat4 lightView = glm::lookAt(
-            shadowOrigin - GetSunLight().mDirection * SHADOW_START_FAC,
-            shadowOrigin, up);
-    glm::mat4 lightProjection = glm::ortho(-40.0f, 40.0f, -40.0f, 40.0f, 
-                                    nearPlane, farPlane);
+    if (!shadowsEnabled) {
+        for (int i = 0; i < MAX_SPOT_SHADOWS; i++) {
+            spotLightShadows[i].mForLightIdx = -1;
+        }
+        numActiveSpotShadows = 0;
+        return;
+    }
 
-    // Transforms world space to light space
-    lightSpaceMatrix = lightProjection * lightView;
+    // Sun cascades for every view that is drawn this frame
+    int numViews = doSplitScreen ? SDL_min(gNumPlayers, MAX_PLAYERS) : 1;
+    if (numViews != sunShadowViews) {
+        CreateSunShadowAtlas(numViews);
+    }
+    UpdateShadowCacheTargets();
+    uint64_t signature = GetStaticCasterSignature();
+    if (signature != staticCasterSignature) {
+        InvalidateShadowCache();
+        staticCasterSignature = signature;
+    }
+    lastStaticRedraws = 0;
 
-    
     glEnable(GL_CULL_FACE);
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
     glEnable(GL_DEPTH_TEST);
-    glClear(GL_DEPTH_BUFFER_BIT);
     glCullFace(GL_FRONT);
     GLERR;
-    // For sun shadow
-    RenderSceneShadow(lightSpaceMatrix);
+    lastCascadesDrawn = 0;
+    for (int i = 0; i < numViews; i++) {
+        const Camera &cam = gPlayers[i].cam.cam;
+        UpdateSunCascades(i, cam.LookAtMatrix(up), cam.projection);
+    }
+    shadowFrame++;
 
     // Render shadows for some spotlights
+    int shadowLights[MAX_SPOT_SHADOWS];
     int shadowNum = 0;
-    int i = 0;
-    glBindFramebuffer(GL_FRAMEBUFFER, spotShadowFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    for (; shadowNum < MAX_SPOT_SHADOWS && i < GetSpotLightsSize(); i++) {
+    for (int i = 0; shadowNum < MAX_SPOT_SHADOWS && i < GetSpotLightsSize(); i++) {
         SpotLight* sl = GetSpotLightByIdx(i);
         if (sl == nullptr || !sl->mEnableShadows) continue;
-        PrepareShadowForLight(shadowNum, i);
-        shadowNum++;
+        shadowLights[shadowNum++] = i;
+    }
+    AssignSpotShadowTiles(shadowLights, shadowNum, numViews);
+    for (int s = 0; s < shadowNum; s++) {
+        PrepareShadowForLight(s, shadowLights[s]);
     }
+    numActiveSpotShadows = shadowNum;
     // If there are left over shadows not in use, set their light idx to -1.
     for (; shadowNum < MAX_SPOT_SHADOWS; shadowNum++) {
         spotLightShadows[shadowNum].mForLightIdx = -1;
@@ -233,8 +568,8 @@ void Render::ShadowPass()
     // Test shadow
     /*
     glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, spotShadowFBO);
-    glViewport(0, 0, SPOT_SHADOW_SIZE, SPOT_SHADOW_SIZE);
+    glBindFramebuffer(GL_FRAMEBUFFER, spotShadowTarget.mFBO);
+    glViewport(0, 0, spotShadowSize, spotShadowSize);
     glClear(GL_DEPTH_BUFFER_BIT);
     RenderSceneShadow(spotLightShadows[0].lightSpaceMatrix);
     */
@@ -248,82 +583,173 @@ void Render::ShadowPass()
 
 
 /* Render the depth of the light's perspective on the currently bound FBO */
-void Render::RenderSceneShadow(glm::mat4 aLightSpaceMatrix)
+void Render::RenderSceneShadow(glm::mat4 aLightSpaceMatrix, ShadowCasters casters)
 {
     GLERR;
-    glUseProgram(simpleDepthShader.id);
+    for (const ShaderProg *shader : {&simpleDepthShader, &simpleDepthInstancedShader}) {
+        glUseProgram(shader->id);
+        shader->SetMat4fv("lightSpaceMatrix"_u, glm::value_ptr(aLightSpaceMatrix));
+    }
     GLERR;
-    simpleDepthShader.SetMat4fv((char*)"lightSpaceMatrix", glm::value_ptr(aLightSpaceMatrix));
+    // The light space matrix is the view volume of the shadow map, so only
+    // casters inside of the sun's ortho box or the spot light's cone are drawn.
+    Frustum lightFrustum;
+    lightFrustum.FromMatrix(aLightSpaceMatrix);
+    LODView lodView = {aLightSpaceMatrix, true};
+    DrawQueueDepthOnly(sceneQueue, simpleDepthShader, simpleDepthInstancedShader,
+                       doFrustumCulling ? &lightFrustum : nullptr, &lodView, casters);
     GLERR;
-    RenderSceneRaw(simpleDepthShader);
+}
+
+
+void Render::UploadShadowUniforms(int viewIdx)
+{
+    static_assert(SUN_CASCADES <= 4, "The cascade splits must fit in a vec4");
+    ShadowsBlock block = {};
+    viewIdx = SDL_clamp(viewIdx, 0, MAX_PLAYERS - 1);
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        const SunCascade &cascade = sunCascades[viewIdx][c];
+        int x, y, size;
+        GetSunCascadeRect(viewIdx, c, &x, &y, &size);
+        block.sunCascadeMatrix[c] = cascade.mLightSpaceMatrix;
+        block.sunCascadeRect[c] = glm::vec4(
+                (float)x / sunShadowTarget.mWidth, (float)y / sunShadowTarget.mHeight,
+                (float)size / sunShadowTarget.mWidth, (float)size / sunShadowTarget.mHeight);
+        // Views without cascades yet get no sun shadow.
+        block.sunCascadeSplits[c] = cascade.mValid ? cascade.mSplitFar : 0.0f;
+    }
+    for (int shadowNum = 0; shadowNum < MAX_SPOT_SHADOWS; shadowNum++) {
+        //if (spotLightShadows[i].mForLightIdx == -1) continue;
+        block.spotLightSpaceMatrix[shadowNum] = spotLightShadows[shadowNum].lightSpaceMatrix;
+        // Shadows that got no tile have a size of 0, which the shader skips.
+        const ShadowTile &tile = spotShadowTiles[shadowNum];
+        float atlasSize = (float)SDL_max(spotShadowAtlas.GetAtlasSize(), 1);
+        block.spotShadowRect[shadowNum] = glm::vec4(tile.mX, tile.mY,
+                                                    tile.mSize, tile.mSize) / atlasSize;
+    }
+    UploadShadowsBlock(block);
     GLERR;
 }
 
 
-void Render::SetSunShadowUniforms(ShaderProg pbrShader)
+void Render::BindShadowMaps()
 {
-    pbrShader.SetMat4fv((char*)"lightSpaceMatrix", glm::value_ptr(lightSpaceMatrix));
     // Sun shadow map is on texture8
     glActiveTexture(GL_TEXTURE8);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    pbrShader.SetInt((char*)"shadowMap", 8);
+    glBindTexture(GL_TEXTURE_2D, sunShadowTarget.mDepthTex);
+    // Spot light shadow atlas is on texture9
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, spotShadowTarget.mDepthTex);
+    //glBindTexture(GL_TEXTURE_2D_ARRAY, GetSpotShadowTexArray());
     glActiveTexture(GL_TEXTURE0);
     GLERR;
 }
 
 
-void Render::SetSpotShadowUniforms(ShaderProg pbrShader)
+void Render::InitShadows()
 {
-    char uniformName[64];
-    for (int shadowNum = 0; shadowNum < MAX_SPOT_SHADOWS; shadowNum++) {
-        //if (spotLightShadows[i].mForLightIdx == -1) continue;
-        //SDL_snprintf(uniformName, 64, "spotLightShadowMaps[%d]", shadowNum);
-        //pbrShader.SetInt(uniformName, 9 + shadowNum);
-        SDL_snprintf(uniformName, 64, "spotLightSpaceMatrix[%d]", shadowNum);
-        GLERR;
-        pbrShader.SetMat4fv(uniformName, glm::value_ptr(spotLightShadows[shadowNum].lightSpaceMatrix));
-        //glActiveTexture(GL_TEXTURE9 + shadowNum);
-        //glBindTexture(GL_TEXTURE_2D, spotLightShadows[shadowNum].mShadowTex);
+    sunShadowTarget.mName = "Sun cascades";
+    sunShadowTarget.mDepthFormat = GL_DEPTH_COMPONENT24;
+    sunShadowTarget.mDepthIsTexture = true;
+    sunShadowTarget.mBorderDepth = 1.0f;
+
+    spotShadowTarget.mName = "Spot shadow atlas";
+    spotShadowTarget.mDepthFormat = GL_DEPTH_COMPONENT24;
+    spotShadowTarget.mDepthIsTexture = true;
+    spotShadowTarget.mBorderDepth = 1.0f;
+
+    sunShadowCacheTarget.mName = "Sun cache";
+    sunShadowCacheTarget.mDepthFormat = sunShadowTarget.mDepthFormat;
+    sunShadowCacheTarget.mDepthIsTexture = true;
+    spotShadowCacheTarget.mName = "Spot cache";
+    spotShadowCacheTarget.mDepthFormat = spotShadowTarget.mDepthFormat;
+    spotShadowCacheTarget.mDepthIsTexture = true;
+
+    SetShadowQuality(shadowQuality);
+}
+
+
+void Render::SetShadowQuality(int quality)
+{
+    SDL_assert(quality >= 0 && quality < (int) SDL_arraysize(cSunCascadeSizes));
+    shadowQuality = quality;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        sunCascadeSizes[c] = cSunCascadeSizes[quality][c];
     }
+    spotShadowSize = cSpotShadowSizes[quality];
     GLERR;
-    glActiveTexture(GL_TEXTURE9);
-    glBindTexture(GL_TEXTURE_2D, spotShadowTexAtlas);
-    //glBindTexture(GL_TEXTURE_2D_ARRAY, GetSpotShadowTexArray());
-    GLERR;
-    SDL_snprintf(uniformName, 64, "spotLightShadowMapAtlas");
-    pbrShader.SetInt(uniformName, 9);
-    //pbrShader.SetInt((char*)"shadowSize", SPOT_SHADOW_SIZE);
+    CreateSunShadowAtlas(SDL_max(sunShadowViews, 1));
+    int spotAtlasSize = cSpotAtlasSizes[quality];
+    CreateRenderTarget(&spotShadowTarget, spotAtlasSize, spotAtlasSize);
+    spotShadowAtlas.Init(spotAtlasSize, cMinSpotShadowSize);
+    for (int s = 0; s < MAX_SPOT_SHADOWS; s++) {
+        spotShadowTiles[s] = ShadowTile();
+        spotShadowRequests[s] = 0;
+    }
+    UpdateShadowCacheTargets();
     GLERR;
 }
 
 
-void Render::InitShadows()
+void Render::SunShadowDebugGUI()
 {
-    // Shadow Map
-    GLERR;
-    //CreateShadowTextureArray(&spotShadowTexArray, SPOT_SHADOW_SIZE, SPOT_SHADOW_SIZE, 1.0f);
-    CreateShadowTextureAtlas(&spotShadowTexAtlas);
-    GLERR;
-    CreateShadowFBOForExistingTex(&spotShadowFBO, spotShadowTexAtlas);
-    //SDL_Log("spotShadowTexArray = %d", spotShadowTexArray);
-    GLERR;
-    // Sun shadow FBO
-    CreateShadowFBO(&depthMapFBO, &depthMap, SHADOW_WIDTH, SHADOW_HEIGHT, 1.0f);
-    SDL_Log("spotShadowTexAtlas = %d", spotShadowTexAtlas);
-    SDL_Log("spotShadowFBO = %d", spotShadowFBO);
-    GLERR;
-    // Spotlight shadows
-    /*
-    for (int i = 0; i < MAX_SPOT_SHADOWS; i++) {
-        //CreateShadowFBOForTexLayer(&(spotLightShadows[i].mShadowFBO), spotShadowTexArray, i);
-        //SDL_Log("Shadow FBO %d = %d", i, spotLightShadows[i].mShadowFBO);
+    ImGui::SliderFloat("Sun shadow distance", &sunShadowDistance, 20.0f, 500.0f);
+    ImGui::SliderFloat("Cascade split lambda", &sunCascadeSplitLambda, 0.0f, 1.0f);
+    const char *sizes[] = {"256", "512", "1024", "2048", "4096"};
+    bool resized = false;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        ImGui::PushID(c);
+        int sizeIdx = 0;
+        while (sizeIdx < 4 && (256 << sizeIdx) < sunCascadeSizes[c]) {
+            sizeIdx++;
+        }
+        ImGui::Text("Cascade %d", c);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(80.0f);
+        if (ImGui::Combo("Size", &sizeIdx, sizes, IM_ARRAYSIZE(sizes))) {
+            sunCascadeSizes[c] = 256 << sizeIdx;
+            resized = true;
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(80.0f);
+        ImGui::SliderInt("Update every N frames", &sunCascadeIntervals[c], 1, 8);
+        ImGui::PopID();
     }
-    */
+    if (resized) {
+        CreateSunShadowAtlas(SDL_max(sunShadowViews, 1));
+    }
+    ImGui::Text("Sun cascades drawn last frame: %d", lastCascadesDrawn);
+    if (ImGui::Checkbox("Shadow caching", &shadowCaching)) {
+        UpdateShadowCacheTargets();
+        InvalidateShadowCache();
+    }
+    if (shadowCaching) {
+        ImGui::Text("    Static shadow tiles redrawn last frame: %d", lastStaticRedraws);
+    }
+}
+
 
-    //CreateShadowFBO(&testShadowFBO, &testShadowTex, SPOT_SHADOW_SIZE, SPOT_SHADOW_SIZE, 1.0f);
-    //CreateShadowFBOForTexLayer(&testShadowFBO, spotShadowTexArray, 0);
+void Render::SpotShadowDebugGUI()
+{
+    ImGui::SliderFloat("Spot shadow resolution scale", &spotShadowResolutionScale,
+                       0.25f, 4.0f);
+    ImGui::Text("Spot shadow atlas: %d x %d, %.0f%% used",
+                spotShadowAtlas.GetAtlasSize(), spotShadowAtlas.GetAtlasSize(),
+                spotShadowAtlas.GetUsage() * 100.0f);
+    for (int s = 0; s < numActiveSpotShadows; s++) {
+        const ShadowTile &tile = spotShadowTiles[s];
+        ImGui::Text("    Light %d: %d (wanted %d) at %d, %d",
+                    spotLightShadows[s].mForLightIdx, tile.mSize,
+                    spotShadowRequests[s], tile.mX, tile.mY);
+    }
 }
 
+
+int Render::GetShadowQuality()                  { return shadowQuality; }
+void Render::SetShadowsEnabled(bool enabled)    { shadowsEnabled = enabled; }
+bool Render::GetShadowsEnabled()                { return shadowsEnabled; }
+int Render::GetNumActiveSpotShadows()           { return numActiveSpotShadows; }
+
 int Render::GetSpotLightShadowNumForLightIdx(int i)
 {
     for (int j=0; j < MAX_SPOT_SHADOWS; j++) {
@@ -335,5 +761,5 @@ int Render::GetSpotLightShadowNumForLightIdx(int i)
 }
 
 //unsigned int Render::GetSpotShadowTexArray()    { return spotShadowTexArray; }
-unsigned int Render::GetSpotShadowTexAtlas()    { return spotShadowTexAtlas; }
+unsigned int Render::GetSpotShadowTexAtlas()    { return spotShadowTarget.mDepthTex; }
 //unsigned int Render::GetTestShadowTex()         { return testShadowTex; }
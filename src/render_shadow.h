@@ -1,26 +1,43 @@
 #pragma once
 
-#include <glm/glm.hpp>
+#include "render_queue.h"
 
-// Forward declarations
-struct ShaderProg;
+#include <glm/glm.hpp>
 
 namespace Render {
     //void PrepareShadowForLight(int shadowIdx, int spotLightIdx);
     void PrepareShadowForLight(int spotShadowNum, int spotLightIdx);
-    void CreateShadowFBO(unsigned int *inFBO, unsigned int *inTex,
-            unsigned int resW, unsigned int resH, float defaultLighting = 0.0f);
     void CreateShadowTextureArray(unsigned int *outTex,
             unsigned int resW, unsigned int resH, float defaultLighting = 0.0f);
     void CreateShadowFBOForTexLayer(unsigned int *outFBO, unsigned int tex, int layer);
-    void CreateShadowTextureAtlas(unsigned int *outTex);
-    void CreateShadowFBOForExistingTex(unsigned int *outFBO, unsigned int tex);
     void ShadowPass();
-    void RenderSceneShadow(glm::mat4 aLightSpaceMatrix);
-    void SetSunShadowUniforms(ShaderProg pbrShader);
+    /* Draws the casters chosen by casters with the light space matrix onto
+     * the bound FBO. */
+    void RenderSceneShadow(glm::mat4 aLightSpaceMatrix,
+                           ShadowCasters casters = CASTERS_ALL);
+    /* Uploads the sun cascades of a split screen view and the spot light
+     * shadow matrices to the shadows uniform block. Call before drawing each
+     * view, after ShadowPass(). */
+    void UploadShadowUniforms(int viewIdx);
+    /* Binds the shadow maps to the texture units used by the PBR shader. */
+    void BindShadowMaps();
     void InitShadows();
+    /* Shadow quality from 0 (low) to 2 (high). Changing the quality rebuilds
+     * the shadow render targets. */
+    void SetShadowQuality(int quality);
+    int GetShadowQuality();
+    /* Distance, split and per cascade resolution and update interval of the
+     * sun's cascaded shadow maps. */
+    void SunShadowDebugGUI();
+    void SpotShadowDebugGUI();
+    /* With shadows off the shadow pass is skipped and the scene is drawn
+     * with shader variants that don't sample the shadow maps. */
+    void SetShadowsEnabled(bool enabled);
+    bool GetShadowsEnabled();
+    /* Number of spot light shadow maps drawn in the last ShadowPass(). They
+     * are always shadow numbers 0 to n - 1. */
+    int GetNumActiveSpotShadows();
     unsigned int GetSpotShadowTexArray();    
-    void SetSpotShadowUniforms(ShaderProg pbrShader);
     int GetSpotLightShadowNumForLightIdx(int i);
     unsigned int GetSpotShadowTexAtlas();
     //unsigned int GetTestShadowTex();
@@ -0,0 +1,109 @@
+#include "render_ubo.h"
+#include "render_defines.h"
+#include "render_clusters.h"
+#include "shader.h"
+#include "glerr.h"
+
+#include <SDL3/SDL.h>
+
+#include <glm/glm.hpp>
+
+static_assert(sizeof(Render::CameraBlock) == 176, "CameraBlock must match std140");
+static_assert(sizeof(Render::LightsBlock) == 32, "LightsBlock must match std140");
+
+static unsigned int cameraUBO = 0;
+static unsigned int lightsUBO = 0;
+static unsigned int shadowsUBO = 0;
+
+
+static unsigned int CreateUniformBuffer(size_t size, unsigned int binding)
+{
+    unsigned int ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    GLERR;
+    return ubo;
+}
+
+
+static void UploadUniformBuffer(unsigned int ubo, const void *data, size_t size)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+
+static void BindBlock(const ShaderProg &shader, const char *name,
+                      unsigned int binding)
+{
+    unsigned int idx = glGetUniformBlockIndex(shader.id, name);
+    if (idx == GL_INVALID_INDEX) return;
+    glUniformBlockBinding(shader.id, idx, binding);
+}
+
+
+void Render::InitUniformBlocks()
+{
+    cameraUBO = CreateUniformBuffer(sizeof(CameraBlock), UBO_BINDING_CAMERA);
+    lightsUBO = CreateUniformBuffer(sizeof(LightsBlock), UBO_BINDING_LIGHTS);
+    shadowsUBO = CreateUniformBuffer(sizeof(ShadowsBlock), UBO_BINDING_SHADOWS);
+
+    // Start with no lights so nothing is lit by uninitialised data.
+    LightsBlock emptyLights = {};
+    UploadLightsBlock(emptyLights);
+}
+
+
+void Render::DestroyUniformBlocks()
+{
+    glDeleteBuffers(1, &cameraUBO);
+    glDeleteBuffers(1, &lightsUBO);
+    glDeleteBuffers(1, &shadowsUBO);
+    cameraUBO = lightsUBO = shadowsUBO = 0;
+}
+
+
+void Render::BindUniformBlocks(const ShaderProg &shader)
+{
+    BindBlock(shader, "Camera", UBO_BINDING_CAMERA);
+    BindBlock(shader, "Lights", UBO_BINDING_LIGHTS);
+    BindBlock(shader, "Shadows", UBO_BINDING_SHADOWS);
+    GLERR;
+}
+
+
+void Render::UploadCameraBlock(const glm::mat4 &view, const glm::mat4 &projection,
+                               const int viewport[4])
+{
+    CameraBlock block;
+    block.view = view;
+    block.projection = projection;
+    // Camera position is the translation of the inverse view matrix.
+    block.camPos = glm::vec4(glm::vec3(glm::inverse(view)[3]), 1.0f);
+    block.viewport = glm::vec4(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    // Must give the same slices as SliceDepth() in render_clusters.cpp.
+    float near, far;
+    GetProjectionNearFar(projection, &near, &far);
+    float clusterNear = SDL_max(near, CLUSTER_NEAR);
+    block.clusterParams = glm::vec4(clusterNear,
+                                    CLUSTER_SLICES_Z / SDL_logf(far / clusterNear),
+                                    0.0f, 0.0f);
+    UploadUniformBuffer(cameraUBO, &block, sizeof(block));
+}
+
+
+void Render::UploadLightsBlock(const LightsBlock &block)
+{
+    UploadUniformBuffer(lightsUBO, &block, sizeof(block));
+}
+
+
+void Render::UploadShadowsBlock(const ShadowsBlock &block)
+{
+    UploadUniformBuffer(shadowsUBO, &block, sizeof(block));
+}
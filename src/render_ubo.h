@@ -0,0 +1,68 @@
+#pragma once
+
+#include "render_defines.h"
+
+#include <glm/glm.hpp>
+
+// Forward declarations
+struct ShaderProg;
+
+namespace Render {
+    /* These structs mirror the std140 uniform blocks declared in the shaders.
+     * Only vec4, ivec4 and mat4 members are used so that the C++ layout is
+     * the same as std140 without any manual padding. */
+    struct CameraBlock
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 camPos;
+        // x, y, width, height of the view in pixels
+        glm::vec4 viewport;
+        // x: depth of the first cluster slice, y: slices per log depth
+        glm::vec4 clusterParams;
+    };
+
+    struct DirLightStd140
+    {
+        glm::vec4 direction;
+        glm::vec4 colour;
+    };
+
+    /* Point and spot lights are in the cluster buffer textures instead, see
+     * render_clusters.h. */
+    struct LightsBlock
+    {
+        DirLightStd140 dirLight;
+    };
+
+    /* Uploaded for each view, as every split screen view has its own sun
+     * cascades. */
+    struct ShadowsBlock
+    {
+        // World to light clip space of each sun cascade of the view
+        glm::mat4 sunCascadeMatrix[SUN_CASCADES];
+        // xy: offset and zw: size of each cascade in the atlas, in texture
+        // coordinates
+        glm::vec4 sunCascadeRect[SUN_CASCADES];
+        // View depth of the far end of each cascade
+        glm::vec4 sunCascadeSplits;
+        glm::mat4 spotLightSpaceMatrix[MAX_SPOT_SHADOWS];
+        // xy: offset and zw: size of each spot shadow's tile in the atlas, in
+        // texture coordinates. The size is 0 if the shadow got no tile.
+        glm::vec4 spotShadowRect[MAX_SPOT_SHADOWS];
+    };
+
+    void InitUniformBlocks();
+    void DestroyUniformBlocks();
+    /* Points the Camera, Lights and Shadows blocks of the shader at their
+     * binding points. Blocks the shader does not use are skipped. */
+    void BindUniformBlocks(const ShaderProg &shader);
+    /* Upload the view dependent data. Call once per view. viewport is x, y,
+     * width and height as returned by glGetIntegerv(GL_VIEWPORT). */
+    void UploadCameraBlock(const glm::mat4 &view, const glm::mat4 &projection,
+                           const int viewport[4]);
+    /* Upload light data. Call once per frame. */
+    void UploadLightsBlock(const LightsBlock &block);
+    /* Upload shadow data. Call once per view. */
+    void UploadShadowsBlock(const ShadowsBlock &block);
+}
@@ -62,12 +62,12 @@ void Render::DrawRect(float x, float y, float w, float h, glm::vec4 colour)
     glBindVertexArray(uiQuadVAO);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, gDefaultTexture.id);
-    uiShader.SetVec4((char*)"colourMod", glm::value_ptr(colour));
-    uiShader.SetMat4fv((char*)"trans", glm::value_ptr(trans));
+    uiShader.SetVec4("colourMod"_u, glm::value_ptr(colour));
+    uiShader.SetMat4fv("trans"_u, glm::value_ptr(trans));
     glDrawArrays(GL_TRIANGLES, 0, 6);
 
     const glm::vec4 white = glm::vec4(1, 1, 1, 1);
-    uiShader.SetVec4((char*)"colourMod", glm::value_ptr(white));
+    uiShader.SetVec4("colourMod"_u, glm::value_ptr(white));
 }
 
 
@@ -75,7 +75,7 @@ void Render::RenderText(Font::Face *face, std::string text, float x, float y,
                         float scale, glm::vec3 colour)
 {
     glUseProgram(textShader.id);
-    textShader.SetVec3((char*)"textColour", colour.x, colour.y, colour.z);
+    textShader.SetVec3("textColour"_u, colour.x, colour.y, colour.z);
     glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(textVAO);
 
@@ -190,8 +190,7 @@ void Render::RenderUIAnchored(Texture tex, glm::vec2 scale, glm::vec2 margin,
     // Draw the texture
     glUseProgram(uiShader.id);
     GLERR;
-    uiShader.SetMat4fv((char*)"trans", glm::value_ptr(trans));
-    uiShader.SetMat4fv((char*)"proj", glm::value_ptr(uiProj));
+    uiShader.SetMat4fv("trans"_u, glm::value_ptr(trans));
     glBindVertexArray(uiQuadVAO);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, tex.id);
@@ -1,19 +1,44 @@
 #include "shader.h"
+#include "shader_cache.h"
+#include "gl_ext.h"
 #include "../glad/glad.h"
 #include "glerr.h"
 
 #include <SDL3/SDL.h>
 
+#include <algorithm>
+#include <string>
 
+static int uniformLookupsAvoided = 0;
+static int lastUniformLookupsAvoided = 0;
 
-unsigned int CreateShaderFromFile(const char* filename, const int shaderType) {
-    char *shaderSource = (char*)SDL_LoadFile(filename, NULL);
-    if (shaderSource == NULL) {
-        SDL_Log("Could not load shader file %s: %s", filename, SDL_GetError());
+
+
+/* Compiles source, inserting defines after the #version line. The source is
+ * passed in parts so that it doesn't need to be copied. */
+static unsigned int CreateShaderFromSource(const char *filename, const char *source,
+                                           const int shaderType, const char *defines)
+{
+    // #version has to come first, so the defines go after it.
+    const char *body = source;
+    if (SDL_strncmp(body, "#version", 8) == 0) {
+        const char *lineEnd = SDL_strchr(body, '\n');
+        body = lineEnd ? lineEnd + 1 : body + SDL_strlen(body);
     }
+    const char *sources[4] = {
+        source,
+        defines ? defines : "",
+        // Restore the line numbers of the file after the defines.
+        body != source ? "#line 2\n" : "",
+        body
+    };
+    int lengths[4] = {
+        (int)(body - source), -1, -1, -1
+    };
+
     unsigned int shaderId;
     shaderId = glCreateShader(shaderType);
-    glShaderSource(shaderId, 1, &shaderSource, NULL);
+    glShaderSource(shaderId, 4, sources, lengths);
     glCompileShader(shaderId);
 
     int success;
@@ -27,12 +52,89 @@ unsigned int CreateShaderFromFile(const char* filename, const int shaderType) {
     return shaderId;
 }
 
-ShaderProg CreateAndLinkShaderProgram(unsigned int vertexShader, 
-                                      unsigned int fragmentShader)
+
+static char* LoadSourceFile(const char *filename)
+{
+    char *shaderSource = (char*)SDL_LoadFile(filename, NULL);
+    if (shaderSource == NULL) {
+        SDL_Log("Could not load shader file %s: %s", filename, SDL_GetError());
+        shaderSource = SDL_strdup("");
+    }
+    return shaderSource;
+}
+
+
+/* Appends source to out with every #include "file" line replaced by the
+ * contents of file, which is relative to the directory of filename. #line
+ * directives keep the line numbers of compile errors right within each
+ * file. */
+static void ExpandIncludes(const char *filename, const char *source,
+                           std::string &out, int depth)
+{
+    const char *slash = SDL_strrchr(filename, '/');
+    std::string directory(filename, slash ? slash + 1 - filename : 0);
+
+    const char *line = source;
+    int lineNum = 1;
+    while (*line != '\0') {
+        const char *lineEnd = SDL_strchr(line, '\n');
+        const char *next = lineEnd ? lineEnd + 1 : line + SDL_strlen(line);
+        const char *path = nullptr;
+        const char *pathEnd = nullptr;
+        if (SDL_strncmp(line, "#include \"", 10) == 0) {
+            path = line + 10;
+            pathEnd = SDL_strchr(path, '"');
+        }
+
+        if (pathEnd == nullptr || pathEnd >= next) {
+            out.append(line, next - line);
+        }
+        else if (depth >= 8) {
+            SDL_Log("Shader includes in %s are nested too deeply", filename);
+        }
+        else {
+            std::string includePath = directory + std::string(path, pathEnd - path);
+            char *included = LoadSourceFile(includePath.c_str());
+            out += "#line 1\n";
+            ExpandIncludes(includePath.c_str(), included, out, depth + 1);
+            SDL_free(included);
+            out += "\n#line " + std::to_string(lineNum + 1) + "\n";
+        }
+        line = next;
+        lineNum++;
+    }
+}
+
+
+/* Loads a shader with its includes expanded. The program cache hashes the
+ * result, so changing an included file also changes the key of every program
+ * that includes it. */
+static char* LoadShaderFile(const char *filename)
+{
+    char *shaderSource = LoadSourceFile(filename);
+    if (SDL_strstr(shaderSource, "#include") == nullptr) {
+        return shaderSource;
+    }
+    std::string expanded;
+    ExpandIncludes(filename, shaderSource, expanded, 0);
+    SDL_free(shaderSource);
+    return SDL_strdup(expanded.c_str());
+}
+
+
+unsigned int CreateShaderFromFile(const char* filename, const int shaderType,
+                                  const char *defines)
+{
+    char *shaderSource = LoadShaderFile(filename);
+    unsigned int shaderId = CreateShaderFromSource(filename, shaderSource,
+                                                   shaderType, defines);
+    SDL_free(shaderSource);
+    return shaderId;
+}
+
+
+static void LinkProgram(unsigned int shaderProgId)
 {
-    unsigned int shaderProgId = glCreateProgram();
-    glAttachShader(shaderProgId, vertexShader);
-    glAttachShader(shaderProgId, fragmentShader);
     glLinkProgram(shaderProgId);
 
     int success;
@@ -45,49 +147,289 @@ ShaderProg CreateAndLinkShaderProgram(unsigned int vertexShader,
     else {
         SDL_Log("Successfully created shader program %u", shaderProgId);
     }
+}
+
+
+ShaderProg CreateAndLinkShaderProgram(unsigned int vertexShader, 
+                                      unsigned int fragmentShader)
+{
+    unsigned int shaderProgId = glCreateProgram();
+    glAttachShader(shaderProgId, vertexShader);
+    glAttachShader(shaderProgId, fragmentShader);
+    LinkProgram(shaderProgId);
 
     ShaderProg program;
     program.id = shaderProgId;
+    program.Reflect();
     return program;
 }
 
 
-void ShaderProg::SetInt(char uniformName[], int value)
+ShaderProg CreateShaderProgramFromFiles(const char *vertexFile,
+                                        const char *fragmentFile,
+                                        const char *defines)
 {
-    glUniform1i(glGetUniformLocation(id, uniformName), value);
+    char *vertexSource = LoadShaderFile(vertexFile);
+    char *fragmentSource = LoadShaderFile(fragmentFile);
+    if (defines == nullptr) defines = "";
+
+    // The key covers everything that changes the linked program. The
+    // separators stop different splits of the same text from matching.
+    uint64_t key = ShaderKeyBase();
+    key = HashShaderKey(key, vertexSource, SDL_strlen(vertexSource) + 1);
+    key = HashShaderKey(key, fragmentSource, SDL_strlen(fragmentSource) + 1);
+    key = HashShaderKey(key, defines, SDL_strlen(defines) + 1);
+
+    ShaderProg program;
+    program.id = LoadCachedProgram(key);
+    if (program.id == 0) {
+        unsigned int vShader = CreateShaderFromSource(
+                vertexFile, vertexSource, GL_VERTEX_SHADER, defines);
+        unsigned int fShader = CreateShaderFromSource(
+                fragmentFile, fragmentSource, GL_FRAGMENT_SHADER, defines);
+        program.id = glCreateProgram();
+        glAttachShader(program.id, vShader);
+        glAttachShader(program.id, fShader);
+        PrepareProgramForCache(program.id);
+        LinkProgram(program.id);
+        // The program keeps the compiled code, the shader objects aren't
+        // needed.
+        glDetachShader(program.id, vShader);
+        glDetachShader(program.id, fShader);
+        glDeleteShader(vShader);
+        glDeleteShader(fShader);
+
+        int success;
+        glGetProgramiv(program.id, GL_LINK_STATUS, &success);
+        if (success) {
+            StoreCachedProgram(key, program.id);
+        }
+    }
+    SDL_free(vertexSource);
+    SDL_free(fragmentSource);
+
+    program.Reflect();
+    return program;
 }
 
-void ShaderProg::SetFloat(char uniformName[], float value)
+
+ShaderProg CreateComputeProgramFromFile(const char *computeFile,
+                                        const char *defines)
 {
-    glUniform1f(glGetUniformLocation(id, uniformName), value);
+    char *computeSource = LoadShaderFile(computeFile);
+    if (defines == nullptr) defines = "";
+
+    uint64_t key = ShaderKeyBase();
+    key = HashShaderKey(key, computeSource, SDL_strlen(computeSource) + 1);
+    key = HashShaderKey(key, defines, SDL_strlen(defines) + 1);
+
+    ShaderProg program;
+    program.id = LoadCachedProgram(key);
+    if (program.id == 0) {
+        unsigned int cShader = CreateShaderFromSource(
+                computeFile, computeSource, GL_COMPUTE_SHADER, defines);
+        program.id = glCreateProgram();
+        glAttachShader(program.id, cShader);
+        PrepareProgramForCache(program.id);
+        LinkProgram(program.id);
+        glDetachShader(program.id, cShader);
+        glDeleteShader(cShader);
+
+        int success;
+        glGetProgramiv(program.id, GL_LINK_STATUS, &success);
+        if (success) {
+            StoreCachedProgram(key, program.id);
+        }
+    }
+    SDL_free(computeSource);
+
+    program.Reflect();
+    return program;
 }
 
-void ShaderProg::SetMat4fv(char uniformName[], const float *matrix)
+
+static void AddUniform(std::vector<UniformInfo> &uniforms, const char *name,
+                       int location)
+{
+    if (location == -1) return;
+    uniforms.push_back({HashUniformName(name), location});
+}
+
+
+void ShaderProg::Reflect()
 {
+    uniforms.clear();
+    int numUniforms = 0;
+    int maxNameLength = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    std::vector<char> name(maxNameLength + 16);
+    char elementName[256];
+    for (int i = 0; i < numUniforms; i++) {
+        int nameLength;
+        int arraySize;
+        GLenum type;
+        glGetActiveUniform(id, i, maxNameLength, &nameLength, &arraySize,
+                           &type, name.data());
+        // Uniforms in uniform blocks don't have a location.
+        int location = glGetUniformLocation(id, name.data());
+        if (location == -1) continue;
+
+        AddUniform(uniforms, name.data(), location);
+        // Arrays are reported as "name[0]". Store the other elements
+        // individually, and also store "name" because it refers to the first
+        // element.
+        if (nameLength > 3 && SDL_strcmp(name.data() + nameLength - 3, "[0]") == 0) {
+            name[nameLength - 3] = '\0';
+            AddUniform(uniforms, name.data(), location);
+            for (int j = 1; j < arraySize; j++) {
+                SDL_snprintf(elementName, sizeof(elementName), "%s[%d]",
+                             name.data(), j);
+                AddUniform(uniforms, elementName,
+                           glGetUniformLocation(id, elementName));
+            }
+        }
+    }
+
+    std::sort(uniforms.begin(), uniforms.end(),
+              [](const UniformInfo &a, const UniformInfo &b) {
+                  return a.hash < b.hash;
+              });
+    for (size_t i = 1; i < uniforms.size(); i++) {
+        if (uniforms[i].hash == uniforms[i - 1].hash) {
+            SDL_Log("Warning: Uniform name hash collision in shader program %u "
+                    "(locations %d and %d)", id, uniforms[i - 1].location,
+                    uniforms[i].location);
+        }
+    }
     GLERR;
-    GLint loc = glGetUniformLocation(id, uniformName); 
+}
+
+
+int ShaderProg::GetLocation(UniformName name) const
+{
+    auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash,
+                               [](const UniformInfo &info, uint32_t hash) {
+                                   return info.hash < hash;
+                               });
+    if (it == uniforms.end() || it->hash != name.hash) {
+        return -1;
+    }
+    return it->location;
+}
+
+
+int ShaderProg::GetLocation(const char *name) const
+{
+    return GetLocation(UniformName{HashUniformName(name)});
+}
+
+
+void ShaderProg::SetInt(UniformName name, int value) const
+{
+    SetInt(GetLocation(name), value);
+}
+
+void ShaderProg::SetFloat(UniformName name, float value) const
+{
+    SetFloat(GetLocation(name), value);
+}
+
+void ShaderProg::SetMat4fv(UniformName name, const float *matrix) const
+{
+    SetMat4fv(GetLocation(name), matrix);
+}
+
+void ShaderProg::SetVec2(UniformName name, float x, float y) const
+{
+    SetVec2(GetLocation(name), x, y);
+}
+
+void ShaderProg::SetVec3(UniformName name, const float *vec3) const
+{
+    SetVec3(GetLocation(name), vec3);
+}
+
+void ShaderProg::SetVec3(UniformName name, float x, float y, float z) const
+{
+    SetVec3(GetLocation(name), x, y, z);
+}
+
+void ShaderProg::SetVec4(UniformName name, const float *vec4) const
+{
+    SetVec4(GetLocation(name), vec4);
+}
+
+void ShaderProg::SetVec4(UniformName name, float x, float y, float z, float w) const
+{
+    SetVec4(GetLocation(name), x, y, z, w);
+}
+
+
+void ShaderProg::SetInt(int location, int value) const
+{
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform1i(location, value);
+}
+
+void ShaderProg::SetFloat(int location, float value) const
+{
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform1f(location, value);
+}
+
+void ShaderProg::SetMat4fv(int location, const float *matrix) const
+{
+    uniformLookupsAvoided++;
+    if (location == -1) return;
     GLERR;
-    glUniformMatrix4fv(loc, 1, GL_FALSE, matrix);
+    glUniformMatrix4fv(location, 1, GL_FALSE, matrix);
     GLERR;
 }
 
+void ShaderProg::SetVec2(int location, float x, float y) const
+{
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform2f(location, x, y);
+}
 
-void ShaderProg::SetVec3(char uniformName[], const float *vec3)
+void ShaderProg::SetVec3(int location, const float *vec3) const
 {
-    glUniform3fv(glGetUniformLocation(id, uniformName), 1, vec3);
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform3fv(location, 1, vec3);
 }
 
-void ShaderProg::SetVec3(char uniformName[], float x, float y, float z)
+void ShaderProg::SetVec3(int location, float x, float y, float z) const
 {
-    glUniform3f(glGetUniformLocation(id, uniformName), x, y, z);
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform3f(location, x, y, z);
 }
 
-void ShaderProg::SetVec4(char uniformName[], const float *vec4)
+void ShaderProg::SetVec4(int location, const float *vec4) const
 {
-    glUniform4fv(glGetUniformLocation(id, uniformName), 1, vec4);
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform4fv(location, 1, vec4);
 }
 
-void ShaderProg::SetVec4(char uniformName[], float x, float y, float z, float w)
+void ShaderProg::SetVec4(int location, float x, float y, float z, float w) const
+{
+    uniformLookupsAvoided++;
+    if (location == -1) return;
+    glUniform4f(location, x, y, z, w);
+}
+
+
+int GetUniformLookupsAvoided()      { return lastUniformLookupsAvoided; }
+
+void ResetUniformLookupCounter()
 {
-    glUniform4f(glGetUniformLocation(id, uniformName), x, y, z, w);
+    lastUniformLookupsAvoided = uniformLookupsAvoided;
+    uniformLookupsAvoided = 0;
 }
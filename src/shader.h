@@ -1,19 +1,97 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/* FNV-1a hash of a uniform name. This is constexpr so that names written in
+ * the source can be hashed at compile time. */
+constexpr uint32_t HashUniformName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (uint8_t) *name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* A hashed uniform name. Write "name"_u to hash a name at compile time. */
+struct UniformName {
+    uint32_t hash;
+};
+
+constexpr UniformName operator""_u(const char *name, size_t)
+{
+    return UniformName{HashUniformName(name)};
+}
+
+struct UniformInfo {
+    uint32_t hash;
+    int location;
+};
+
 struct ShaderProg {
-    unsigned int id;
-
-    void SetInt(char uniformName[], int value);
-    void SetFloat(char uniformName[], float value);
-    void SetMat4fv(char uniformName[], const float *matrix);
-    void SetVec3(char uniformName[], const float *vec3);
-    void SetVec3(char uniformName[], float x, float y, float z);
-    void SetVec4(char uniformName[], const float *vec4);
-    void SetVec4(char uniformName[], float x, float y, float z, float w);
+    unsigned int id = 0;
+    // All active uniforms of the program sorted by the hash of their name.
+    // Array elements are stored individually, e.g. "lights[3].colour".
+    std::vector<UniformInfo> uniforms;
+
+    /* Fills in uniforms by querying the active uniforms of the linked
+     * program. Called by CreateAndLinkShaderProgram(). */
+    void Reflect();
+    /* Returns the location of a uniform, or -1 if it isn't active. These
+     * don't call glGetUniformLocation. */
+    int GetLocation(UniformName name) const;
+    int GetLocation(const char *name) const;
+
+    void SetInt(UniformName name, int value) const;
+    void SetFloat(UniformName name, float value) const;
+    void SetMat4fv(UniformName name, const float *matrix) const;
+    void SetVec2(UniformName name, float x, float y) const;
+    void SetVec3(UniformName name, const float *vec3) const;
+    void SetVec3(UniformName name, float x, float y, float z) const;
+    void SetVec4(UniformName name, const float *vec4) const;
+    void SetVec4(UniformName name, float x, float y, float z, float w) const;
+
+    // Setters for locations that were resolved ahead of time with
+    // GetLocation(). Locations of -1 are ignored.
+    void SetInt(int location, int value) const;
+    void SetFloat(int location, float value) const;
+    void SetMat4fv(int location, const float *matrix) const;
+    void SetVec2(int location, float x, float y) const;
+    void SetVec3(int location, const float *vec3) const;
+    void SetVec3(int location, float x, float y, float z) const;
+    void SetVec4(int location, const float *vec4) const;
+    void SetVec4(int location, float x, float y, float z, float w) const;
 };
 
-unsigned int CreateShaderFromFile(const char* filename, const int shaderType);
+/* Compiles a shader from a file. defines is inserted after the #version line,
+ * e.g. "#define FOO 1\n", so that one file can be built in several variants.
+ * Lines of the form #include "file" are replaced by file, relative to the
+ * including file, so that shaders can share code. Line numbers in compile
+ * errors still refer to the file. */
+unsigned int CreateShaderFromFile(const char* filename, const int shaderType,
+                                  const char *defines = nullptr);
 
 ShaderProg CreateAndLinkShaderProgram(unsigned int vertexShader, 
                                       unsigned int fragmentShader);
 
+/* Creates a program from a vertex and fragment shader file, both compiled
+ * with defines (see CreateShaderFromFile()). The linked program is loaded
+ * from the program binary cache if it is there, see shader_cache.h. Uniform
+ * values and block bindings are not cached, so set them afterwards. */
+ShaderProg CreateShaderProgramFromFiles(const char *vertexFile,
+                                        const char *fragmentFile,
+                                        const char *defines = nullptr);
+
+/* Same as CreateShaderProgramFromFiles() for a compute shader. Only call
+ * when GLEXT_ARB_compute_shader is set, see gl_ext.h. */
+ShaderProg CreateComputeProgramFromFile(const char *computeFile,
+                                        const char *defines = nullptr);
+
+/* Number of glGetUniformLocation calls that were avoided by using cached
+ * uniform locations between the last two calls to ResetUniformLookupCounter().
+ * The counter is reset once per frame, so this is the count of the last frame. */
+int GetUniformLookupsAvoided();
+void ResetUniformLookupCounter();
@@ -0,0 +1,190 @@
+#include "shader_cache.h"
+#include "gl_ext.h"
+#include "glerr.h"
+
+#include <SDL3/SDL.h>
+
+#include <vector>
+
+static constexpr uint32_t cCacheMagic = 0x4E494250; // "PBIN"
+static constexpr uint32_t cCacheVersion = 1;
+
+struct CacheFileHeader {
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint64_t mKey;
+    uint32_t mBinaryFormat;
+    uint32_t mBinaryLength;
+};
+
+static bool cacheEnabled = false;
+static char *cacheDir = nullptr;
+static uint64_t driverHash = 0;
+static int cacheHits = 0;
+static int cacheMisses = 0;
+
+
+static void GetCachePath(uint64_t key, char *outPath, size_t size)
+{
+    SDL_snprintf(outPath, size, "%s%016llx.bin", cacheDir,
+                 (unsigned long long)key);
+}
+
+
+void InitShaderCache()
+{
+    if (!GLEXT_ARB_get_program_binary) {
+        SDL_Log("Program binary cache disabled: not supported by the driver");
+        return;
+    }
+    int numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats == 0) {
+        SDL_Log("Program binary cache disabled: no binary formats");
+        return;
+    }
+
+    char *prefPath = SDL_GetPrefPath(NULL, "Car Game");
+    if (prefPath == nullptr) {
+        SDL_Log("Program binary cache disabled: %s", SDL_GetError());
+        return;
+    }
+    SDL_asprintf(&cacheDir, "%sshader_cache/", prefPath);
+    SDL_free(prefPath);
+    if (!SDL_CreateDirectory(cacheDir)) {
+        SDL_Log("Program binary cache disabled: could not create %s: %s",
+                cacheDir, SDL_GetError());
+        SDL_free(cacheDir);
+        cacheDir = nullptr;
+        return;
+    }
+
+    // Binaries are only valid for the driver that made them.
+    const char *driverStrings[] = {
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION),
+    };
+    driverHash = 14695981039346656037ull;
+    for (const char *str : driverStrings) {
+        if (str == nullptr) continue;
+        driverHash = HashShaderKey(driverHash, str, SDL_strlen(str) + 1);
+    }
+    cacheEnabled = true;
+    SDL_Log("Program binary cache: %s", cacheDir);
+    GLERR;
+}
+
+
+uint64_t HashShaderKey(uint64_t hash, const void *data, size_t size)
+{
+    // FNV-1a
+    const uint8_t *bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+uint64_t ShaderKeyBase()
+{
+    return driverHash;
+}
+
+
+unsigned int LoadCachedProgram(uint64_t key)
+{
+    if (!cacheEnabled) return 0;
+
+    char path[1024];
+    GetCachePath(key, path, sizeof(path));
+    size_t size = 0;
+    uint8_t *data = (uint8_t*)SDL_LoadFile(path, &size);
+    if (data == nullptr) {
+        cacheMisses++;
+        return 0;
+    }
+
+    CacheFileHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        SDL_memcpy(&header, data, sizeof(header));
+        valid = header.mMagic == cCacheMagic && header.mVersion == cCacheVersion
+             && header.mKey == key
+             && header.mBinaryLength == size - sizeof(header);
+    }
+
+    unsigned int program = 0;
+    if (valid) {
+        // Report errors from before the lookup, so that only the ones raised
+        // by glProgramBinary are cleared below.
+        GLERR;
+        program = glCreateProgram();
+        glProgramBinary(program, header.mBinaryFormat, data + sizeof(header),
+                        header.mBinaryLength);
+        // A binary in a format the driver no longer accepts raises an error
+        // as well as failing to link. It isn't a problem, the program is
+        // just compiled again.
+        glGetError();
+        int success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    SDL_free(data);
+
+    if (program == 0) {
+        SDL_Log("Discarding stale program binary %s", path);
+        SDL_RemovePath(path);
+        cacheMisses++;
+        return 0;
+    }
+    cacheHits++;
+    return program;
+}
+
+
+void StoreCachedProgram(uint64_t key, unsigned int program)
+{
+    if (!cacheEnabled) return;
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    std::vector<uint8_t> data(sizeof(CacheFileHeader) + length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format,
+                       data.data() + sizeof(CacheFileHeader));
+    GLERR;
+
+    CacheFileHeader header;
+    header.mMagic = cCacheMagic;
+    header.mVersion = cCacheVersion;
+    header.mKey = key;
+    header.mBinaryFormat = format;
+    header.mBinaryLength = length;
+    SDL_memcpy(data.data(), &header, sizeof(header));
+
+    char path[1024];
+    GetCachePath(key, path, sizeof(path));
+    if (!SDL_SaveFile(path, data.data(), sizeof(header) + length)) {
+        SDL_Log("Could not save program binary %s: %s", path, SDL_GetError());
+    }
+}
+
+
+void PrepareProgramForCache(unsigned int program)
+{
+    if (!cacheEnabled) return;
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+
+bool IsShaderCacheEnabled()     { return cacheEnabled; }
+int GetShaderCacheHits()        { return cacheHits; }
+int GetShaderCacheMisses()      { return cacheMisses; }
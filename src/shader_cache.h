@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * On-disk cache of linked program binaries, stored in the user's pref path.
+ * Entries are keyed by a hash of everything that goes into the program (see
+ * HashShaderKey()), which includes the GL vendor, renderer and version
+ * strings, so a driver update gives new keys instead of stale binaries. If
+ * the driver doesn't support GL_ARB_get_program_binary the cache is off and
+ * every lookup misses.
+ */
+
+/* Call after the GL context is created and LoadGLExtensions() is called. */
+void InitShaderCache();
+/* Adds data to a key that was started with ShaderKeyBase(). */
+uint64_t HashShaderKey(uint64_t hash, const void *data, size_t size);
+/* Starting hash of a key for the current driver. */
+uint64_t ShaderKeyBase();
+/* Returns a linked program created from the cached binary for key, or 0 if
+ * there is none or the driver rejected it. */
+unsigned int LoadCachedProgram(uint64_t key);
+/* Saves the binary of a linked program. The program should have been linked
+ * with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set, see PrepareProgramForCache(). */
+void StoreCachedProgram(uint64_t key, unsigned int program);
+/* Sets the hint that lets the binary be retrieved. Call before linking. */
+void PrepareProgramForCache(unsigned int program);
+bool IsShaderCacheEnabled();
+/* Number of programs loaded from and missing from the cache since start. */
+int GetShaderCacheHits();
+int GetShaderCacheMisses();
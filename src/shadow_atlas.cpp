@@ -0,0 +1,123 @@
+#include "shadow_atlas.h"
+
+#include <SDL3/SDL.h>
+
+
+void ShadowAtlas::Init(int atlasSize, int minTileSize)
+{
+    SDL_assert(atlasSize > 0 && (atlasSize & (atlasSize - 1)) == 0);
+    SDL_assert(minTileSize > 0 && minTileSize <= atlasSize
+               && (minTileSize & (minTileSize - 1)) == 0);
+    mAtlasSize = atlasSize;
+    mMinTileSize = minTileSize;
+    mNumLevels = 1;
+    while ((atlasSize >> mNumLevels) >= minTileSize) {
+        mNumLevels++;
+    }
+    // 4^0 + 4^1 + ... + 4^(levels - 1)
+    size_t numNodes = ((size_t(1) << (2 * mNumLevels)) - 1) / 3;
+    mNodes.assign(numNodes, NODE_FREE);
+    mUsedArea = 0;
+}
+
+
+int ShadowAtlas::NodeIndex(int level, int x, int y) const
+{
+    int levelStart = ((1 << (2 * level)) - 1) / 3;
+    return levelStart + y * (1 << level) + x;
+}
+
+
+/* Depth first search for a free node at targetLevel. Subtrees that are
+ * already split are tried before free ones, so that big free nodes are only
+ * broken up when they have to be. */
+bool ShadowAtlas::AllocateNode(int level, int x, int y, int targetLevel,
+                               ShadowTile *outTile)
+{
+    NodeState &state = mNodes[NodeIndex(level, x, y)];
+    if (state == NODE_USED) return false;
+    if (level == targetLevel) {
+        if (state != NODE_FREE) return false;
+        state = NODE_USED;
+        int size = mAtlasSize >> level;
+        outTile->mX = x * size;
+        outTile->mY = y * size;
+        outTile->mSize = size;
+        return true;
+    }
+
+    for (NodeState pass : {NODE_SPLIT, NODE_FREE}) {
+        if (state == NODE_FREE && pass == NODE_SPLIT) continue;
+        for (int i = 0; i < 4; i++) {
+            int cx = x * 2 + (i & 1);
+            int cy = y * 2 + (i >> 1);
+            if (mNodes[NodeIndex(level + 1, cx, cy)] != pass) continue;
+            NodeState oldState = state;
+            state = NODE_SPLIT;
+            if (AllocateNode(level + 1, cx, cy, targetLevel, outTile)) {
+                return true;
+            }
+            state = oldState;
+        }
+    }
+    return false;
+}
+
+
+ShadowTile ShadowAtlas::Allocate(int size)
+{
+    ShadowTile tile;
+    int level = mNumLevels - 1;
+    while (level > 0 && (mAtlasSize >> level) < size) {
+        level--;
+    }
+    if ((mAtlasSize >> level) < size) return tile;
+    if (AllocateNode(0, 0, 0, level, &tile)) {
+        mUsedArea += (int64_t)tile.mSize * tile.mSize;
+    }
+    return tile;
+}
+
+
+void ShadowAtlas::Free(ShadowTile *tile)
+{
+    if (tile->mSize == 0) return;
+    int level = 0;
+    while ((mAtlasSize >> level) > tile->mSize) {
+        level++;
+    }
+    int x = tile->mX / tile->mSize;
+    int y = tile->mY / tile->mSize;
+    SDL_assert(mNodes[NodeIndex(level, x, y)] == NODE_USED);
+    mNodes[NodeIndex(level, x, y)] = NODE_FREE;
+    mUsedArea -= (int64_t)tile->mSize * tile->mSize;
+
+    // Merge parents whose children are all free again.
+    while (level > 0) {
+        int px = x / 2;
+        int py = y / 2;
+        bool allFree = true;
+        for (int i = 0; i < 4; i++) {
+            int cx = px * 2 + (i & 1);
+            int cy = py * 2 + (i >> 1);
+            allFree &= mNodes[NodeIndex(level, cx, cy)] == NODE_FREE;
+        }
+        if (!allFree) break;
+        level--;
+        x = px;
+        y = py;
+        mNodes[NodeIndex(level, x, y)] = NODE_FREE;
+    }
+    *tile = ShadowTile();
+}
+
+
+int ShadowAtlas::GetAtlasSize() const       { return mAtlasSize; }
+int ShadowAtlas::GetMinTileSize() const     { return mMinTileSize; }
+
+
+float ShadowAtlas::GetUsage() const
+{
+    if (mAtlasSize == 0) return 0.0f;
+    return (float)mUsedArea / ((float)mAtlasSize * mAtlasSize);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Quadtree allocator for square shadow map tiles in a square atlas. Tiles are
+ * powers of two between the minimum tile size and the atlas size, and each
+ * one is a node of the tree, so a freed tile always leaves a hole that fits
+ * any tile of the same size or smaller. Freed siblings are merged back into
+ * their parent.
+ *
+ * Only the layout is managed here, the texture itself never changes size.
+ */
+
+struct ShadowTile {
+    int mX = 0;
+    int mY = 0;
+    // 0 if nothing is allocated
+    int mSize = 0;
+};
+
+struct ShadowAtlas {
+    /* Frees every tile. atlasSize and minTileSize must be powers of two. */
+    void Init(int atlasSize, int minTileSize);
+    /* Allocates a tile of size, rounded up to a power of two and to at least
+     * the minimum tile size. Returns a tile with mSize 0 if there is no free
+     * node that big. */
+    ShadowTile Allocate(int size);
+    /* Frees tile and resets it. Does nothing for an empty tile. */
+    void Free(ShadowTile *tile);
+    int GetAtlasSize() const;
+    int GetMinTileSize() const;
+    /* Area of the atlas in allocated tiles, from 0 to 1. */
+    float GetUsage() const;
+
+private:
+    enum NodeState : uint8_t {
+        NODE_FREE,
+        NODE_SPLIT,
+        NODE_USED
+    };
+
+    int NodeIndex(int level, int x, int y) const;
+    bool AllocateNode(int level, int x, int y, int targetLevel, ShadowTile *outTile);
+
+    int mAtlasSize = 0;
+    int mMinTileSize = 0;
+    // Level 0 is the whole atlas and mNumLevels - 1 the smallest tiles
+    int mNumLevels = 0;
+    // Every level of the tree one after the other, each a row major grid
+    std::vector<NodeState> mNodes;
+    int64_t mUsedArea = 0;
+};
@@ -152,6 +152,7 @@ VehicleSettings GetVehicleSettingsFromFile(const char* filename)
     VehicleSettings vs;
     vs.modelFile      = j["model_file"];
     vs.wheelModelFile = j["wheel_model_file"];
+    vs.paintMaterial  = j.value("paint_material", "");
     vs.mass           = j["mass"];
     vs.frontCamber    = glm::radians((float) j["front_camber"]);
     vs.frontToe       = glm::radians((float) j["front_toe"]);
@@ -182,6 +183,13 @@ void VehicleSettings::Init()
     PrepareLoadCar(this);
     vehicleModel = LoadModel(modelFile.c_str(), CarNodeCallback);
     wheelModel = LoadModel(wheelModelFile.c_str());
+    if (!paintMaterial.empty()) {
+        paintMaterialIdx = vehicleModel->FindMaterial(paintMaterial.c_str());
+        if (paintMaterialIdx == -1) {
+            SDL_Log("Paint material %s not found in %s", paintMaterial.c_str(),
+                    modelFile.c_str());
+        }
+    }
 
     JPH::WheelSettings *fr = GetWheelFR();
     JPH::WheelSettings *fl = GetWheelFL();
@@ -229,6 +237,7 @@ void VehicleSettings::Destroy()
     delete wheelModel;
     vehicleModel = nullptr;
     wheelModel = nullptr;
+    paintMaterialIdx = -1;
     mCompoundShape = nullptr;
     mWheels.clear();
 }
@@ -371,6 +380,11 @@ JPH::WheelSettings* Vehicle::GetWheelFL()
 void Vehicle::Init(const VehicleSettings &settings)
 {
     mSettings = &settings;
+    // Start with the colour the paint has in the model.
+    if (settings.paintMaterialIdx != -1) {
+        glm::vec3 paint = settings.vehicleModel->materials[settings.paintMaterialIdx]->diffuseColour;
+        mPaintColour = JPH::Vec3(paint.x, paint.y, paint.z);
+    }
     JPH::PhysicsSystem &physicsSystem = Phys::GetPhysicsSystem();
     JPH::BodyInterface &bodyInterface = physicsSystem.GetBodyInterface();
 
@@ -537,6 +551,12 @@ void Vehicle::DebugGUI(unsigned int id)
     //motionProperties->SetMassProperties(JPH::EAllowedDOFs::All, massProperties);
 
     ImGui::Text("Mass: %f", 1.0 / motionProperties->GetInverseMass());
+    if (mSettings->paintMaterialIdx != -1) {
+        float paint[3] = {mPaintColour.GetX(), mPaintColour.GetY(), mPaintColour.GetZ()};
+        if (ImGui::ColorEdit3("Paint", paint)) {
+            mPaintColour = JPH::Vec3(paint[0], paint[1], paint[2]);
+        }
+    }
 
     int i = 0;
     for (JPH::Ref<JPH::WheelSettings> wheel : mSettings->mWheels) {
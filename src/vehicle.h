@@ -40,8 +40,13 @@ struct VehicleSettings
 
     std::string modelFile;
     std::string wheelModelFile;
+    // Name of the material in the vehicle model that is drawn with each
+    // vehicle's paint colour. Optional.
+    std::string paintMaterial;
     Model *vehicleModel = nullptr;
     Model *wheelModel = nullptr;
+    // Index of paintMaterial in the vehicle model, or -1 for no paint.
+    int paintMaterialIdx = -1;
     float mass;
     float frontCamber;
     float frontToe;
@@ -102,6 +107,8 @@ struct Vehicle
 
     Audio::Sound *engineSnd = nullptr;
     Audio::Sound *driftSnd = nullptr;
+    // Colour of the paint material, see VehicleSettings::paintMaterial
+    JPH::Vec3 mPaintColour = JPH::Vec3(1.0f, 1.0f, 1.0f);
     Render::SpotLight *headLightLeft = nullptr;
     Render::SpotLight *headLightRight = nullptr;
     JPH::RMat44 headLightLeftTransform;
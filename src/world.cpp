@@ -29,6 +29,10 @@ static VehicleSettings carSettings;
 static VehicleSettings carSettings2;
 
 static std::unique_ptr<Model> mapModel;
+// Maps are static, so their meshes are merged per material and per cell of
+// this size at load, see Model::BatchStatic(). Small enough that culling
+// still removes most of a big map. 0 keeps the nodes of the file.
+static float mapBatchCellSize = 64.0f;
 static glm::vec3 mapSpawnPoint = glm::vec3(0.0f);
 static std::vector<Checkpoint> existingCheckpoints;
 static Audio::Sound *checkpointSound;
@@ -130,8 +134,12 @@ static void ChangeMap(const char *modelFileName)
     existingCheckpoints.clear();
     // Reset shader spotlights to prevent phantom lights.
     Render::ResetSpotLightsGPU();
+    // Free the old map first, so that the new one can reuse its geometry
+    // pool ranges instead of both being allocated at once.
+    mapModel.reset();
     // Load the map
-    mapModel.reset(LoadModel(modelFileName, MapNodeCallback, LightCallback));
+    mapModel.reset(LoadModel(modelFileName, MapNodeCallback, LightCallback,
+                             mapBatchCellSize));
     Phys::LoadMap(*mapModel);
     // Sort checkpoints
     //std::sort(existingCheckpoints.begin(), existingCheckpoints.end(),
@@ -339,6 +347,7 @@ void World::Update(float delta)
 
     //static int currentItem = 0;
     ImGui::Combo("Map", &gMapOption.selectedChoice, gMapOption.optionStrings, gMapOption.numOptions);
+    ImGui::SliderFloat("Batch cell size (0 = off)", &mapBatchCellSize, 0.0f, 256.0f);
     if (ImGui::Button("Change map")) {
         ChangeMap(mapFilepaths[gMapOption.selectedChoice]);
     }
@@ -388,7 +397,8 @@ void World::Init()
 
     if (mapModel.get() == nullptr) {
         mapModel = std::unique_ptr<Model>(
-                LoadModel(mapFilepaths[gMapOption.selectedChoice], MapNodeCallback, LightCallback));
+                LoadModel(mapFilepaths[gMapOption.selectedChoice], MapNodeCallback, LightCallback,
+                          mapBatchCellSize));
     }
     Phys::LoadMap(*mapModel);
     